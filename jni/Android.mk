@@ -1,11 +1,30 @@
 LOCAL_PATH:= $(call my-dir)
 
+UVCC_SRC_FILES    := uvccap.c uvcc_ring.c uvcc_stats.c uvcc_backend.c uvcc_backend_fake.c uvcc_backend_replay.c uvcc_convert.c uvcc_convert_x86.c uvcc_pool.c uvcc_scale.c
+# NEON is optional on armeabi-v7a: only the kernels are built with it and picked at run time.
+ifeq ($(TARGET_ARCH_ABI),armeabi-v7a)
+UVCC_SRC_FILES    += uvcc_convert_neon.c.neon
+else
+UVCC_SRC_FILES    += uvcc_convert_neon.c
+endif
+
 include $(CLEAR_VARS)
 
 LOCAL_MODULE      := uvccap
 LOCAL_CFLAGS      := -Werror -Wall -O2
-LOCAL_SRC_FILES   := uvccap_main.c uvccap.c
+LOCAL_SRC_FILES   := uvccap_main.c uvccap_writer.c uvccap_uring.c $(UVCC_SRC_FILES)
 LOCAL_LDLIBS      := -llog
+LOCAL_STATIC_LIBRARIES := cpufeatures
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE      := uvccap_bench
+LOCAL_CFLAGS      := -Werror -Wall -O2
+LOCAL_SRC_FILES   := uvccap_bench.c $(UVCC_SRC_FILES)
+LOCAL_LDLIBS      := -llog
+LOCAL_STATIC_LIBRARIES := cpufeatures
 
 include $(BUILD_EXECUTABLE)
 
@@ -13,7 +32,10 @@ include $(CLEAR_VARS)
 
 LOCAL_MODULE      := uvcc
 LOCAL_CFLAGS      := -Werror -Wall -O2
-LOCAL_SRC_FILES   := uvccap.c
+LOCAL_SRC_FILES   := $(UVCC_SRC_FILES)
 LOCAL_LDLIBS      := -llog
+LOCAL_STATIC_LIBRARIES := cpufeatures
 
 include $(BUILD_SHARED_LIBRARY)
+
+$(call import-module,android/cpufeatures)
@@ -0,0 +1,69 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "uvcc_backend.h"
+
+/* Internal APIs */
+static int v4l2_open(char const *path, void **context);
+static int v4l2_close(void *context, int fd);
+static int v4l2_ioctl(void *context, int fd, unsigned long request, void *arg);
+static void *v4l2_mmap(void *context, int fd, size_t length, int prot, int flags, off_t offset);
+static int v4l2_munmap(void *context, void *addr, size_t length);
+
+uvcc_backend_t const uvcc_v4l2_backend = {
+	"v4l2",
+	v4l2_open,
+	v4l2_close,
+	v4l2_ioctl,
+	v4l2_mmap,
+	v4l2_munmap,
+	NULL,
+};
+
+static uvcc_backend_t const * const BACKENDS[] = {
+	&uvcc_fake_backend,
+	&uvcc_replay_backend,
+	NULL // sentinel
+};
+
+uvcc_backend_t const *uvcc_find_backend(char const *path, char const **args) {
+	size_t len;
+	int i;
+
+	for (i = 0; NULL != BACKENDS[i]; ++i) {
+		len = strlen(BACKENDS[i]->name);
+		if ((0 == strncmp(path, BACKENDS[i]->name, len)) && (':' == path[len])) {
+			*args = path + len + 1;
+			return BACKENDS[i];
+		}
+	}
+
+	*args = path;
+	return &uvcc_v4l2_backend;
+}
+
+static int v4l2_open(char const *path, void **context) {
+	*context = NULL;
+	return open(path, O_RDONLY);
+}
+
+static int v4l2_close(void *context, int fd) {
+	return close(fd);
+}
+
+static int v4l2_ioctl(void *context, int fd, unsigned long request, void *arg) {
+	return ioctl(fd, request, arg);
+}
+
+static void *v4l2_mmap(void *context, int fd, size_t length, int prot, int flags, off_t offset) {
+	return mmap(NULL, length, prot, flags, fd, offset);
+}
+
+static int v4l2_munmap(void *context, void *addr, size_t length) {
+	return munmap(addr, length);
+}
@@ -0,0 +1,76 @@
+#ifndef UVCC_BACKEND_H
+#define UVCC_BACKEND_H
+
+#include<stdint.h>
+#include<stddef.h>
+#include<sys/types.h>
+
+struct v4l2_buffer;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Device operations used by the capture library.
+ * 'open' returns a descriptor which becomes readable while a frame can be
+ * dequeued, so that poll() and epoll keep working with every backend.
+ * Failures are reported through -1 (MAP_FAILED for 'mmap') and errno,
+ * the same as the system calls they replace.
+ * 'frame_data' is optional: backends which hand out frames without
+ * copying them into the mapped buffer return where a dequeued frame
+ * really is, NULL means the mapped buffer.
+ */
+typedef struct uvcc_backend_t_ {
+	char const *name;
+	int   (*open)(char const *path, void **context);
+	int   (*close)(void *context, int fd);
+	int   (*ioctl)(void *context, int fd, unsigned long request, void *arg);
+	void *(*mmap)(void *context, int fd, size_t length, int prot, int flags, off_t offset);
+	int   (*munmap)(void *context, void *addr, size_t length);
+	void const *(*frame_data)(void *context, struct v4l2_buffer const *buf);
+} uvcc_backend_t;
+
+/*
+ * Frames for the emulated device. 'read_frame' returns 0 after the last
+ * frame, otherwise the payload of frame 'n' and the delay after the
+ * previous frame in microseconds (0 = as soon as a buffer is queued).
+ * The payload must stay valid until 'close' is called.
+ * A source which knows the format of its frames sets 'pixelformat' (V4L2)
+ * and its size; the device then offers only that format.
+ * 'bytesperline' may be 0 for the natural stride.
+ */
+typedef struct uvcc_fake_source_t_ {
+	void  *context;
+	uint32_t pixelformat; // 0 = any format
+	uint32_t width;
+	uint32_t height;
+	uint32_t bytesperline;
+	int  (*read_frame)(void *context, uint32_t n, void const **data, uint32_t *size, uint64_t *delay_us);
+	void (*close)(void *context);
+} uvcc_fake_source_t;
+
+extern uvcc_backend_t const uvcc_v4l2_backend;
+extern uvcc_backend_t const uvcc_fake_backend;
+extern uvcc_backend_t const uvcc_replay_backend;
+
+/* Emulated device core, shared by the backends which generate frames in-process. */
+extern int   uvcc_fake_open_source(char const *options, uvcc_fake_source_t const *source, void **context);
+extern int   uvcc_fake_close(void *context, int fd);
+extern int   uvcc_fake_ioctl(void *context, int fd, unsigned long request, void *arg);
+extern void *uvcc_fake_mmap(void *context, int fd, size_t length, int prot, int flags, off_t offset);
+extern int   uvcc_fake_munmap(void *context, void *addr, size_t length);
+extern void const *uvcc_fake_frame_data(void *context, struct v4l2_buffer const *buf);
+
+/*
+ * Pick the backend for 'path'. "scheme:arguments" selects an emulated
+ * device and '*args' points at the arguments; any other path is opened
+ * as a V4L2 device node.
+ */
+extern uvcc_backend_t const *uvcc_find_backend(char const *path, char const **args);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
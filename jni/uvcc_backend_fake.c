@@ -0,0 +1,786 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef __ANDROID__
+#include <linux/videodev.h>
+#else
+#include <linux/videodev2.h>
+#endif
+
+#include "uvcc_backend.h"
+
+/*
+ * In-process emulation of a V4L2 capture device.
+ * A generator thread fills queued buffers at a fixed frame rate and makes
+ * the eventfd returned by open() readable once per finished frame.
+ * Frames carry a test pattern unless a source supplies recorded frames.
+ * Options follow the "fake:" prefix as comma separated key=value pairs:
+ *   fps=N     frames per second, 0 generates as fast as buffers are queued.
+ *   jitter=N  random deviation of every frame in microseconds.
+ *   drop=N    probability of dropping a frame in 1/1000.
+ *   seed=N    seed of the jitter and drop sequence.
+ */
+
+#ifndef EFD_SEMAPHORE
+#define EFD_SEMAPHORE 1
+#endif
+#ifndef EFD_NONBLOCK
+#define EFD_NONBLOCK O_NONBLOCK
+#endif
+
+#define FAKE_MAX_BUFFERS 32
+#define FAKE_MIN_SIZE    16
+#define FAKE_MAX_SIZE    4096
+#define FAKE_DEF_WIDTH   640
+#define FAKE_DEF_HEIGHT  480
+#define FAKE_DEF_FPS     30
+
+enum FAKE_BUFFER_STATES {
+	FAKE_BUFFER_DEQUEUED = 0,
+	FAKE_BUFFER_QUEUED,
+	FAKE_BUFFER_DONE,
+};
+
+typedef struct fake_format_t_ {
+	uint32_t    pixelformat;
+	uint32_t    bits;        // bits per pixel over all planes
+	uint32_t    line_bits;   // bits per pixel in the first plane
+	char const *name;
+} fake_format_t;
+
+typedef struct fake_buf_t_ {
+	uint8_t           *addr;    // MMAP: owned by the device, USERPTR: set by QBUF
+	void const        *data;    // frame handed out without copying, or NULL
+	uint32_t           length;
+	int                state;
+	struct v4l2_buffer info;    // filled when the frame is done
+} fake_buf_t;
+
+typedef struct fake_dev_t_ {
+	int                event_fd;
+	pthread_t          thread;
+	pthread_mutex_t    lock;
+	pthread_cond_t     cond;
+	int                has_thread;
+	int                is_stopping;
+	int                is_ended;  // the source has no more frames
+	uvcc_fake_source_t source;
+	int                has_source;
+	struct v4l2_format format;
+	uint32_t           memory;
+	fake_buf_t         bufs[FAKE_MAX_BUFFERS];
+	uint32_t           buf_count;
+	uint32_t           queued[FAKE_MAX_BUFFERS]; // FIFO of buffers owned by the device
+	uint32_t           queued_head;
+	uint32_t           queued_count;
+	uint32_t           done[FAKE_MAX_BUFFERS];   // FIFO of finished frames
+	uint32_t           done_head;
+	uint32_t           done_count;
+	uint32_t           sequence;
+	uint32_t           fps;
+	uint32_t           jitter_us;
+	uint32_t           drop_permille;
+	uint32_t           random;
+} fake_dev_t;
+
+static fake_format_t const FAKE_FORMATS[] = {
+	{ V4L2_PIX_FMT_YUYV,    16, 16, "YUYV 4:2:2" },
+	{ V4L2_PIX_FMT_UYVY,    16, 16, "UYVY 4:2:2" },
+	{ V4L2_PIX_FMT_RGB565,  16, 16, "RGB565" },
+	{ V4L2_PIX_FMT_RGB32,   32, 32, "RGB32" },
+	{ V4L2_PIX_FMT_BGR32,   32, 32, "BGR32" },
+	{ V4L2_PIX_FMT_YUV420,  12,  8, "YUV 4:2:0" },
+	{ V4L2_PIX_FMT_YUV410,   9,  8, "YUV 4:1:0" },
+	{ V4L2_PIX_FMT_YUV422P, 16,  8, "YUV 4:2:2 planar" },
+	{ V4L2_PIX_FMT_NV12,    12,  8, "Y/CbCr 4:2:0" },
+	{ V4L2_PIX_FMT_NV21,    12,  8, "Y/CrCb 4:2:0" },
+	{ 0, 0, 0, NULL } // sentinel
+};
+
+/* Internal APIs */
+static int fake_open(char const *path, void **context);
+static void parse_options(fake_dev_t *fake, char const *options);
+static fake_format_t const *find_format(uint32_t pixelformat);
+static void set_format(fake_dev_t *fake, struct v4l2_format *fmt);
+static int accepts_format(fake_dev_t const *fake, struct v4l2_pix_format const *pix);
+static int request_buffers(fake_dev_t *fake, struct v4l2_requestbuffers *req);
+static void free_buffers(fake_dev_t *fake);
+static int query_buffer(fake_dev_t *fake, struct v4l2_buffer *buf);
+static int queue_buffer(fake_dev_t *fake, struct v4l2_buffer *buf);
+static int dequeue_buffer(fake_dev_t *fake, struct v4l2_buffer *buf);
+static int stream_on(fake_dev_t *fake);
+static void stream_off(fake_dev_t *fake);
+static void *generator_main(void *arg);
+static int next_frame(fake_dev_t *fake, void const **data, uint32_t *size, uint64_t *interval);
+static void fill_frame(fake_dev_t const *fake, fake_buf_t *buf, uint32_t sequence);
+static uint32_t next_random(fake_dev_t *fake);
+static uint64_t monotonic_us();
+
+uvcc_backend_t const uvcc_fake_backend = {
+	"fake",
+	fake_open,
+	uvcc_fake_close,
+	uvcc_fake_ioctl,
+	uvcc_fake_mmap,
+	uvcc_fake_munmap,
+	uvcc_fake_frame_data,
+};
+
+static int fake_open(char const *path, void **context) {
+	return uvcc_fake_open_source(path, NULL, context);
+}
+
+int uvcc_fake_open_source(char const *options, uvcc_fake_source_t const *source, void **context) {
+	fake_dev_t *fake;
+
+	fake = (fake_dev_t*)malloc(sizeof(fake_dev_t));
+	if (NULL == fake) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memset(fake, 0, sizeof(fake_dev_t));
+
+	// the counter of the eventfd is the number of finished frames.
+	fake->event_fd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK);
+	if (0 > fake->event_fd) {
+		free(fake);
+		return -1;
+	}
+	pthread_mutex_init(&fake->lock, NULL);
+	pthread_cond_init(&fake->cond, NULL);
+
+	fake->memory    = V4L2_MEMORY_MMAP;
+	fake->fps       = FAKE_DEF_FPS;
+	fake->random    = 1;
+	parse_options(fake, options);
+	if (NULL != source) {
+		fake->source     = *source;
+		fake->has_source = 1;
+	}
+
+	fake->format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	fake->format.fmt.pix.width       = FAKE_DEF_WIDTH;
+	fake->format.fmt.pix.height      = FAKE_DEF_HEIGHT;
+	fake->format.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+	if (fake->has_source && (0 != fake->source.pixelformat)) {
+		fake->format.fmt.pix.width       = fake->source.width;
+		fake->format.fmt.pix.height      = fake->source.height;
+		fake->format.fmt.pix.pixelformat = fake->source.pixelformat;
+	}
+	set_format(fake, &fake->format);
+
+	*context = fake;
+
+	return fake->event_fd;
+}
+
+int uvcc_fake_close(void *context, int fd) {
+	fake_dev_t *fake = (fake_dev_t*)context;
+
+	stream_off(fake);
+	free_buffers(fake);
+	if (fake->has_source && (NULL != fake->source.close)) {
+		fake->source.close(fake->source.context);
+	}
+	close(fake->event_fd);
+	pthread_cond_destroy(&fake->cond);
+	pthread_mutex_destroy(&fake->lock);
+	free(fake);
+
+	return 0;
+}
+
+int uvcc_fake_ioctl(void *context, int fd, unsigned long request, void *arg) {
+	fake_dev_t *fake = (fake_dev_t*)context;
+	int result = 0;
+
+	switch (request) {
+	case VIDIOC_QUERYCAP:
+		{
+			struct v4l2_capability *caps = (struct v4l2_capability*)arg;
+			memset(caps, 0, sizeof(*caps));
+			strncpy((char*)caps->driver,   "uvcc-fake", sizeof(caps->driver) - 1);
+			strncpy((char*)caps->card,     "Emulated capture device", sizeof(caps->card) - 1);
+			strncpy((char*)caps->bus_info, "virtual", sizeof(caps->bus_info) - 1);
+			caps->version      = 1;
+			caps->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+		}
+		break;
+	case VIDIOC_CROPCAP:
+		{
+			struct v4l2_cropcap *cropcap = (struct v4l2_cropcap*)arg;
+			cropcap->bounds.left   = 0;
+			cropcap->bounds.top    = 0;
+			cropcap->bounds.width  = FAKE_MAX_SIZE;
+			cropcap->bounds.height = FAKE_MAX_SIZE;
+			cropcap->defrect.left   = 0;
+			cropcap->defrect.top    = 0;
+			cropcap->defrect.width  = FAKE_DEF_WIDTH;
+			cropcap->defrect.height = FAKE_DEF_HEIGHT;
+			cropcap->pixelaspect.numerator   = 1;
+			cropcap->pixelaspect.denominator = 1;
+		}
+		break;
+	case VIDIOC_ENUM_FMT:
+		{
+			struct v4l2_fmtdesc *desc = (struct v4l2_fmtdesc*)arg;
+			uint32_t const index = desc->index;
+			if (index >= sizeof(FAKE_FORMATS) / sizeof(FAKE_FORMATS[0]) - 1) {
+				errno  = EINVAL;
+				result = -1;
+				break;
+			}
+			memset(desc, 0, sizeof(*desc));
+			desc->index       = index;
+			desc->type        = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			desc->pixelformat = FAKE_FORMATS[index].pixelformat;
+			strncpy((char*)desc->description, FAKE_FORMATS[index].name, sizeof(desc->description) - 1);
+		}
+		break;
+	case VIDIOC_S_FMT:
+		pthread_mutex_lock(&fake->lock);
+		if (fake->has_thread || (0 != fake->buf_count)) {
+			errno  = EBUSY;
+			result = -1;
+		} else if (!accepts_format(fake, &((struct v4l2_format*)arg)->fmt.pix)) {
+			// recorded frames can not be converted, report what the source has.
+			*(struct v4l2_format*)arg = fake->format;
+			errno  = EINVAL;
+			result = -1;
+		} else {
+			set_format(fake, (struct v4l2_format*)arg);
+			fake->format = *(struct v4l2_format*)arg;
+		}
+		pthread_mutex_unlock(&fake->lock);
+		break;
+	case VIDIOC_G_FMT:
+		*(struct v4l2_format*)arg = fake->format;
+		break;
+	case VIDIOC_G_PARM:
+		{
+			struct v4l2_streamparm *parm = (struct v4l2_streamparm*)arg;
+			memset(&parm->parm, 0, sizeof(parm->parm));
+			// free running devices and recordings have no nominal rate.
+			if ((0 < fake->fps) && !fake->has_source) {
+				parm->parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
+				parm->parm.capture.timeperframe.numerator   = 1;
+				parm->parm.capture.timeperframe.denominator = fake->fps;
+			}
+		}
+		break;
+	case VIDIOC_REQBUFS:
+		result = request_buffers(fake, (struct v4l2_requestbuffers*)arg);
+		break;
+	case VIDIOC_QUERYBUF:
+		result = query_buffer(fake, (struct v4l2_buffer*)arg);
+		break;
+	case VIDIOC_QBUF:
+		result = queue_buffer(fake, (struct v4l2_buffer*)arg);
+		break;
+	case VIDIOC_DQBUF:
+		result = dequeue_buffer(fake, (struct v4l2_buffer*)arg);
+		break;
+	case VIDIOC_STREAMON:
+		result = stream_on(fake);
+		break;
+	case VIDIOC_STREAMOFF:
+		stream_off(fake);
+		break;
+	default:
+		// cropping, buffer export and the like are not emulated.
+		errno  = EINVAL;
+		result = -1;
+		break;
+	}
+
+	return result;
+}
+
+void *uvcc_fake_mmap(void *context, int fd, size_t length, int prot, int flags, off_t offset) {
+	fake_dev_t *fake = (fake_dev_t*)context;
+	uint32_t const index = (uint32_t)(offset / getpagesize());
+
+	// the offset handed out by VIDIOC_QUERYBUF identifies the buffer.
+	if ((V4L2_MEMORY_MMAP != fake->memory) || (index >= fake->buf_count) || (length > fake->bufs[index].length)) {
+		errno = EINVAL;
+		return MAP_FAILED;
+	}
+
+	return fake->bufs[index].addr;
+}
+
+int uvcc_fake_munmap(void *context, void *addr, size_t length) {
+	// buffers stay with the device until VIDIOC_REQBUFS or close.
+	return 0;
+}
+
+void const *uvcc_fake_frame_data(void *context, struct v4l2_buffer const *buf) {
+	fake_dev_t const *fake = (fake_dev_t const*)context;
+
+	if (buf->index >= fake->buf_count) {
+		return NULL;
+	}
+	return fake->bufs[buf->index].data;
+}
+
+static void parse_options(fake_dev_t *fake, char const *options) {
+	char const *p = options;
+	char key[16];
+	uint32_t value;
+	size_t len;
+
+	while ((NULL != p) && ('\0' != *p)) {
+		len = strcspn(p, "=,");
+		if ((len < sizeof(key)) && ('=' == p[len])) {
+			memcpy(key, p, len);
+			key[len] = '\0';
+			value = (uint32_t)strtoul(p + len + 1, NULL, 10);
+			if (0 == strcmp(key, "fps")) {
+				fake->fps = value;
+			} else if (0 == strcmp(key, "jitter")) {
+				fake->jitter_us = value;
+			} else if (0 == strcmp(key, "drop")) {
+				fake->drop_permille = value;
+			} else if (0 == strcmp(key, "seed")) {
+				fake->random = (0 != value) ? value : 1;
+			}
+		}
+		p = strchr(p, ',');
+		if (NULL != p) {
+			++p;
+		}
+	}
+}
+
+static fake_format_t const *find_format(uint32_t pixelformat) {
+	int i;
+	for (i = 0; NULL != FAKE_FORMATS[i].name; ++i) {
+		if (pixelformat == FAKE_FORMATS[i].pixelformat) {
+			return &FAKE_FORMATS[i];
+		}
+	}
+	return NULL;
+}
+
+static void set_format(fake_dev_t *fake, struct v4l2_format *fmt) {
+	struct v4l2_pix_format *pix = &fmt->fmt.pix;
+	fake_format_t const *format = find_format(pix->pixelformat);
+
+	// adjust the request like a driver would do.
+	if (NULL == format) {
+		format = &FAKE_FORMATS[0];
+	}
+	if (fake->has_source && (0 != fake->source.pixelformat)) {
+		// recorded frames keep their size.
+		pix->width  = fake->source.width;
+		pix->height = fake->source.height;
+	} else {
+		if (pix->width < FAKE_MIN_SIZE) {
+			pix->width = FAKE_MIN_SIZE;
+		} else if (pix->width > FAKE_MAX_SIZE) {
+			pix->width = FAKE_MAX_SIZE;
+		}
+		if (pix->height < FAKE_MIN_SIZE) {
+			pix->height = FAKE_MIN_SIZE;
+		} else if (pix->height > FAKE_MAX_SIZE) {
+			pix->height = FAKE_MAX_SIZE;
+		}
+		pix->width  &= ~3u;
+		pix->height &= ~3u;
+	}
+	pix->pixelformat  = format->pixelformat;
+	pix->field        = V4L2_FIELD_NONE;
+	pix->bytesperline = pix->width * format->line_bits / 8;
+	pix->sizeimage    = pix->width * pix->height * format->bits / 8;
+	pix->colorspace   = V4L2_COLORSPACE_SMPTE170M;
+	if (fake->has_source && (pix->bytesperline < fake->source.bytesperline)) {
+		// recorded with padded lines, the other planes are padded alike.
+		pix->bytesperline = fake->source.bytesperline;
+		pix->sizeimage    = pix->bytesperline * pix->height * format->bits / format->line_bits;
+	}
+}
+
+static int accepts_format(fake_dev_t const *fake, struct v4l2_pix_format const *pix) {
+	if (!fake->has_source || (0 == fake->source.pixelformat)) {
+		return 1;
+	}
+	return (pix->pixelformat == fake->source.pixelformat) &&
+		(pix->width == fake->source.width) && (pix->height == fake->source.height);
+}
+
+static int request_buffers(fake_dev_t *fake, struct v4l2_requestbuffers *req) {
+	uint32_t const page = getpagesize();
+	uint32_t length;
+	uint32_t i;
+
+	if ((V4L2_MEMORY_MMAP != req->memory) && (V4L2_MEMORY_USERPTR != req->memory)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (fake->has_thread) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	free_buffers(fake);
+	fake->memory = req->memory;
+
+	if (req->count > FAKE_MAX_BUFFERS) {
+		req->count = FAKE_MAX_BUFFERS;
+	}
+
+	length = (fake->format.fmt.pix.sizeimage + page - 1) & ~(page - 1);
+	for (i = 0; i < req->count; ++i) {
+		fake->bufs[i].length = length;
+		fake->bufs[i].state  = FAKE_BUFFER_DEQUEUED;
+		fake->bufs[i].addr   = NULL;
+		if (V4L2_MEMORY_MMAP == req->memory) {
+			fake->bufs[i].addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (MAP_FAILED == (void*)fake->bufs[i].addr) {
+				fake->bufs[i].addr = NULL;
+				break;
+			}
+		}
+	}
+	fake->buf_count = i;
+	req->count      = i;
+
+	return 0;
+}
+
+static void free_buffers(fake_dev_t *fake) {
+	uint32_t i;
+
+	for (i = 0; i < fake->buf_count; ++i) {
+		if ((V4L2_MEMORY_MMAP == fake->memory) && (NULL != fake->bufs[i].addr)) {
+			munmap(fake->bufs[i].addr, fake->bufs[i].length);
+		}
+		fake->bufs[i].addr = NULL;
+	}
+	fake->buf_count    = 0;
+	fake->queued_count = 0;
+	fake->done_count   = 0;
+}
+
+static int query_buffer(fake_dev_t *fake, struct v4l2_buffer *buf) {
+	uint32_t const index = buf->index;
+
+	if (index >= fake->buf_count) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(buf, 0, sizeof(*buf));
+	buf->index    = index;
+	buf->type     = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf->memory   = fake->memory;
+	buf->length   = fake->bufs[index].length;
+	buf->m.offset = index * getpagesize();
+	if (FAKE_BUFFER_QUEUED == fake->bufs[index].state) {
+		buf->flags |= V4L2_BUF_FLAG_QUEUED;
+	} else if (FAKE_BUFFER_DONE == fake->bufs[index].state) {
+		buf->flags |= V4L2_BUF_FLAG_DONE;
+	}
+
+	return 0;
+}
+
+static int queue_buffer(fake_dev_t *fake, struct v4l2_buffer *buf) {
+	fake_buf_t *fbuf;
+	int result = 0;
+
+	pthread_mutex_lock(&fake->lock);
+
+	if ((buf->index >= fake->buf_count) || (buf->memory != fake->memory)) {
+		errno  = EINVAL;
+		result = -1;
+	} else if (FAKE_BUFFER_DEQUEUED != fake->bufs[buf->index].state) {
+		errno  = EINVAL;
+		result = -1;
+	} else if ((V4L2_MEMORY_USERPTR == fake->memory) &&
+			((0 == buf->m.userptr) || (buf->length < fake->format.fmt.pix.sizeimage))) {
+		errno  = EINVAL;
+		result = -1;
+	} else {
+		fbuf = &fake->bufs[buf->index];
+		if (V4L2_MEMORY_USERPTR == fake->memory) {
+			fbuf->addr   = (uint8_t*)buf->m.userptr;
+			fbuf->length = buf->length;
+		}
+		fbuf->state = FAKE_BUFFER_QUEUED;
+		fake->queued[(fake->queued_head + fake->queued_count) % FAKE_MAX_BUFFERS] = buf->index;
+		++fake->queued_count;
+		pthread_cond_broadcast(&fake->cond);
+	}
+
+	pthread_mutex_unlock(&fake->lock);
+
+	return result;
+}
+
+static int dequeue_buffer(fake_dev_t *fake, struct v4l2_buffer *buf) {
+	uint64_t value;
+	uint32_t index;
+
+	pthread_mutex_lock(&fake->lock);
+
+	// blocks like a device opened without O_NONBLOCK.
+	while ((0 == fake->done_count) && fake->has_thread && !fake->is_ended) {
+		pthread_cond_wait(&fake->cond, &fake->lock);
+	}
+	if (0 == fake->done_count) {
+		pthread_mutex_unlock(&fake->lock);
+		errno = fake->is_ended ? EPIPE : EINVAL;
+		return -1;
+	}
+
+	index = fake->done[fake->done_head];
+	fake->done_head = (fake->done_head + 1) % FAKE_MAX_BUFFERS;
+	--fake->done_count;
+	fake->bufs[index].state = FAKE_BUFFER_DEQUEUED;
+	*buf = fake->bufs[index].info;
+	read(fake->event_fd, &value, sizeof(value));
+
+	pthread_mutex_unlock(&fake->lock);
+
+	return 0;
+}
+
+static int stream_on(fake_dev_t *fake) {
+	if (fake->has_thread) {
+		return 0;
+	}
+	if (0 == fake->buf_count) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	fake->is_stopping = 0;
+	fake->is_ended    = 0;
+	fake->sequence    = 0;
+	fake->has_thread  = 1;
+	if (0 != pthread_create(&fake->thread, NULL, generator_main, fake)) {
+		fake->has_thread = 0;
+		errno = ENOMEM;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void stream_off(fake_dev_t *fake) {
+	uint64_t value;
+	uint32_t i;
+
+	if (fake->has_thread) {
+		pthread_mutex_lock(&fake->lock);
+		fake->is_stopping = 1;
+		pthread_cond_broadcast(&fake->cond);
+		pthread_mutex_unlock(&fake->lock);
+		pthread_join(fake->thread, NULL);
+		fake->has_thread = 0;
+	}
+
+	// every buffer goes back to the application.
+	pthread_mutex_lock(&fake->lock);
+	for (i = 0; i < fake->buf_count; ++i) {
+		fake->bufs[i].state = FAKE_BUFFER_DEQUEUED;
+	}
+	fake->queued_count = 0;
+	fake->done_count   = 0;
+	fake->is_ended     = 0;
+	while (0 < read(fake->event_fd, &value, sizeof(value))) {
+	}
+	pthread_cond_broadcast(&fake->cond);
+	pthread_mutex_unlock(&fake->lock);
+}
+
+static void *generator_main(void *arg) {
+	fake_dev_t *fake = (fake_dev_t*)arg;
+	uint64_t const value = 1;
+	uint64_t next = monotonic_us();
+	uint64_t deadline = 0;
+	uint64_t interval = 0;
+	uint64_t now, wait;
+	void const *data = NULL;
+	uint32_t size = 0;
+	struct timeval tv;
+	struct timespec ts;
+	uint32_t sequence;
+	uint32_t index;
+	int32_t jitter;
+	int has_frame = 0;
+	fake_buf_t *buf;
+
+	pthread_mutex_lock(&fake->lock);
+
+	while (!fake->is_stopping) {
+		if (!has_frame) {
+			if (!next_frame(fake, &data, &size, &interval)) {
+				// keep the descriptor readable so that the next VIDIOC_DQBUF reports the end.
+				fake->is_ended = 1;
+				write(fake->event_fd, &value, sizeof(value));
+				pthread_cond_broadcast(&fake->cond);
+				while (!fake->is_stopping) {
+					pthread_cond_wait(&fake->cond, &fake->lock);
+				}
+				break;
+			}
+			jitter    = ((0 < fake->jitter_us) && (0 < interval)) ? (int32_t)(next_random(fake) % (2 * fake->jitter_us + 1)) - (int32_t)fake->jitter_us : 0;
+			next     += interval;
+			deadline  = next + jitter;
+			has_frame = 1;
+		}
+
+		if (0 == interval) {
+			// free running: a frame per queued buffer.
+			if (0 == fake->queued_count) {
+				pthread_cond_wait(&fake->cond, &fake->lock);
+				continue;
+			}
+		} else {
+			now = monotonic_us();
+			if (now < deadline) {
+				// condition variables wait on the wall clock.
+				wait = deadline - now;
+				gettimeofday(&tv, NULL);
+				ts.tv_sec  = tv.tv_sec + wait / 1000000;
+				ts.tv_nsec = (tv.tv_usec + wait % 1000000) * 1000;
+				if (ts.tv_nsec >= 1000000000) {
+					ts.tv_sec  += 1;
+					ts.tv_nsec -= 1000000000;
+				}
+				// woken up by QBUF or stop requests as well, the deadline is kept.
+				pthread_cond_timedwait(&fake->cond, &fake->lock, &ts);
+				continue;
+			}
+			// a late frame resets the clock instead of bursting to catch up.
+			if (now > next + interval) {
+				next = now;
+			}
+		}
+		has_frame = 0;
+
+		sequence = fake->sequence++;
+
+		if ((0 < fake->drop_permille) && ((next_random(fake) % 1000) < fake->drop_permille)) {
+			continue;
+		}
+		if (0 == fake->queued_count) {
+			// no buffer to fill, the frame is lost like on real hardware.
+			continue;
+		}
+
+		index = fake->queued[fake->queued_head];
+		fake->queued_head = (fake->queued_head + 1) % FAKE_MAX_BUFFERS;
+		--fake->queued_count;
+		buf = &fake->bufs[index];
+		buf->data = NULL;
+		if (size > buf->length) {
+			size = buf->length;
+		}
+
+		pthread_mutex_unlock(&fake->lock);
+		if (NULL == data) {
+			fill_frame(fake, buf, sequence);
+		} else if (V4L2_MEMORY_MMAP == fake->memory) {
+			// recorded frames are handed out where they are.
+			buf->data = data;
+		} else {
+			memcpy(buf->addr, data, size);
+		}
+		pthread_mutex_lock(&fake->lock);
+
+		if (fake->is_stopping) {
+			break;
+		}
+
+		memset(&buf->info, 0, sizeof(buf->info));
+		buf->info.index     = index;
+		buf->info.type      = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf->info.memory    = fake->memory;
+		buf->info.bytesused = size;
+		buf->info.length    = buf->length;
+		buf->info.field     = V4L2_FIELD_NONE;
+		buf->info.sequence  = sequence;
+		buf->info.flags     = V4L2_BUF_FLAG_DONE;
+#ifdef V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC
+		buf->info.flags    |= V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+		now = monotonic_us();
+#else
+		gettimeofday(&tv, NULL);
+		now = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+		buf->info.timestamp.tv_sec  = now / 1000000;
+		buf->info.timestamp.tv_usec = now % 1000000;
+		if (V4L2_MEMORY_USERPTR == fake->memory) {
+			buf->info.m.userptr = (unsigned long)buf->addr;
+		} else {
+			buf->info.m.offset = index * getpagesize();
+		}
+		buf->state = FAKE_BUFFER_DONE;
+
+		fake->done[(fake->done_head + fake->done_count) % FAKE_MAX_BUFFERS] = index;
+		++fake->done_count;
+		write(fake->event_fd, &value, sizeof(value));
+		pthread_cond_broadcast(&fake->cond);
+	}
+
+	pthread_mutex_unlock(&fake->lock);
+
+	return NULL;
+}
+
+static int next_frame(fake_dev_t *fake, void const **data, uint32_t *size, uint64_t *interval) {
+	if (fake->has_source) {
+		return fake->source.read_frame(fake->source.context, fake->sequence, data, size, interval);
+	}
+
+	*data     = NULL;
+	*size     = fake->format.fmt.pix.sizeimage;
+	*interval = (0 < fake->fps) ? 1000000 / fake->fps : 0;
+
+	return 1;
+}
+
+static void fill_frame(fake_dev_t const *fake, fake_buf_t *buf, uint32_t sequence) {
+	uint32_t const stride = fake->format.fmt.pix.bytesperline;
+	uint32_t const size   = fake->format.fmt.pix.sizeimage;
+	uint32_t offset;
+	uint32_t line;
+
+	// diagonal stripes moving with the sequence number, so frames differ.
+	for (offset = 0, line = 0; offset + stride <= size; offset += stride, ++line) {
+		memset(buf->addr + offset, (uint8_t)(line + sequence), stride);
+	}
+	if (offset < size) {
+		memset(buf->addr + offset, (uint8_t)sequence, size - offset);
+	}
+	if (sizeof(sequence) <= size) {
+		memcpy(buf->addr, &sequence, sizeof(sequence));
+	}
+}
+
+static uint32_t next_random(fake_dev_t *fake) {
+	// xorshift32, the same seed reproduces the same jitter and drops.
+	uint32_t x = fake->random;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	fake->random = x;
+	return x;
+}
+
+static uint64_t monotonic_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,386 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __ANDROID__
+#include <linux/videodev.h>
+#else
+#include <linux/videodev2.h>
+#endif
+
+#include "uvcc_backend.h"
+#include "uvcc_record.h"
+
+/*
+ * Replays frames dumped by uvccap ("prefix.0", "prefix.1", ...) or a
+ * segmented recording ("prefix.idx", see uvcc_record.h) through the
+ * emulated device. Every file is mapped read-only and handed out
+ * without copying when the application uses memory mapped buffers.
+ * Segmented recordings keep the recorded time between frames.
+ * The path is followed by options of the emulated device and:
+ *   fps=N     frame rate of the recording (default: 30, or the recorded
+ *             timestamps of a segmented recording).
+ *   speed=X   replay speed factor, 0 replays as fast as buffers are queued.
+ *   loop=1    start over after the last frame instead of failing DQBUF.
+ */
+
+#define REPLAY_DEF_FPS 30
+
+typedef struct replay_frame_t_ {
+	void const *addr;
+	uint32_t    size;
+	uint64_t    delay_us;  // after the previous frame of a segmented recording.
+} replay_frame_t;
+
+typedef struct replay_map_t_ {
+	void  *addr;
+	size_t size;
+} replay_map_t;
+
+typedef struct replay_t_ {
+	replay_frame_t *frames;
+	uint32_t        count;
+	replay_map_t   *maps;
+	uint32_t        map_count;
+	uint64_t        interval_us;
+	double          speed;
+	int             use_timestamps;
+	int             loop;
+	uvcc_record_entry_t format; // first entry of the index, width 0 without one
+} replay_t;
+
+/* Internal APIs */
+static int replay_open(char const *path, void **context);
+static int replay_read_frame(void *context, uint32_t n, void const **data, uint32_t *size, uint64_t *delay_us);
+static void replay_close(void *context);
+static uint32_t to_v4l2_pixel_format(uint32_t format);
+static int map_recording(replay_t *replay, char const *prefix);
+static int map_segments(replay_t *replay, char const *prefix, int fd);
+static void *map_file(replay_t *replay, char const *path, size_t *size);
+static void parse_options(char const *options, double *fps, double *speed, int *loop);
+
+uvcc_backend_t const uvcc_replay_backend = {
+	"replay",
+	replay_open,
+	uvcc_fake_close,
+	uvcc_fake_ioctl,
+	uvcc_fake_mmap,
+	uvcc_fake_munmap,
+	uvcc_fake_frame_data,
+};
+
+static int replay_open(char const *path, void **context) {
+	uvcc_fake_source_t source;
+	replay_t *replay;
+	char prefix[4096];
+	char const *options;
+	double fps   = -1.0;
+	double speed = 1.0;
+	int loop     = 0;
+	size_t len;
+	int fd;
+
+	len     = strcspn(path, ",");
+	options = ('\0' != path[len]) ? path + len + 1 : "";
+	if ((0 == len) || (len >= sizeof(prefix))) {
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(prefix, path, len);
+	prefix[len] = '\0';
+
+	parse_options(options, &fps, &speed, &loop);
+
+	replay = (replay_t*)malloc(sizeof(replay_t));
+	if (NULL == replay) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memset(replay, 0, sizeof(replay_t));
+	replay->loop           = loop;
+	replay->speed          = speed;
+	replay->use_timestamps = (0.0 > fps) && (0.0 < speed);
+	if (0.0 > fps) {
+		fps = REPLAY_DEF_FPS;
+	}
+	replay->interval_us = ((0.0 < fps) && (0.0 < speed)) ? (uint64_t)(1000000.0 / (fps * speed)) : 0;
+
+	if (0 != map_recording(replay, prefix)) {
+		replay_close(replay);
+		return -1;
+	}
+
+	memset(&source, 0, sizeof(source));
+	source.context    = replay;
+	source.read_frame = replay_read_frame;
+	source.close      = replay_close;
+	if (0 < replay->format.width) {
+		source.pixelformat  = to_v4l2_pixel_format(replay->format.pixel_format);
+		source.width        = replay->format.width;
+		source.height       = replay->format.height;
+		source.bytesperline = replay->format.stride;
+	}
+
+	fd = uvcc_fake_open_source(options, &source, context);
+	if (0 > fd) {
+		replay_close(replay);
+	}
+
+	return fd;
+}
+
+static int replay_read_frame(void *context, uint32_t n, void const **data, uint32_t *size, uint64_t *delay_us) {
+	replay_t const *replay = (replay_t const*)context;
+
+	if (n >= replay->count) {
+		if (!replay->loop) {
+			return 0;
+		}
+		n %= replay->count;
+	}
+
+	*data     = replay->frames[n].addr;
+	*size     = replay->frames[n].size;
+	*delay_us = replay->interval_us;
+	if (replay->use_timestamps && (0 < n)) {
+		*delay_us = (uint64_t)(replay->frames[n].delay_us / replay->speed);
+	}
+
+	return 1;
+}
+
+static void replay_close(void *context) {
+	replay_t *replay = (replay_t*)context;
+	uint32_t i;
+
+	for (i = 0; i < replay->map_count; ++i) {
+		munmap(replay->maps[i].addr, replay->maps[i].size);
+	}
+	free(replay->maps);
+	free(replay->frames);
+	free(replay);
+}
+
+static int map_recording(replay_t *replay, char const *prefix) {
+	replay_frame_t *frames;
+	uint32_t capacity = 0;
+	char path[4096 + 16];
+	size_t size;
+	void *addr;
+	int fd;
+
+	snprintf(path, sizeof(path), UVCC_RECORD_INDEX_NAME, prefix);
+	fd = open(path, O_RDONLY);
+	if (0 <= fd) {
+		return map_segments(replay, prefix, fd);
+	}
+
+	for (; ; ) {
+		snprintf(path, sizeof(path), "%s.%u", prefix, replay->count);
+		addr = map_file(replay, path, &size);
+		if (NULL == addr) {
+			if (ENOMEM == errno) {
+				return -1;
+			}
+			break;
+		}
+
+		if (replay->count == capacity) {
+			capacity = (0 < capacity) ? capacity * 2 : 64;
+			frames = (replay_frame_t*)realloc(replay->frames, sizeof(replay_frame_t) * capacity);
+			if (NULL == frames) {
+				errno = ENOMEM;
+				return -1;
+			}
+			replay->frames = frames;
+		}
+		replay->frames[replay->count].addr     = addr;
+		replay->frames[replay->count].size     = (uint32_t)size;
+		replay->frames[replay->count].delay_us = 0;
+		++replay->count;
+	}
+	// prefix.N files carry no timestamps.
+	replay->use_timestamps = 0;
+
+	if (0 == replay->count) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Map every segment once and point the frames of the index into them. */
+static int map_segments(replay_t *replay, char const *prefix, int fd) {
+	uvcc_record_header_t header;
+	uvcc_record_entry_t entry;
+	char path[4096 + 16];
+	uint8_t const **segments = NULL;
+	size_t *sizes = NULL;
+	uint32_t segment_count = 0;
+	uint64_t previous = 0;
+	struct stat st;
+	FILE *fp;
+	void *p;
+	uint32_t i;
+	int ret = -1;
+
+	fp = fdopen(fd, "rb");
+	if (NULL == fp) {
+		close(fd);
+		return -1;
+	}
+	if ((1 != fread(&header, sizeof(header), 1, fp)) ||
+		(0 != memcmp(header.magic, UVCC_RECORD_MAGIC, sizeof(header.magic))) ||
+		(UVCC_RECORD_VERSION != header.version) ||
+		(header.header_size < sizeof(header)) || (header.entry_size < sizeof(entry)) ||
+		(0 != fstat(fd, &st)) || (0 != fseek(fp, header.header_size, SEEK_SET))) {
+		errno = EINVAL;
+		goto done;
+	}
+
+	replay->count  = (uint32_t)((st.st_size - header.header_size) / header.entry_size);
+	replay->frames = (replay_frame_t*)calloc((0 < replay->count) ? replay->count : 1, sizeof(replay_frame_t));
+	if (NULL == replay->frames) {
+		errno = ENOMEM;
+		goto done;
+	}
+
+	for (i = 0; i < replay->count; ++i) {
+		if ((1 != fread(&entry, sizeof(entry), 1, fp)) ||
+			(0 != fseek(fp, header.entry_size - sizeof(entry), SEEK_CUR))) {
+			errno = EINVAL;
+			goto done;
+		}
+		// segments are written in order, the index never skips one.
+		if (entry.segment >= segment_count) {
+			if (entry.segment != segment_count) {
+				errno = EINVAL;
+				goto done;
+			}
+			p = realloc(segments, sizeof(*segments) * (segment_count + 1));
+			if (NULL == p) {
+				errno = ENOMEM;
+				goto done;
+			}
+			segments = (uint8_t const**)p;
+			p = realloc(sizes, sizeof(*sizes) * (segment_count + 1));
+			if (NULL == p) {
+				errno = ENOMEM;
+				goto done;
+			}
+			sizes = (size_t*)p;
+			snprintf(path, sizeof(path), UVCC_RECORD_SEGMENT_NAME, prefix, segment_count);
+			segments[segment_count] = (uint8_t const*)map_file(replay, path, &sizes[segment_count]);
+			if (NULL == segments[segment_count]) {
+				goto done;
+			}
+			++segment_count;
+		}
+		if ((entry.offset > sizes[entry.segment]) || (entry.size > sizes[entry.segment] - entry.offset)) {
+			errno = EINVAL;
+			goto done;
+		}
+		// frames are played in the format of the first one, when it was recorded.
+		if ((0 == i) && (0 != to_v4l2_pixel_format(entry.pixel_format)) && (0 < entry.width) && (0 < entry.height)) {
+			replay->format = entry;
+		}
+		replay->frames[i].addr     = segments[entry.segment] + entry.offset;
+		replay->frames[i].size     = entry.size;
+		replay->frames[i].delay_us = ((0 < i) && (entry.timestamp > previous)) ? entry.timestamp - previous : 0;
+		previous = entry.timestamp;
+	}
+	ret = 0;
+
+	if (0 == replay->count) {
+		errno = ENOENT;
+		ret = -1;
+	}
+
+done:
+	free(sizes);
+	free(segments);
+	fclose(fp);
+
+	return ret;
+}
+
+/* Map a whole file read-only; NULL with errno set when it is missing, empty or fails. */
+static void *map_file(replay_t *replay, char const *path, size_t *size) {
+	replay_map_t *maps;
+	struct stat st;
+	void *addr;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (0 > fd) {
+		return NULL;
+	}
+	if ((0 != fstat(fd, &st)) || (0 == st.st_size)) {
+		close(fd);
+		errno = ENOENT;
+		return NULL;
+	}
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (MAP_FAILED == addr) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	// replay faster than the page cache would be filled on demand.
+	madvise(addr, st.st_size, MADV_WILLNEED);
+
+	maps = (replay_map_t*)realloc(replay->maps, sizeof(replay_map_t) * (replay->map_count + 1));
+	if (NULL == maps) {
+		munmap(addr, st.st_size);
+		errno = ENOMEM;
+		return NULL;
+	}
+	replay->maps = maps;
+	replay->maps[replay->map_count].addr = addr;
+	replay->maps[replay->map_count].size = st.st_size;
+	++replay->map_count;
+
+	*size = st.st_size;
+	return addr;
+}
+
+static void parse_options(char const *options, double *fps, double *speed, int *loop) {
+	char const *p = options;
+
+	while ((NULL != p) && ('\0' != *p)) {
+		if (0 == strncmp(p, "fps=", 4)) {
+			*fps = strtod(p + 4, NULL);
+		} else if (0 == strncmp(p, "speed=", 6)) {
+			*speed = strtod(p + 6, NULL);
+		} else if (0 == strncmp(p, "loop=", 5)) {
+			*loop = atoi(p + 5);
+		}
+		p = strchr(p, ',');
+		if (NULL != p) {
+			++p;
+		}
+	}
+}
+
+static uint32_t to_v4l2_pixel_format(uint32_t format) {
+	// indexed by enum PIXEL_FORMATS.
+	static uint32_t const formats[] = {
+		V4L2_PIX_FMT_RGB565,
+		V4L2_PIX_FMT_RGB32,
+		V4L2_PIX_FMT_BGR32,
+		V4L2_PIX_FMT_YUYV,
+		V4L2_PIX_FMT_UYVY,
+		V4L2_PIX_FMT_YUV420,
+		V4L2_PIX_FMT_YUV410,
+		V4L2_PIX_FMT_YUV422P,
+		V4L2_PIX_FMT_NV12,
+		V4L2_PIX_FMT_NV21,
+	};
+	return (format < sizeof(formats) / sizeof(formats[0])) ? formats[format] : 0;
+}
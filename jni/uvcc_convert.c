@@ -0,0 +1,336 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "uvccap.h"
+#include "uvcc_convert.h"
+
+// bytes read and written per tile handed to the thread pool, about half of a typical L2.
+#define CONVERT_TILE_BYTES (128 * 1024)
+
+typedef struct rgb_job_t_ {
+	uvcc_convert_kernels_t const *kernels;
+	uvcc_yuv_coeffs_t const      *k;
+	uint8_t const *src;
+	uint32_t       src_stride;
+	uint32_t       src_format;
+	uint8_t       *dst;
+	uint32_t       dst_stride;
+	uint32_t       dst_format;
+	uint32_t       width;
+} rgb_job_t;
+
+typedef struct yuv420_job_t_ {
+	uvcc_convert_kernels_t const *kernels;
+	uint8_t const *src;
+	uint32_t       src_stride;
+	uint32_t       src_format;
+	uvcc_planes_t  dst;
+	uint32_t       dst_format;
+	uint32_t       chroma_step; // bytes per pixel pair in a chroma row
+	uint32_t       width;
+	uint32_t       height;
+} yuv420_job_t;
+
+/* indexed by UVCC_COLOR_SPACES; see uvcc_yuv_coeffs_t for the formula. */
+static uvcc_yuv_coeffs_t const YUV_COEFFS[] = {
+	{ 16, 75, 102, 25, 52, 129 }, // BT.601 limited
+	{  0, 64,  90, 22, 46, 113 }, // BT.601 full
+	{ 16, 75, 115, 14, 34, 135 }, // BT.709 limited
+	{  0, 64, 101, 12, 30, 119 }, // BT.709 full
+};
+
+static uvcc_convert_kernels_t const SCALAR_KERNELS = {
+	UVCC_SIMD_NONE,
+	uvcc_yuv422_to_rgb_row_c,
+	uvcc_yuv422_to_yuv420_row_c,
+	uvcc_halve_row_c,
+};
+
+// selected on first use, replaced by uvcc_set_simd_level().
+static uvcc_convert_kernels_t const *selected_kernels = NULL;
+
+/* Internal APIs */
+static uvcc_convert_kernels_t const *find_kernels(uint32_t max_level);
+static uint32_t rgb_bytes_per_pixel(uint32_t format);
+static uint8_t clamp_u8(int32_t value);
+static void store_rgb(uint8_t *dst, uint32_t format, int32_t r, int32_t g, int32_t b);
+static uint32_t tile_rows(uint32_t bytes_per_row);
+static void convert_rgb_rows(uint32_t begin, uint32_t end, void *user_data);
+static void convert_yuv420_rows(uint32_t begin, uint32_t end, void *user_data);
+
+int uvcc_convert_to_rgb(void const *src, uint32_t src_stride, uint32_t src_format, void *dst, uint32_t dst_stride, uint32_t dst_format, uint32_t width, uint32_t height, uint32_t color_space) {
+	rgb_job_t job;
+	uint32_t bpp;
+
+	if ((NULL == src) || (NULL == dst) || (0 == width) || (0 != (width & 1))) {
+		return INVALID_ARGUMENTS;
+	}
+	if (color_space >= UVCC_COLOR_COUNT) {
+		return INVALID_ARGUMENTS;
+	}
+	if ((UVCC_PIX_FMT_YUYV != src_format) && (UVCC_PIX_FMT_UYVY != src_format)) {
+		return INVALID_FORMAT_ARGUMENTS;
+	}
+	bpp = rgb_bytes_per_pixel(dst_format);
+	if (0 == bpp) {
+		return INVALID_FORMAT_ARGUMENTS;
+	}
+	if ((src_stride < width * 2) || (dst_stride < width * bpp)) {
+		return INVALID_ARGUMENTS;
+	}
+
+	job.kernels    = uvcc_get_kernels();
+	job.k          = &YUV_COEFFS[color_space];
+	job.src        = (uint8_t const*)src;
+	job.src_stride = src_stride;
+	job.src_format = src_format;
+	job.dst        = (uint8_t*)dst;
+	job.dst_stride = dst_stride;
+	job.dst_format = dst_format;
+	job.width      = width;
+
+	return uvcc_run_bands(height, tile_rows(width * (2 + bpp)), convert_rgb_rows, &job);
+}
+
+int uvcc_convert_to_yuv420(void const *src, uint32_t src_stride, uint32_t src_format, uvcc_planes_t const *dst, uint32_t dst_format, uint32_t width, uint32_t height) {
+	yuv420_job_t job;
+	uint32_t chroma_step;
+
+	if ((NULL == src) || (NULL == dst) || (0 == width) || (0 != (width & 1)) || (src_stride < width * 2)) {
+		return INVALID_ARGUMENTS;
+	}
+	if ((UVCC_PIX_FMT_YUYV != src_format) && (UVCC_PIX_FMT_UYVY != src_format)) {
+		return INVALID_FORMAT_ARGUMENTS;
+	}
+	switch (dst_format) {
+	case UVCC_PIX_FMT_YUV420:
+		if ((NULL == dst->data[2]) || (dst->stride[1] < width / 2) || (dst->stride[2] < width / 2)) {
+			return INVALID_ARGUMENTS;
+		}
+		chroma_step = 1;
+		break;
+	case UVCC_PIX_FMT_NV12:
+	case UVCC_PIX_FMT_NV21:
+		if (dst->stride[1] < width) {
+			return INVALID_ARGUMENTS;
+		}
+		chroma_step = 2;
+		break;
+	default:
+		return INVALID_FORMAT_ARGUMENTS;
+	}
+	if ((NULL == dst->data[0]) || (NULL == dst->data[1]) || (dst->stride[0] < width)) {
+		return INVALID_ARGUMENTS;
+	}
+
+	job.kernels     = uvcc_get_kernels();
+	job.src         = (uint8_t const*)src;
+	job.src_stride  = src_stride;
+	job.src_format  = src_format;
+	job.dst         = *dst;
+	job.dst_format  = dst_format;
+	job.chroma_step = chroma_step;
+	job.width       = width;
+	job.height      = height;
+
+	// bands are made of row pairs sharing a chroma row: 4w bytes read, 3w written.
+	return uvcc_run_bands((height + 1) / 2, tile_rows(width * 7), convert_yuv420_rows, &job);
+}
+
+uint32_t uvcc_get_simd_level() {
+	return uvcc_get_kernels()->level;
+}
+
+uint32_t uvcc_set_simd_level(uint32_t level) {
+	uvcc_convert_kernels_t const *kernels = find_kernels(level);
+	selected_kernels = kernels;
+	return kernels->level;
+}
+
+uint32_t uvcc_yuv422_to_rgb_row_c(uint8_t const *src, uint8_t *dst, uint32_t width, uint32_t src_format, uint32_t dst_format, uvcc_yuv_coeffs_t const *k) {
+	uint32_t const bpp = rgb_bytes_per_pixel(dst_format);
+	int const y_index  = (UVCC_PIX_FMT_YUYV == src_format) ? 0 : 1;
+	int const uv_index = 1 - y_index;
+	int32_t y0, y1, u, v;
+	int32_t ru, gu, bu;
+	uint32_t x;
+
+	for (x = 0; x < width; x += 2) {
+		y0 = (src[y_index]     - k->y_offset) * k->y_gain + 32;
+		y1 = (src[y_index + 2] - k->y_offset) * k->y_gain + 32;
+		u  = src[uv_index]     - 128;
+		v  = src[uv_index + 2] - 128;
+		// without saturation, since every result beyond 16 bits clamps to the same 0 or 255.
+		ru = k->rv * v;
+		gu = -k->gu * u - k->gv * v;
+		bu = k->bu * u;
+		store_rgb(dst,       dst_format, (y0 + ru) >> 6, (y0 + gu) >> 6, (y0 + bu) >> 6);
+		store_rgb(dst + bpp, dst_format, (y1 + ru) >> 6, (y1 + gu) >> 6, (y1 + bu) >> 6);
+		src += 4;
+		dst += bpp * 2;
+	}
+
+	return width;
+}
+
+uint32_t uvcc_yuv422_to_yuv420_row_c(uint8_t const *src0, uint8_t const *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uint32_t width, uint32_t src_format, uint32_t dst_format) {
+	int const y_index  = (UVCC_PIX_FMT_YUYV == src_format) ? 0 : 1;
+	int const uv_index = 1 - y_index;
+	uint8_t cb, cr;
+	uint32_t x;
+
+	for (x = 0; x < width; x += 2) {
+		y0[x]     = src0[y_index];
+		y0[x + 1] = src0[y_index + 2];
+		y1[x]     = src1[y_index];
+		y1[x + 1] = src1[y_index + 2];
+		cb = (uint8_t)((src0[uv_index]     + src1[uv_index]     + 1) >> 1);
+		cr = (uint8_t)((src0[uv_index + 2] + src1[uv_index + 2] + 1) >> 1);
+		switch (dst_format) {
+		case UVCC_PIX_FMT_YUV420:
+			u[x / 2] = cb;
+			v[x / 2] = cr;
+			break;
+		case UVCC_PIX_FMT_NV12:
+			u[x]     = cb;
+			u[x + 1] = cr;
+			break;
+		default:
+			u[x]     = cr;
+			u[x + 1] = cb;
+			break;
+		}
+		src0 += 4;
+		src1 += 4;
+	}
+
+	return width;
+}
+
+static uint32_t tile_rows(uint32_t bytes_per_row) {
+	uint32_t const rows = CONVERT_TILE_BYTES / bytes_per_row;
+	return (0 < rows) ? rows : 1;
+}
+
+static void convert_rgb_rows(uint32_t begin, uint32_t end, void *user_data) {
+	rgb_job_t const *job = (rgb_job_t const*)user_data;
+	uint32_t const bpp = rgb_bytes_per_pixel(job->dst_format);
+	uint8_t const *s = job->src + begin * job->src_stride;
+	uint8_t *d = job->dst + begin * job->dst_stride;
+	uint32_t done;
+	uint32_t y;
+
+	for (y = begin; y < end; ++y) {
+		done = job->kernels->yuv422_to_rgb_row(s, d, job->width, job->src_format, job->dst_format, job->k);
+		if (done < job->width) {
+			uvcc_yuv422_to_rgb_row_c(s + done * 2, d + done * bpp, job->width - done, job->src_format, job->dst_format, job->k);
+		}
+		s += job->src_stride;
+		d += job->dst_stride;
+	}
+}
+
+static void convert_yuv420_rows(uint32_t begin, uint32_t end, void *user_data) {
+	yuv420_job_t const *job = (yuv420_job_t const*)user_data;
+	uvcc_planes_t const *dst = &job->dst;
+	uint8_t const *s0, *s1;
+	uint8_t *y0, *y1, *u, *v;
+	uint32_t done;
+	uint32_t pair;
+	uint32_t y;
+
+	for (pair = begin; pair < end; ++pair) {
+		y  = pair * 2;
+		s0 = job->src + y * job->src_stride;
+		y0 = (uint8_t*)dst->data[0] + y * dst->stride[0];
+		// the last row of an odd height is its own pair.
+		s1 = (y + 1 < job->height) ? s0 + job->src_stride : s0;
+		y1 = (y + 1 < job->height) ? y0 + dst->stride[0] : y0;
+		u  = (uint8_t*)dst->data[1] + pair * dst->stride[1];
+		v  = (1 == job->chroma_step) ? (uint8_t*)dst->data[2] + pair * dst->stride[2] : NULL;
+
+		done = job->kernels->yuv422_to_yuv420_row(s0, s1, y0, y1, u, v, job->width, job->src_format, job->dst_format);
+		if (done < job->width) {
+			uvcc_yuv422_to_yuv420_row_c(s0 + done * 2, s1 + done * 2, y0 + done, y1 + done,
+				u + done / 2 * job->chroma_step, (NULL != v) ? v + done / 2 : NULL, job->width - done, job->src_format, job->dst_format);
+		}
+	}
+}
+
+static uvcc_convert_kernels_t const *find_kernels(uint32_t max_level) {
+	uvcc_convert_kernels_t const *candidates[3];
+	uvcc_convert_kernels_t const *best = &SCALAR_KERNELS;
+	int i;
+
+	candidates[0] = uvcc_convert_kernels_sse2();
+	candidates[1] = uvcc_convert_kernels_avx2();
+	candidates[2] = uvcc_convert_kernels_neon();
+
+	for (i = 0; i < 3; ++i) {
+		if ((NULL != candidates[i]) && (candidates[i]->level <= max_level) && (candidates[i]->level > best->level)) {
+			best = candidates[i];
+		}
+	}
+
+	return best;
+}
+
+uvcc_convert_kernels_t const *uvcc_get_kernels() {
+	uvcc_convert_kernels_t const *kernels = selected_kernels;
+	if (NULL == kernels) {
+		// racing callers pick the same kernels, storing a pointer is enough.
+		kernels = find_kernels(UINT32_MAX);
+		selected_kernels = kernels;
+	}
+	return kernels;
+}
+
+static uint32_t rgb_bytes_per_pixel(uint32_t format) {
+	switch (format) {
+	case UVCC_PIX_FMT_RGB565:
+		return 2;
+	case UVCC_PIX_FMT_RGB32:
+	case UVCC_PIX_FMT_BGR32:
+		return 4;
+	default:
+		return 0;
+	}
+}
+
+static uint8_t clamp_u8(int32_t value) {
+	if (value < 0) {
+		return 0;
+	}
+	if (value > 255) {
+		return 255;
+	}
+	return (uint8_t)value;
+}
+
+static void store_rgb(uint8_t *dst, uint32_t format, int32_t r, int32_t g, int32_t b) {
+	uint8_t const r8 = clamp_u8(r);
+	uint8_t const g8 = clamp_u8(g);
+	uint8_t const b8 = clamp_u8(b);
+	uint16_t rgb;
+
+	switch (format) {
+	case UVCC_PIX_FMT_RGB565:
+		rgb = ((r8 & 0xf8) << 8) | ((g8 & 0xfc) << 3) | (b8 >> 3);
+		dst[0] = (uint8_t)rgb;
+		dst[1] = (uint8_t)(rgb >> 8);
+		break;
+	case UVCC_PIX_FMT_RGB32:
+		dst[0] = r8;
+		dst[1] = g8;
+		dst[2] = b8;
+		dst[3] = 0xff;
+		break;
+	default:
+		dst[0] = b8;
+		dst[1] = g8;
+		dst[2] = r8;
+		dst[3] = 0xff;
+		break;
+	}
+}
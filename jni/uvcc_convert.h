@@ -0,0 +1,84 @@
+#ifndef UVCC_CONVERT_H
+#define UVCC_CONVERT_H
+
+#include<stdint.h>
+
+#include "uvccap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * YUV -> RGB coefficients in 6 bit fixed point:
+ *   y = (Y - y_offset) * y_gain + 32
+ *   R = sat16(y + rv * (V - 128)) >> 6
+ *   G = sat16(sat16(y - gu * (U - 128)) - gv * (V - 128)) >> 6
+ *   B = sat16(y + bu * (U - 128)) >> 6
+ * clamped to 0..255. Every kernel follows this order of saturating
+ * 16 bit operations, so SIMD results match the scalar ones exactly.
+ */
+typedef struct uvcc_yuv_coeffs_t_ {
+	int16_t y_offset;
+	int16_t y_gain;
+	int16_t rv;
+	int16_t gu;
+	int16_t gv;
+	int16_t bu;
+} uvcc_yuv_coeffs_t;
+
+/*
+ * Row kernels convert the leading pixels of a row which fit their vector
+ * width and return how many they converted; the scalar kernel finishes
+ * the rest. 'width' is even.
+ */
+typedef uint32_t (*uvcc_yuv422_to_rgb_row_t)(uint8_t const *src, uint8_t *dst, uint32_t width, uint32_t src_format, uint32_t dst_format, uvcc_yuv_coeffs_t const *k);
+
+/*
+ * Two source rows into two luma rows and one chroma row, chroma being the
+ * rounded average of both rows ((a + b + 1) >> 1). 'u' and 'v' are the
+ * chroma rows of YUV420; NV12 and NV21 write the interleaved row to 'u'.
+ */
+typedef uint32_t (*uvcc_yuv422_to_yuv420_row_t)(uint8_t const *src0, uint8_t const *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uint32_t width, uint32_t src_format, uint32_t dst_format);
+
+/* Byte layouts of a plane row, as far as halving it is concerned. */
+enum UVCC_HALVE_LAYOUTS {
+	UVCC_HALVE_PLANE = 0, // one sample per byte (Y, U or V plane).
+	UVCC_HALVE_PAIR,      // two interleaved channels (NV12/NV21 chroma).
+	UVCC_HALVE_QUAD,      // four interleaved channels (RGB32, BGR32).
+	UVCC_HALVE_YUYV,
+	UVCC_HALVE_UYVY,
+	UVCC_HALVE_COUNT,
+};
+
+/*
+ * Two source rows into one row of half the width, every output byte being
+ * (a + b + c + d + 2) >> 2 of the 2x2 samples of its channel.
+ * 'dst_bytes' is a multiple of 4 bytes (packed layouts) or 2 (pairs).
+ */
+typedef uint32_t (*uvcc_halve_row_t)(uint8_t const *src0, uint8_t const *src1, uint8_t *dst, uint32_t dst_bytes, uint32_t layout);
+
+typedef struct uvcc_convert_kernels_t_ {
+	uint32_t                    level;
+	uvcc_yuv422_to_rgb_row_t    yuv422_to_rgb_row;
+	uvcc_yuv422_to_yuv420_row_t yuv422_to_yuv420_row;
+	uvcc_halve_row_t            halve_row;
+} uvcc_convert_kernels_t;
+
+extern uint32_t uvcc_yuv422_to_rgb_row_c(uint8_t const *src, uint8_t *dst, uint32_t width, uint32_t src_format, uint32_t dst_format, uvcc_yuv_coeffs_t const *k);
+extern uint32_t uvcc_yuv422_to_yuv420_row_c(uint8_t const *src0, uint8_t const *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uint32_t width, uint32_t src_format, uint32_t dst_format);
+extern uint32_t uvcc_halve_row_c(uint8_t const *src0, uint8_t const *src1, uint8_t *dst, uint32_t dst_bytes, uint32_t layout);
+
+/* Kernels picked for this CPU, or limited by uvcc_set_simd_level(). */
+extern uvcc_convert_kernels_t const *uvcc_get_kernels();
+
+/* Kernel sets are NULL when the build does not include them. */
+extern uvcc_convert_kernels_t const *uvcc_convert_kernels_sse2();
+extern uvcc_convert_kernels_t const *uvcc_convert_kernels_avx2();
+extern uvcc_convert_kernels_t const *uvcc_convert_kernels_neon();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,257 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "uvccap.h"
+#include "uvcc_convert.h"
+
+/*
+ * NEON kernels. Android.mk builds this file with NEON only for
+ * armeabi-v7a, where it is optional, so the CPU is asked before use;
+ * AArch64 always has it.
+ */
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+
+#include <arm_neon.h>
+#if defined(__ANDROID__) && defined(__arm__)
+#include <cpu-features.h>
+#endif
+
+/* Internal APIs */
+static uint32_t yuv422_to_rgb_row_neon(uint8_t const *src, uint8_t *dst, uint32_t width, uint32_t src_format, uint32_t dst_format, uvcc_yuv_coeffs_t const *k);
+static void convert_8_neon(uint8x8_t y8, int16x8_t u, int16x8_t v, uint8x8_t *r, uint8x8_t *g, uint8x8_t *b, uvcc_yuv_coeffs_t const *k);
+static uint16x8_t pack_rgb565_neon(uint8x8_t r, uint8x8_t g, uint8x8_t b);
+static uint32_t yuv422_to_yuv420_row_neon(uint8_t const *src0, uint8_t const *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uint32_t width, uint32_t src_format, uint32_t dst_format);
+static uint32_t halve_row_neon(uint8_t const *src0, uint8_t const *src1, uint8_t *dst, uint32_t dst_bytes, uint32_t layout);
+static uint8x8_t halve_plane_neon(uint8x16_t a, uint8x16_t b);
+
+static uvcc_convert_kernels_t const NEON_KERNELS = {
+	UVCC_SIMD_NEON,
+	yuv422_to_rgb_row_neon,
+	yuv422_to_yuv420_row_neon,
+	halve_row_neon,
+};
+
+uvcc_convert_kernels_t const *uvcc_convert_kernels_neon() {
+#if defined(__ANDROID__) && defined(__arm__)
+	if ((ANDROID_CPU_FAMILY_ARM != android_getCpuFamily()) || (0 == (android_getCpuFeatures() & ANDROID_CPU_ARM_FEATURE_NEON))) {
+		return NULL;
+	}
+#endif
+	return &NEON_KERNELS;
+}
+
+static uint32_t yuv422_to_rgb_row_neon(uint8_t const *src, uint8_t *dst, uint32_t width, uint32_t src_format, uint32_t dst_format, uvcc_yuv_coeffs_t const *k) {
+	int const yuyv = (UVCC_PIX_FMT_YUYV == src_format);
+	uint8x8_t const uv_bias = vdup_n_u8(128);
+	uint8x8x4_t yuv;
+	uint8x8_t y0, y1, u8, v8;
+	int16x8_t u, v;
+	uint8x8_t r0, g0, b0, r1, g1, b1;
+	uint8x8x2_t r, g, b;
+	uint8x8x4_t rgba;
+	uint32_t x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		// 8 pairs: Y0 U Y1 V (YUYV) or U Y0 V Y1 (UYVY).
+		yuv = vld4_u8(src);
+		if (yuyv) {
+			y0 = yuv.val[0];
+			u8 = yuv.val[1];
+			y1 = yuv.val[2];
+			v8 = yuv.val[3];
+		} else {
+			u8 = yuv.val[0];
+			y0 = yuv.val[1];
+			v8 = yuv.val[2];
+			y1 = yuv.val[3];
+		}
+		u = vreinterpretq_s16_u16(vsubl_u8(u8, uv_bias));
+		v = vreinterpretq_s16_u16(vsubl_u8(v8, uv_bias));
+
+		// even and odd pixels share U and V, interleave them afterwards.
+		convert_8_neon(y0, u, v, &r0, &g0, &b0, k);
+		convert_8_neon(y1, u, v, &r1, &g1, &b1, k);
+		r = vzip_u8(r0, r1);
+		g = vzip_u8(g0, g1);
+		b = vzip_u8(b0, b1);
+
+		if (UVCC_PIX_FMT_RGB565 == dst_format) {
+			vst1q_u16((uint16_t*)(dst),      pack_rgb565_neon(r.val[0], g.val[0], b.val[0]));
+			vst1q_u16((uint16_t*)(dst + 16), pack_rgb565_neon(r.val[1], g.val[1], b.val[1]));
+			dst += 32;
+		} else {
+			rgba.val[1] = g.val[0];
+			rgba.val[3] = vdup_n_u8(0xff);
+			if (UVCC_PIX_FMT_BGR32 == dst_format) {
+				rgba.val[0] = b.val[0];
+				rgba.val[2] = r.val[0];
+			} else {
+				rgba.val[0] = r.val[0];
+				rgba.val[2] = b.val[0];
+			}
+			vst4_u8(dst, rgba);
+			rgba.val[1] = g.val[1];
+			if (UVCC_PIX_FMT_BGR32 == dst_format) {
+				rgba.val[0] = b.val[1];
+				rgba.val[2] = r.val[1];
+			} else {
+				rgba.val[0] = r.val[1];
+				rgba.val[2] = b.val[1];
+			}
+			vst4_u8(dst + 32, rgba);
+			dst += 64;
+		}
+		src += 32;
+	}
+
+	return x;
+}
+
+/* 8 pixels into clamped R, G and B with the saturating steps of the other kernels. */
+static void convert_8_neon(uint8x8_t y8, int16x8_t u, int16x8_t v, uint8x8_t *r, uint8x8_t *g, uint8x8_t *b, uvcc_yuv_coeffs_t const *k) {
+	int16x8_t y;
+	int16x8_t t;
+
+	y = vreinterpretq_s16_u16(vsubl_u8(y8, vdup_n_u8((uint8_t)k->y_offset)));
+	y = vaddq_s16(vmulq_n_s16(y, k->y_gain), vdupq_n_s16(32));
+
+	*r = vqmovun_s16(vshrq_n_s16(vqaddq_s16(y, vmulq_n_s16(v, k->rv)), 6));
+	t  = vqsubq_s16(y, vmulq_n_s16(u, k->gu));
+	*g = vqmovun_s16(vshrq_n_s16(vqsubq_s16(t, vmulq_n_s16(v, k->gv)), 6));
+	*b = vqmovun_s16(vshrq_n_s16(vqaddq_s16(y, vmulq_n_s16(u, k->bu)), 6));
+}
+
+static uint16x8_t pack_rgb565_neon(uint8x8_t r, uint8x8_t g, uint8x8_t b) {
+	uint16x8_t rgb = vshll_n_u8(r, 8);
+	rgb = vsriq_n_u16(rgb, vshll_n_u8(g, 8), 5);
+	rgb = vsriq_n_u16(rgb, vshll_n_u8(b, 8), 11);
+	return rgb;
+}
+
+static uint32_t yuv422_to_yuv420_row_neon(uint8_t const *src0, uint8_t const *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uint32_t width, uint32_t src_format, uint32_t dst_format) {
+	// lanes of vld4_u8(): Y0 U Y1 V (YUYV) or U Y0 V Y1 (UYVY).
+	int const y_lane  = (UVCC_PIX_FMT_YUYV == src_format) ? 0 : 1;
+	int const uv_lane = 1 - y_lane;
+	uint8x8x4_t a, b;
+	uint8x8x2_t luma, chroma;
+	uint8x8_t cb, cr;
+	uint32_t x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		a = vld4_u8(src0);
+		b = vld4_u8(src1);
+
+		luma.val[0] = a.val[y_lane];
+		luma.val[1] = a.val[y_lane + 2];
+		vst2_u8(y0 + x, luma);
+		luma.val[0] = b.val[y_lane];
+		luma.val[1] = b.val[y_lane + 2];
+		vst2_u8(y1 + x, luma);
+
+		cb = vrhadd_u8(a.val[uv_lane],     b.val[uv_lane]);
+		cr = vrhadd_u8(a.val[uv_lane + 2], b.val[uv_lane + 2]);
+		switch (dst_format) {
+		case UVCC_PIX_FMT_YUV420:
+			vst1_u8(u + x / 2, cb);
+			vst1_u8(v + x / 2, cr);
+			break;
+		case UVCC_PIX_FMT_NV12:
+			chroma.val[0] = cb;
+			chroma.val[1] = cr;
+			vst2_u8(u + x, chroma);
+			break;
+		default:
+			chroma.val[0] = cr;
+			chroma.val[1] = cb;
+			vst2_u8(u + x, chroma);
+			break;
+		}
+		src0 += 32;
+		src1 += 32;
+	}
+
+	return x;
+}
+
+static uint32_t halve_row_neon(uint8_t const *src0, uint8_t const *src1, uint8_t *dst, uint32_t dst_bytes, uint32_t layout) {
+	// lanes of vld4q_u8() holding luma for YUYV and UYVY, chroma being the other two.
+	int const y_lane = (UVCC_HALVE_YUYV == layout) ? 0 : 1;
+	uint8x16x2_t a2, b2;
+	uint8x16x4_t a4, b4;
+	uint8x8x2_t out2;
+	uint8x8x4_t out4;
+	uint16x8x2_t luma;
+	uint16x8_t lo, hi;
+	uint32_t x = 0;
+
+	switch (layout) {
+	case UVCC_HALVE_PLANE:
+		for (; x + 16 <= dst_bytes; x += 16) {
+			vst1q_u8(dst + x, vcombine_u8(halve_plane_neon(vld1q_u8(src0), vld1q_u8(src1)),
+				halve_plane_neon(vld1q_u8(src0 + 16), vld1q_u8(src1 + 16))));
+			src0 += 32;
+			src1 += 32;
+		}
+		break;
+	case UVCC_HALVE_PAIR:
+		for (; x + 16 <= dst_bytes; x += 16) {
+			a2 = vld2q_u8(src0);
+			b2 = vld2q_u8(src1);
+			out2.val[0] = halve_plane_neon(a2.val[0], b2.val[0]);
+			out2.val[1] = halve_plane_neon(a2.val[1], b2.val[1]);
+			vst2_u8(dst + x, out2);
+			src0 += 32;
+			src1 += 32;
+		}
+		break;
+	case UVCC_HALVE_QUAD:
+		for (; x + 32 <= dst_bytes; x += 32) {
+			a4 = vld4q_u8(src0);
+			b4 = vld4q_u8(src1);
+			out4.val[0] = halve_plane_neon(a4.val[0], b4.val[0]);
+			out4.val[1] = halve_plane_neon(a4.val[1], b4.val[1]);
+			out4.val[2] = halve_plane_neon(a4.val[2], b4.val[2]);
+			out4.val[3] = halve_plane_neon(a4.val[3], b4.val[3]);
+			vst4_u8(dst + x, out4);
+			src0 += 64;
+			src1 += 64;
+		}
+		break;
+	default:
+		// 16 pairs: Y0 U Y1 V (YUYV) or U Y0 V Y1 (UYVY) into 8 pairs.
+		for (; x + 32 <= dst_bytes; x += 32) {
+			a4 = vld4q_u8(src0);
+			b4 = vld4q_u8(src1);
+			// Y0 + Y1 of each source pair, the even pairs making the first output luma.
+			lo = vaddq_u16(vaddl_u8(vget_low_u8(a4.val[y_lane]),  vget_low_u8(a4.val[y_lane + 2])),
+				vaddl_u8(vget_low_u8(b4.val[y_lane]),  vget_low_u8(b4.val[y_lane + 2])));
+			hi = vaddq_u16(vaddl_u8(vget_high_u8(a4.val[y_lane]), vget_high_u8(a4.val[y_lane + 2])),
+				vaddl_u8(vget_high_u8(b4.val[y_lane]), vget_high_u8(b4.val[y_lane + 2])));
+			luma = vuzpq_u16(lo, hi);
+			out4.val[y_lane]     = vrshrn_n_u16(luma.val[0], 2);
+			out4.val[y_lane + 2] = vrshrn_n_u16(luma.val[1], 2);
+			out4.val[1 - y_lane] = halve_plane_neon(a4.val[1 - y_lane], b4.val[1 - y_lane]);
+			out4.val[3 - y_lane] = halve_plane_neon(a4.val[3 - y_lane], b4.val[3 - y_lane]);
+			vst4_u8(dst + x, out4);
+			src0 += 64;
+			src1 += 64;
+		}
+		break;
+	}
+
+	return x;
+}
+
+/* Neighbouring samples of two rows of one channel: 16 of each into 8. */
+static uint8x8_t halve_plane_neon(uint8x16_t a, uint8x16_t b) {
+	return vrshrn_n_u16(vaddq_u16(vpaddlq_u8(a), vpaddlq_u8(b)), 2);
+}
+
+#else
+
+uvcc_convert_kernels_t const *uvcc_convert_kernels_neon() {
+	return NULL;
+}
+
+#endif
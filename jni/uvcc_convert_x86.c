@@ -0,0 +1,420 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "uvccap.h"
+#include "uvcc_convert.h"
+
+/*
+ * SSE2 and AVX2 kernels. SSE2 is part of every x86-64 and Android x86
+ * target; AVX2 is compiled with a target attribute and only picked when
+ * the CPU reports it, so the rest of the library keeps the baseline ISA.
+ */
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+/* Internal APIs */
+static uint32_t yuv422_to_rgb_row_sse2(uint8_t const *src, uint8_t *dst, uint32_t width, uint32_t src_format, uint32_t dst_format, uvcc_yuv_coeffs_t const *k);
+static void convert_8_sse2(__m128i yuv, __m128i *r, __m128i *g, __m128i *b, int yuyv, uvcc_yuv_coeffs_t const *k);
+static __m128i pack_rgb565_sse2(__m128i r, __m128i g, __m128i b);
+static uint32_t yuv422_to_yuv420_row_sse2(uint8_t const *src0, uint8_t const *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uint32_t width, uint32_t src_format, uint32_t dst_format);
+static __m128i extract_luma_sse2(__m128i a, __m128i b, int yuyv);
+static uint32_t halve_row_sse2(uint8_t const *src0, uint8_t const *src1, uint8_t *dst, uint32_t dst_bytes, uint32_t layout);
+static __m128i halve_8_sse2(__m128i sums, uint32_t layout);
+
+static uvcc_convert_kernels_t const SSE2_KERNELS = {
+	UVCC_SIMD_SSE2,
+	yuv422_to_rgb_row_sse2,
+	yuv422_to_yuv420_row_sse2,
+	halve_row_sse2,
+};
+
+uvcc_convert_kernels_t const *uvcc_convert_kernels_sse2() {
+	return &SSE2_KERNELS;
+}
+
+static uint32_t yuv422_to_rgb_row_sse2(uint8_t const *src, uint8_t *dst, uint32_t width, uint32_t src_format, uint32_t dst_format, uvcc_yuv_coeffs_t const *k) {
+	int const yuyv = (UVCC_PIX_FMT_YUYV == src_format);
+	__m128i const alpha = _mm_set1_epi8((char)0xff);
+	__m128i r0, g0, b0, r1, g1, b1;
+	__m128i r, g, b, rg, ba;
+	uint32_t x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		convert_8_sse2(_mm_loadu_si128((__m128i const*)(src)),      &r0, &g0, &b0, yuyv, k);
+		convert_8_sse2(_mm_loadu_si128((__m128i const*)(src + 16)), &r1, &g1, &b1, yuyv, k);
+
+		if (UVCC_PIX_FMT_RGB565 == dst_format) {
+			_mm_storeu_si128((__m128i*)(dst),      pack_rgb565_sse2(r0, g0, b0));
+			_mm_storeu_si128((__m128i*)(dst + 16), pack_rgb565_sse2(r1, g1, b1));
+			dst += 32;
+		} else {
+			r = _mm_packus_epi16(r0, r1);
+			g = _mm_packus_epi16(g0, g1);
+			b = _mm_packus_epi16(b0, b1);
+			if (UVCC_PIX_FMT_BGR32 == dst_format) {
+				__m128i const t = r;
+				r = b;
+				b = t;
+			}
+			rg = _mm_unpacklo_epi8(r, g);
+			ba = _mm_unpacklo_epi8(b, alpha);
+			_mm_storeu_si128((__m128i*)(dst),      _mm_unpacklo_epi16(rg, ba));
+			_mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi16(rg, ba));
+			rg = _mm_unpackhi_epi8(r, g);
+			ba = _mm_unpackhi_epi8(b, alpha);
+			_mm_storeu_si128((__m128i*)(dst + 32), _mm_unpacklo_epi16(rg, ba));
+			_mm_storeu_si128((__m128i*)(dst + 48), _mm_unpackhi_epi16(rg, ba));
+			dst += 64;
+		}
+		src += 32;
+	}
+
+	return x;
+}
+
+/* 8 pixels (16 bytes) into signed 16 bit R, G and B, not clamped yet. */
+static void convert_8_sse2(__m128i yuv, __m128i *r, __m128i *g, __m128i *b, int yuyv, uvcc_yuv_coeffs_t const *k) {
+	__m128i const low = _mm_set1_epi16(0x00ff);
+	__m128i y, uv, u, v;
+
+	if (yuyv) {
+		y  = _mm_and_si128(yuv, low);
+		uv = _mm_srli_epi16(yuv, 8);
+	} else {
+		y  = _mm_srli_epi16(yuv, 8);
+		uv = _mm_and_si128(yuv, low);
+	}
+	// U0 V0 U1 V1 ... -> U0 U0 U1 U1 ... and V0 V0 V1 V1 ...
+	u = _mm_and_si128(uv, _mm_set1_epi32(0x0000ffff));
+	u = _mm_or_si128(u, _mm_slli_epi32(u, 16));
+	v = _mm_srli_epi32(uv, 16);
+	v = _mm_or_si128(v, _mm_slli_epi32(v, 16));
+
+	y = _mm_sub_epi16(y, _mm_set1_epi16(k->y_offset));
+	y = _mm_add_epi16(_mm_mullo_epi16(y, _mm_set1_epi16(k->y_gain)), _mm_set1_epi16(32));
+	u = _mm_sub_epi16(u, _mm_set1_epi16(128));
+	v = _mm_sub_epi16(v, _mm_set1_epi16(128));
+
+	*r = _mm_srai_epi16(_mm_adds_epi16(y, _mm_mullo_epi16(v, _mm_set1_epi16(k->rv))), 6);
+	*g = _mm_subs_epi16(y, _mm_mullo_epi16(u, _mm_set1_epi16(k->gu)));
+	*g = _mm_srai_epi16(_mm_subs_epi16(*g, _mm_mullo_epi16(v, _mm_set1_epi16(k->gv))), 6);
+	*b = _mm_srai_epi16(_mm_adds_epi16(y, _mm_mullo_epi16(u, _mm_set1_epi16(k->bu))), 6);
+}
+
+static __m128i pack_rgb565_sse2(__m128i r, __m128i g, __m128i b) {
+	__m128i const zero = _mm_setzero_si128();
+	__m128i const max  = _mm_set1_epi16(255);
+
+	r = _mm_min_epi16(_mm_max_epi16(r, zero), max);
+	g = _mm_min_epi16(_mm_max_epi16(g, zero), max);
+	b = _mm_min_epi16(_mm_max_epi16(b, zero), max);
+
+	r = _mm_and_si128(_mm_slli_epi16(r, 8), _mm_set1_epi16((short)0xf800));
+	g = _mm_and_si128(_mm_slli_epi16(g, 3), _mm_set1_epi16(0x07e0));
+	b = _mm_srli_epi16(b, 3);
+
+	return _mm_or_si128(_mm_or_si128(r, g), b);
+}
+
+static uint32_t yuv422_to_yuv420_row_sse2(uint8_t const *src0, uint8_t const *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uint32_t width, uint32_t src_format, uint32_t dst_format) {
+	int const yuyv = (UVCC_PIX_FMT_YUYV == src_format);
+	__m128i const low = _mm_set1_epi16(0x00ff);
+	__m128i a0, a1, b0, b1, c0, c1, uv;
+	uint32_t x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		a0 = _mm_loadu_si128((__m128i const*)(src0));
+		a1 = _mm_loadu_si128((__m128i const*)(src0 + 16));
+		b0 = _mm_loadu_si128((__m128i const*)(src1));
+		b1 = _mm_loadu_si128((__m128i const*)(src1 + 16));
+		_mm_storeu_si128((__m128i*)(y0 + x), extract_luma_sse2(a0, a1, yuyv));
+		_mm_storeu_si128((__m128i*)(y1 + x), extract_luma_sse2(b0, b1, yuyv));
+
+		// averaging whole vectors is cheaper than picking chroma first; luma lanes are dropped.
+		c0 = _mm_avg_epu8(a0, b0);
+		c1 = _mm_avg_epu8(a1, b1);
+		if (yuyv) {
+			uv = _mm_packus_epi16(_mm_srli_epi16(c0, 8), _mm_srli_epi16(c1, 8));
+		} else {
+			uv = _mm_packus_epi16(_mm_and_si128(c0, low), _mm_and_si128(c1, low));
+		}
+		// uv: U0 V0 U1 V1 ... U7 V7
+		switch (dst_format) {
+		case UVCC_PIX_FMT_YUV420:
+			_mm_storel_epi64((__m128i*)(u + x / 2), _mm_packus_epi16(_mm_and_si128(uv, low), uv));
+			_mm_storel_epi64((__m128i*)(v + x / 2), _mm_packus_epi16(_mm_srli_epi16(uv, 8), uv));
+			break;
+		case UVCC_PIX_FMT_NV12:
+			_mm_storeu_si128((__m128i*)(u + x), uv);
+			break;
+		default:
+			_mm_storeu_si128((__m128i*)(u + x), _mm_or_si128(_mm_slli_epi16(uv, 8), _mm_srli_epi16(uv, 8)));
+			break;
+		}
+		src0 += 32;
+		src1 += 32;
+	}
+
+	return x;
+}
+
+/* 16 luma samples out of 32 bytes of YUYV or UYVY. */
+static __m128i extract_luma_sse2(__m128i a, __m128i b, int yuyv) {
+	__m128i const low = _mm_set1_epi16(0x00ff);
+
+	if (yuyv) {
+		return _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low));
+	}
+	return _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+}
+
+static uint32_t halve_row_sse2(uint8_t const *src0, uint8_t const *src1, uint8_t *dst, uint32_t dst_bytes, uint32_t layout) {
+	__m128i const zero = _mm_setzero_si128();
+	__m128i const two  = _mm_set1_epi16(2);
+	__m128i a, b, lo, hi;
+	uint32_t x;
+
+	for (x = 0; x + 16 <= dst_bytes; x += 16) {
+		// vertical sums of 32 source bytes, 8 per vector.
+		a  = _mm_loadu_si128((__m128i const*)(src0));
+		b  = _mm_loadu_si128((__m128i const*)(src1));
+		lo = _mm_unpacklo_epi64(
+			halve_8_sse2(_mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)), layout),
+			halve_8_sse2(_mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)), layout));
+		a  = _mm_loadu_si128((__m128i const*)(src0 + 16));
+		b  = _mm_loadu_si128((__m128i const*)(src1 + 16));
+		hi = _mm_unpacklo_epi64(
+			halve_8_sse2(_mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)), layout),
+			halve_8_sse2(_mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)), layout));
+
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+		_mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(lo, hi));
+		src0 += 32;
+		src1 += 32;
+	}
+
+	return x;
+}
+
+/* Vertical sums of 8 source bytes into the 4 sums of the output bytes, in the low half. */
+static __m128i halve_8_sse2(__m128i sums, uint32_t layout) {
+	__m128i const low = _mm_set1_epi32(0x0000ffff);
+	__m128i pairs, quads;
+
+	switch (layout) {
+	case UVCC_HALVE_PLANE:
+		pairs = _mm_madd_epi16(sums, _mm_set1_epi16(1));
+		return _mm_packs_epi32(pairs, pairs);
+	case UVCC_HALVE_QUAD:
+		return _mm_add_epi16(sums, _mm_srli_si128(sums, 8));
+	default:
+		break;
+	}
+
+	// s0+s2 s1+s3 s4+s6 s5+s7 in the low half.
+	pairs = _mm_add_epi16(sums, _mm_srli_si128(sums, 4));
+	pairs = _mm_shuffle_epi32(pairs, _MM_SHUFFLE(3, 1, 2, 0));
+	if (UVCC_HALVE_PAIR == layout) {
+		return pairs;
+	}
+	// s0+s4 s1+s5 s2+s6 s3+s7
+	quads = _mm_add_epi16(sums, _mm_srli_si128(sums, 8));
+	if (UVCC_HALVE_YUYV == layout) {
+		// Y from pairs, U and V from quads.
+		return _mm_or_si128(_mm_and_si128(pairs, low), _mm_andnot_si128(low, quads));
+	}
+	return _mm_or_si128(_mm_and_si128(quads, low), _mm_andnot_si128(low, pairs));
+}
+
+#else
+
+uvcc_convert_kernels_t const *uvcc_convert_kernels_sse2() {
+	return NULL;
+}
+
+#endif
+
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+
+#include <immintrin.h>
+
+#define AVX2 __attribute__((target("avx2")))
+
+/* Internal APIs */
+static AVX2 uint32_t yuv422_to_rgb_row_avx2(uint8_t const *src, uint8_t *dst, uint32_t width, uint32_t src_format, uint32_t dst_format, uvcc_yuv_coeffs_t const *k);
+static AVX2 void convert_16_avx2(__m256i yuv, __m256i *r, __m256i *g, __m256i *b, int yuyv, uvcc_yuv_coeffs_t const *k);
+static AVX2 __m256i pack_rgb565_avx2(__m256i r, __m256i g, __m256i b);
+static AVX2 uint32_t yuv422_to_yuv420_row_avx2(uint8_t const *src0, uint8_t const *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uint32_t width, uint32_t src_format, uint32_t dst_format);
+static AVX2 __m256i extract_luma_avx2(__m256i a, __m256i b, int yuyv);
+
+static uvcc_convert_kernels_t const AVX2_KERNELS = {
+	UVCC_SIMD_AVX2,
+	yuv422_to_rgb_row_avx2,
+	yuv422_to_yuv420_row_avx2,
+	halve_row_sse2, // bound by memory rather than by the width of the vectors.
+};
+
+uvcc_convert_kernels_t const *uvcc_convert_kernels_avx2() {
+	__builtin_cpu_init();
+	if (!__builtin_cpu_supports("avx2")) {
+		return NULL;
+	}
+	return &AVX2_KERNELS;
+}
+
+static AVX2 uint32_t yuv422_to_rgb_row_avx2(uint8_t const *src, uint8_t *dst, uint32_t width, uint32_t src_format, uint32_t dst_format, uvcc_yuv_coeffs_t const *k) {
+	int const yuyv = (UVCC_PIX_FMT_YUYV == src_format);
+	__m256i const alpha = _mm256_set1_epi8((char)0xff);
+	__m256i r0, g0, b0, r1, g1, b1;
+	__m256i r, g, b, rg, ba, lo, hi;
+	uint32_t x;
+
+	for (x = 0; x + 32 <= width; x += 32) {
+		convert_16_avx2(_mm256_loadu_si256((__m256i const*)(src)),      &r0, &g0, &b0, yuyv, k);
+		convert_16_avx2(_mm256_loadu_si256((__m256i const*)(src + 32)), &r1, &g1, &b1, yuyv, k);
+
+		if (UVCC_PIX_FMT_RGB565 == dst_format) {
+			_mm256_storeu_si256((__m256i*)(dst),      pack_rgb565_avx2(r0, g0, b0));
+			_mm256_storeu_si256((__m256i*)(dst + 32), pack_rgb565_avx2(r1, g1, b1));
+			dst += 64;
+		} else {
+			// packing works per 128 bit lane: pixels 0-7,16-23 | 8-15,24-31.
+			r = _mm256_packus_epi16(r0, r1);
+			g = _mm256_packus_epi16(g0, g1);
+			b = _mm256_packus_epi16(b0, b1);
+			if (UVCC_PIX_FMT_BGR32 == dst_format) {
+				__m256i const t = r;
+				r = b;
+				b = t;
+			}
+			rg = _mm256_unpacklo_epi8(r, g);
+			ba = _mm256_unpacklo_epi8(b, alpha);
+			lo = _mm256_unpacklo_epi16(rg, ba); // 0-3  | 8-11
+			hi = _mm256_unpackhi_epi16(rg, ba); // 4-7  | 12-15
+			_mm256_storeu_si256((__m256i*)(dst),      _mm256_permute2x128_si256(lo, hi, 0x20));
+			_mm256_storeu_si256((__m256i*)(dst + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+			rg = _mm256_unpackhi_epi8(r, g);
+			ba = _mm256_unpackhi_epi8(b, alpha);
+			lo = _mm256_unpacklo_epi16(rg, ba); // 16-19 | 24-27
+			hi = _mm256_unpackhi_epi16(rg, ba); // 20-23 | 28-31
+			_mm256_storeu_si256((__m256i*)(dst + 64), _mm256_permute2x128_si256(lo, hi, 0x20));
+			_mm256_storeu_si256((__m256i*)(dst + 96), _mm256_permute2x128_si256(lo, hi, 0x31));
+			dst += 128;
+		}
+		src += 64;
+	}
+
+	return x;
+}
+
+/* 16 pixels (32 bytes), same steps as convert_8_sse2(). */
+static AVX2 void convert_16_avx2(__m256i yuv, __m256i *r, __m256i *g, __m256i *b, int yuyv, uvcc_yuv_coeffs_t const *k) {
+	__m256i const low = _mm256_set1_epi16(0x00ff);
+	__m256i y, uv, u, v;
+
+	if (yuyv) {
+		y  = _mm256_and_si256(yuv, low);
+		uv = _mm256_srli_epi16(yuv, 8);
+	} else {
+		y  = _mm256_srli_epi16(yuv, 8);
+		uv = _mm256_and_si256(yuv, low);
+	}
+	u = _mm256_and_si256(uv, _mm256_set1_epi32(0x0000ffff));
+	u = _mm256_or_si256(u, _mm256_slli_epi32(u, 16));
+	v = _mm256_srli_epi32(uv, 16);
+	v = _mm256_or_si256(v, _mm256_slli_epi32(v, 16));
+
+	y = _mm256_sub_epi16(y, _mm256_set1_epi16(k->y_offset));
+	y = _mm256_add_epi16(_mm256_mullo_epi16(y, _mm256_set1_epi16(k->y_gain)), _mm256_set1_epi16(32));
+	u = _mm256_sub_epi16(u, _mm256_set1_epi16(128));
+	v = _mm256_sub_epi16(v, _mm256_set1_epi16(128));
+
+	*r = _mm256_srai_epi16(_mm256_adds_epi16(y, _mm256_mullo_epi16(v, _mm256_set1_epi16(k->rv))), 6);
+	*g = _mm256_subs_epi16(y, _mm256_mullo_epi16(u, _mm256_set1_epi16(k->gu)));
+	*g = _mm256_srai_epi16(_mm256_subs_epi16(*g, _mm256_mullo_epi16(v, _mm256_set1_epi16(k->gv))), 6);
+	*b = _mm256_srai_epi16(_mm256_adds_epi16(y, _mm256_mullo_epi16(u, _mm256_set1_epi16(k->bu))), 6);
+}
+
+static AVX2 __m256i pack_rgb565_avx2(__m256i r, __m256i g, __m256i b) {
+	__m256i const zero = _mm256_setzero_si256();
+	__m256i const max  = _mm256_set1_epi16(255);
+
+	r = _mm256_min_epi16(_mm256_max_epi16(r, zero), max);
+	g = _mm256_min_epi16(_mm256_max_epi16(g, zero), max);
+	b = _mm256_min_epi16(_mm256_max_epi16(b, zero), max);
+
+	r = _mm256_and_si256(_mm256_slli_epi16(r, 8), _mm256_set1_epi16((short)0xf800));
+	g = _mm256_and_si256(_mm256_slli_epi16(g, 3), _mm256_set1_epi16(0x07e0));
+	b = _mm256_srli_epi16(b, 3);
+
+	return _mm256_or_si256(_mm256_or_si256(r, g), b);
+}
+
+static AVX2 uint32_t yuv422_to_yuv420_row_avx2(uint8_t const *src0, uint8_t const *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uint32_t width, uint32_t src_format, uint32_t dst_format) {
+	int const yuyv = (UVCC_PIX_FMT_YUYV == src_format);
+	__m256i const low = _mm256_set1_epi16(0x00ff);
+	__m256i a0, a1, b0, b1, c0, c1, uv, planar;
+	uint32_t x;
+
+	for (x = 0; x + 32 <= width; x += 32) {
+		a0 = _mm256_loadu_si256((__m256i const*)(src0));
+		a1 = _mm256_loadu_si256((__m256i const*)(src0 + 32));
+		b0 = _mm256_loadu_si256((__m256i const*)(src1));
+		b1 = _mm256_loadu_si256((__m256i const*)(src1 + 32));
+		_mm256_storeu_si256((__m256i*)(y0 + x), extract_luma_avx2(a0, a1, yuyv));
+		_mm256_storeu_si256((__m256i*)(y1 + x), extract_luma_avx2(b0, b1, yuyv));
+
+		c0 = _mm256_avg_epu8(a0, b0);
+		c1 = _mm256_avg_epu8(a1, b1);
+		if (yuyv) {
+			uv = _mm256_packus_epi16(_mm256_srli_epi16(c0, 8), _mm256_srli_epi16(c1, 8));
+		} else {
+			uv = _mm256_packus_epi16(_mm256_and_si256(c0, low), _mm256_and_si256(c1, low));
+		}
+		// undo the per-lane packing: U0 V0 ... U15 V15.
+		uv = _mm256_permute4x64_epi64(uv, 0xd8);
+		switch (dst_format) {
+		case UVCC_PIX_FMT_YUV420:
+			// U in the low 64 bits of each lane, V in the high ones.
+			planar = _mm256_packus_epi16(_mm256_and_si256(uv, low), _mm256_srli_epi16(uv, 8));
+			planar = _mm256_permute4x64_epi64(planar, 0xd8);
+			_mm_storeu_si128((__m128i*)(u + x / 2), _mm256_castsi256_si128(planar));
+			_mm_storeu_si128((__m128i*)(v + x / 2), _mm256_extracti128_si256(planar, 1));
+			break;
+		case UVCC_PIX_FMT_NV12:
+			_mm256_storeu_si256((__m256i*)(u + x), uv);
+			break;
+		default:
+			_mm256_storeu_si256((__m256i*)(u + x), _mm256_or_si256(_mm256_slli_epi16(uv, 8), _mm256_srli_epi16(uv, 8)));
+			break;
+		}
+		src0 += 64;
+		src1 += 64;
+	}
+
+	return x;
+}
+
+/* 32 luma samples out of 64 bytes of YUYV or UYVY. */
+static AVX2 __m256i extract_luma_avx2(__m256i a, __m256i b, int yuyv) {
+	__m256i const low = _mm256_set1_epi16(0x00ff);
+	__m256i y;
+
+	if (yuyv) {
+		y = _mm256_packus_epi16(_mm256_and_si256(a, low), _mm256_and_si256(b, low));
+	} else {
+		y = _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+	}
+	return _mm256_permute4x64_epi64(y, 0xd8);
+}
+
+#else
+
+uvcc_convert_kernels_t const *uvcc_convert_kernels_avx2() {
+	return NULL;
+}
+
+#endif
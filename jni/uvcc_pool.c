@@ -0,0 +1,318 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "uvccap.h"
+
+/*
+ * Library-owned worker pool for per-frame kernels.
+ * A run splits the rows into tiles; every participant (the caller and
+ * each worker) starts with an even share of consecutive tiles, takes
+ * tiles from the front of its own share and, once it runs dry, steals
+ * the back half of the largest share left. A share is packed into one
+ * 32-bit word (first tile << 16 | end tile) so that taking and stealing
+ * are single compare-and-swaps, which every supported ABI has.
+ */
+
+#define POOL_MAX_TILES   0xffff
+#define RANGE(begin, end) (((uint32_t)(begin) << 16) | (uint32_t)(end))
+#define RANGE_BEGIN(r)    ((r) >> 16)
+#define RANGE_END(r)      ((r) & 0xffff)
+
+typedef struct pool_job_t_ {
+	uvcc_band_func_t func;
+	void            *user_data;
+	uint32_t         rows;
+	uint32_t         tile_rows;
+	uint32_t         finished; // workers done with this job, guarded by the pool lock.
+	uint32_t volatile ranges[UVCC_MAX_THREADS];
+} pool_job_t;
+
+typedef struct pool_worker_t_ {
+	struct pool_t_ *pool;
+	pthread_t       thread;
+	uint32_t        index;
+} pool_worker_t;
+
+typedef struct pool_t_ {
+	pthread_mutex_t lock;
+	pthread_cond_t  work_cond;
+	pthread_cond_t  done_cond;
+	pool_job_t     *job;
+	uint32_t        generation;
+	int             is_exiting;
+	uint32_t        threads;  // participants including the caller.
+	pool_worker_t   workers[UVCC_MAX_THREADS];
+} pool_t;
+
+// held while a job runs or the pool is replaced; a busy pool runs callers inline.
+static pthread_mutex_t run_lock = PTHREAD_MUTEX_INITIALIZER;
+static pool_t *library_pool = NULL;
+
+/* Internal APIs */
+static pool_t *create_pool(uint32_t threads);
+static void destroy_pool(pool_t *pool);
+static void *worker_main(void *arg);
+static void run_tiles(pool_job_t *job, uint32_t self, uint32_t participants);
+static int take_tile(pool_job_t *job, uint32_t self, uint32_t *tile);
+static int steal_tiles(pool_job_t *job, uint32_t self, uint32_t participants);
+static void run_tile(pool_job_t const *job, uint32_t tile);
+
+uint32_t uvcc_set_thread_count(uint32_t count) {
+	pool_t *pool = NULL;
+	long online;
+
+	if (0 == count) {
+		online = sysconf(_SC_NPROCESSORS_ONLN);
+		count  = (0 < online) ? (uint32_t)online : 1;
+	}
+	if (count > UVCC_MAX_THREADS) {
+		count = UVCC_MAX_THREADS;
+	}
+
+	pthread_mutex_lock(&run_lock);
+	if ((NULL == library_pool) || (library_pool->threads != count)) {
+		if (1 < count) {
+			pool = create_pool(count);
+			if (NULL == pool) {
+				// keep what we had rather than dropping to one thread.
+				count = (NULL != library_pool) ? library_pool->threads : 1;
+				pthread_mutex_unlock(&run_lock);
+				return count;
+			}
+		}
+		destroy_pool(library_pool);
+		library_pool = pool;
+	}
+	pthread_mutex_unlock(&run_lock);
+
+	return count;
+}
+
+uint32_t uvcc_get_thread_count() {
+	uint32_t count;
+
+	pthread_mutex_lock(&run_lock);
+	count = (NULL != library_pool) ? library_pool->threads : 1;
+	pthread_mutex_unlock(&run_lock);
+
+	return count;
+}
+
+int uvcc_run_bands(uint32_t rows, uint32_t tile_rows, uvcc_band_func_t func, void *user_data) {
+	pool_job_t job;
+	pool_t *pool;
+	uint32_t tiles;
+	uint32_t i;
+
+	if (NULL == func) {
+		return INVALID_ARGUMENTS;
+	}
+	if (0 == rows) {
+		return NOERROR;
+	}
+	if (0 == tile_rows) {
+		tile_rows = 1;
+	}
+	tiles = (rows + tile_rows - 1) / tile_rows;
+	if (tiles > POOL_MAX_TILES) {
+		tile_rows = (rows + POOL_MAX_TILES - 1) / POOL_MAX_TILES;
+		tiles     = (rows + tile_rows - 1) / tile_rows;
+	}
+
+	// nested or concurrent runs, and single tiles, are not worth waking anyone.
+	if ((1 == tiles) || (0 != pthread_mutex_trylock(&run_lock))) {
+		func(0, rows, user_data);
+		return NOERROR;
+	}
+	pool = library_pool;
+	if (NULL == pool) {
+		pthread_mutex_unlock(&run_lock);
+		func(0, rows, user_data);
+		return NOERROR;
+	}
+
+	memset(&job, 0, sizeof(job));
+	job.func      = func;
+	job.user_data = user_data;
+	job.rows      = rows;
+	job.tile_rows = tile_rows;
+	for (i = 0; i < pool->threads; ++i) {
+		job.ranges[i] = RANGE(tiles * i / pool->threads, tiles * (i + 1) / pool->threads);
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->job = &job;
+	++pool->generation;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	run_tiles(&job, 0, pool->threads);
+
+	// the job lives on this stack, every worker has to be done with it.
+	pthread_mutex_lock(&pool->lock);
+	while (job.finished + 1 < pool->threads) {
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+	}
+	pool->job = NULL;
+	pthread_mutex_unlock(&pool->lock);
+
+	pthread_mutex_unlock(&run_lock);
+
+	return NOERROR;
+}
+
+static pool_t *create_pool(uint32_t threads) {
+	pool_t *pool;
+	uint32_t i;
+
+	pool = (pool_t*)malloc(sizeof(pool_t));
+	if (NULL == pool) {
+		return NULL;
+	}
+	memset(pool, 0, sizeof(pool_t));
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	// worker 0 is the calling thread.
+	for (i = 1; i < threads; ++i) {
+		pool->workers[i].pool  = pool;
+		pool->workers[i].index = i;
+		if (0 != pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i])) {
+			break;
+		}
+		pool->threads = i + 1;
+	}
+	if (pool->threads != threads) {
+		destroy_pool(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+static void destroy_pool(pool_t *pool) {
+	uint32_t i;
+
+	if (NULL == pool) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->is_exiting = 1;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 1; i < pool->threads; ++i) {
+		pthread_join(pool->workers[i].thread, NULL);
+	}
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+static void *worker_main(void *arg) {
+	pool_worker_t *worker = (pool_worker_t*)arg;
+	pool_t *pool = worker->pool;
+	uint32_t seen = 0;
+	pool_job_t *job;
+
+	pthread_mutex_lock(&pool->lock);
+	for (; ; ) {
+		while (!pool->is_exiting && (seen == pool->generation)) {
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
+		}
+		if (pool->is_exiting) {
+			break;
+		}
+		seen = pool->generation;
+		job  = pool->job;
+		pthread_mutex_unlock(&pool->lock);
+
+		run_tiles(job, worker->index, pool->threads);
+
+		pthread_mutex_lock(&pool->lock);
+		if (++job->finished + 1 == pool->threads) {
+			pthread_cond_signal(&pool->done_cond);
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+static void run_tiles(pool_job_t *job, uint32_t self, uint32_t participants) {
+	uint32_t tile;
+
+	for (; ; ) {
+		while (take_tile(job, self, &tile)) {
+			run_tile(job, tile);
+		}
+		if (!steal_tiles(job, self, participants)) {
+			break;
+		}
+	}
+}
+
+/* Take the first tile of our own share. */
+static int take_tile(pool_job_t *job, uint32_t self, uint32_t *tile) {
+	uint32_t range;
+
+	for (; ; ) {
+		range = job->ranges[self];
+		if (RANGE_BEGIN(range) >= RANGE_END(range)) {
+			return 0;
+		}
+		if (__sync_bool_compare_and_swap(&job->ranges[self], range, RANGE(RANGE_BEGIN(range) + 1, RANGE_END(range)))) {
+			*tile = RANGE_BEGIN(range);
+			return 1;
+		}
+	}
+}
+
+/* Move the back half of the largest share into our own, which is empty. */
+static int steal_tiles(pool_job_t *job, uint32_t self, uint32_t participants) {
+	uint32_t victim, range, left, half;
+	uint32_t best, best_left;
+	uint32_t i;
+
+	for (; ; ) {
+		best      = self;
+		best_left = 0;
+		for (i = 1; i < participants; ++i) {
+			victim = (self + i) % participants;
+			range  = job->ranges[victim];
+			left   = (RANGE_END(range) > RANGE_BEGIN(range)) ? RANGE_END(range) - RANGE_BEGIN(range) : 0;
+			if (left > best_left) {
+				best      = victim;
+				best_left = left;
+			}
+		}
+		if (0 == best_left) {
+			return 0;
+		}
+
+		range = job->ranges[best];
+		if (RANGE_BEGIN(range) >= RANGE_END(range)) {
+			continue;
+		}
+		half = (RANGE_END(range) - RANGE_BEGIN(range) + 1) / 2;
+		if (__sync_bool_compare_and_swap(&job->ranges[best], range, RANGE(RANGE_BEGIN(range), RANGE_END(range) - half))) {
+			// nobody writes an empty share but its owner.
+			__sync_lock_test_and_set(&job->ranges[self], RANGE(RANGE_END(range) - half, RANGE_END(range)));
+			return 1;
+		}
+	}
+}
+
+static void run_tile(pool_job_t const *job, uint32_t tile) {
+	uint32_t const begin = tile * job->tile_rows;
+	uint32_t const end   = (begin + job->tile_rows < job->rows) ? begin + job->tile_rows : job->rows;
+
+	job->func(begin, end, job->user_data);
+}
@@ -0,0 +1,50 @@
+#ifndef UVCC_RECORD_H
+#define UVCC_RECORD_H
+
+#include<stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Segmented recording written by uvccap and read by the replay backend.
+ * "prefix.idx" holds uvcc_record_header_t followed by one
+ * uvcc_record_entry_t per frame; payloads are appended to preallocated
+ * segment files "prefix.s000", "prefix.s001", ... at offsets aligned to
+ * 'align'. Integers are in host byte order (every supported ABI is
+ * little endian).
+ */
+#define UVCC_RECORD_MAGIC        "UVCCREC1"
+#define UVCC_RECORD_VERSION      1
+#define UVCC_RECORD_ALIGN        4096
+#define UVCC_RECORD_INDEX_NAME   "%s.idx"
+#define UVCC_RECORD_SEGMENT_NAME "%s.s%03u"
+
+typedef struct uvcc_record_header_t_ {
+	char     magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t entry_size;
+	uint32_t align;
+	uint32_t reserved[2];
+} uvcc_record_header_t;
+
+typedef struct uvcc_record_entry_t_ {
+	uint64_t offset;       // in the segment.
+	uint64_t timestamp;    // microseconds, as captured.
+	uint32_t segment;
+	uint32_t size;
+	uint32_t sequence;
+	uint32_t flags;
+	uint32_t pixel_format; // enum PIXEL_FORMATS.
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;       // of the first plane.
+} uvcc_record_entry_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
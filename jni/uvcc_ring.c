@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "uvccap.h"
+#include "uvcc_ring.h"
+
+int uvcc_ring_init(uvcc_ring_t *ring, uint32_t capacity, uint32_t elem_size) {
+	uint32_t size;
+	uint32_t i;
+
+	assert(NULL != ring);
+
+	if ((0 == capacity) || (0 == elem_size)) {
+		return INVALID_ARGUMENTS;
+	}
+
+	// round up to power of 2 so that indices can wrap with a mask.
+	for (size = 1; size < capacity; size <<= 1) {
+	}
+
+	memset(ring, 0, sizeof(*ring));
+
+	ring->seqs  = (volatile uint32_t*)malloc(sizeof(uint32_t) * size);
+	ring->elems = (uint8_t*)malloc(elem_size * size);
+	if ((NULL == ring->seqs) || (NULL == ring->elems)) {
+		uvcc_ring_destroy(ring);
+		return INSUFFICIENT_MEMORY;
+	}
+
+	for (i = 0; i < size; ++i) {
+		ring->seqs[i] = i;
+	}
+	ring->elem_size = elem_size;
+	ring->mask      = size - 1;
+	ring->head      = 0;
+	ring->tail      = 0;
+	__sync_synchronize();
+
+	return NOERROR;
+}
+
+void uvcc_ring_destroy(uvcc_ring_t *ring) {
+	assert(NULL != ring);
+
+	free((void*)ring->seqs);
+	free(ring->elems);
+	ring->seqs  = NULL;
+	ring->elems = NULL;
+}
+
+int uvcc_ring_push(uvcc_ring_t *ring, void const *elem) {
+	uint32_t pos = ring->tail;
+	uint32_t seq;
+	int32_t diff;
+
+	for (; ; ) {
+		seq  = ring->seqs[pos & ring->mask];
+		__sync_synchronize();
+		diff = (int32_t)(seq - pos);
+		if (0 == diff) {
+			if (__sync_bool_compare_and_swap(&ring->tail, pos, pos + 1)) {
+				break;
+			}
+		} else if (diff < 0) {
+			return 0; // full
+		}
+		pos = ring->tail;
+	}
+
+	memcpy(ring->elems + (pos & ring->mask) * ring->elem_size, elem, ring->elem_size);
+	__sync_synchronize();
+	ring->seqs[pos & ring->mask] = pos + 1;
+
+	return 1;
+}
+
+int uvcc_ring_pop(uvcc_ring_t *ring, void *elem) {
+	uint32_t pos = ring->head;
+	uint32_t seq;
+	int32_t diff;
+
+	for (; ; ) {
+		seq  = ring->seqs[pos & ring->mask];
+		__sync_synchronize();
+		diff = (int32_t)(seq - (pos + 1));
+		if (0 == diff) {
+			if (__sync_bool_compare_and_swap(&ring->head, pos, pos + 1)) {
+				break;
+			}
+		} else if (diff < 0) {
+			return 0; // empty
+		}
+		pos = ring->head;
+	}
+
+	memcpy(elem, ring->elems + (pos & ring->mask) * ring->elem_size, ring->elem_size);
+	__sync_synchronize();
+	ring->seqs[pos & ring->mask] = pos + ring->mask + 1;
+
+	return 1;
+}
+
+uint32_t uvcc_ring_count(uvcc_ring_t const *ring) {
+	uint32_t const head = ring->head;
+	__sync_synchronize();
+	return ring->tail - head;
+}
+
+uint32_t uvcc_ring_capacity(uvcc_ring_t const *ring) {
+	return ring->mask + 1;
+}
@@ -0,0 +1,37 @@
+#ifndef UVCC_RING_H
+#define UVCC_RING_H
+
+#include<stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bounded lock-free ring of fixed size elements.
+ * Every slot carries a sequence number, so a slot is handed over only
+ * after its element is completely written. Pushing and popping may run
+ * on different threads without locks; a producer may also pop to drop
+ * the oldest element when the ring is full.
+ */
+typedef struct uvcc_ring_t_ {
+	volatile uint32_t *seqs;
+	uint8_t           *elems;
+	uint32_t           elem_size;
+	uint32_t           mask;
+	volatile uint32_t  head;
+	volatile uint32_t  tail;
+} uvcc_ring_t;
+
+extern int  uvcc_ring_init(uvcc_ring_t *ring, uint32_t capacity, uint32_t elem_size);
+extern void uvcc_ring_destroy(uvcc_ring_t *ring);
+extern int  uvcc_ring_push(uvcc_ring_t *ring, void const *elem);
+extern int  uvcc_ring_pop(uvcc_ring_t *ring, void *elem);
+extern uint32_t uvcc_ring_count(uvcc_ring_t const *ring);
+extern uint32_t uvcc_ring_capacity(uvcc_ring_t const *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,418 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "uvccap.h"
+#include "uvcc_convert.h"
+
+/*
+ * Downscaling, one plane after the other and one output row at a time.
+ * A plane scaled to exactly a half (or a quarter) of its size in both
+ * directions goes through the halving kernels; any other ratio through a
+ * box or bilinear filter applied to each channel of the plane, which only
+ * needs one row of vertical sums or blends at a time.
+ */
+
+// as CONVERT_TILE_BYTES: bytes read and written per tile handed to the thread pool.
+#define SCALE_TILE_BYTES   (128 * 1024)
+#define SCALE_MAX_CHANNELS 4
+#define SCALE_MAX_SIZE     0xffff // keeps 16.16 positions within 32 bits.
+
+typedef struct scale_channel_t_ {
+	uint8_t offset; // first byte of the channel in a row.
+	uint8_t step;   // bytes from one sample to the next.
+	uint8_t xshift; // horizontal subsampling, log2.
+} scale_channel_t;
+
+typedef struct scale_plane_t_ {
+	uint8_t         yshift; // vertical subsampling, log2.
+	uint8_t         halve_layout;
+	uint8_t         channels;
+	scale_channel_t channel[SCALE_MAX_CHANNELS];
+} scale_plane_t;
+
+typedef struct scale_format_t_ {
+	uint32_t      format;
+	uint32_t      planes;
+	scale_plane_t plane[3];
+} scale_format_t;
+
+typedef struct scale_job_t_ {
+	uvcc_convert_kernels_t const *kernels;
+	scale_plane_t const *plane;
+	uint8_t const *src;
+	uint32_t       src_stride;
+	uint32_t       src_rows;
+	uint32_t       src_bytes; // bytes of a row holding samples.
+	uint8_t       *dst;
+	uint32_t       dst_stride;
+	uint32_t       dst_rows;
+	uint32_t       dst_bytes;
+	uint32_t       halvings;  // 1 or 2 for exact halves and quarters, 0 otherwise.
+	uint32_t       filter;
+	uint32_t       src_samples[SCALE_MAX_CHANNELS];
+	uint32_t       dst_samples[SCALE_MAX_CHANNELS];
+	// per output sample: first source sample, and the end (box) or weight (bilinear).
+	uint32_t      *x_first[SCALE_MAX_CHANNELS];
+	uint32_t      *x_param[SCALE_MAX_CHANNELS];
+	uint32_t volatile failed;
+} scale_job_t;
+
+#define PLANE_Y    { 0, UVCC_HALVE_PLANE, 1, { { 0, 1, 0 } } }
+#define PLANE_C(x, y) { y, UVCC_HALVE_PLANE, 1, { { 0, 1, x } } }
+#define PLANE_RGBA { 0, UVCC_HALVE_QUAD, 4, { { 0, 4, 0 }, { 1, 4, 0 }, { 2, 4, 0 }, { 3, 4, 0 } } }
+
+static scale_format_t const SCALE_FORMATS[] = {
+	{ UVCC_PIX_FMT_YUYV,    1, { { 0, UVCC_HALVE_YUYV, 3, { { 0, 2, 0 }, { 1, 4, 1 }, { 3, 4, 1 } } } } },
+	{ UVCC_PIX_FMT_UYVY,    1, { { 0, UVCC_HALVE_UYVY, 3, { { 1, 2, 0 }, { 0, 4, 1 }, { 2, 4, 1 } } } } },
+	{ UVCC_PIX_FMT_RGB32,   1, { PLANE_RGBA } },
+	{ UVCC_PIX_FMT_BGR32,   1, { PLANE_RGBA } },
+	{ UVCC_PIX_FMT_YUV420,  3, { PLANE_Y, PLANE_C(1, 1), PLANE_C(1, 1) } },
+	{ UVCC_PIX_FMT_YUV422P, 3, { PLANE_Y, PLANE_C(1, 0), PLANE_C(1, 0) } },
+	{ UVCC_PIX_FMT_YUV410,  3, { PLANE_Y, PLANE_C(2, 2), PLANE_C(2, 2) } },
+	{ UVCC_PIX_FMT_NV12,    2, { PLANE_Y, { 1, UVCC_HALVE_PAIR, 2, { { 0, 2, 1 }, { 1, 2, 1 } } } } },
+	{ UVCC_PIX_FMT_NV21,    2, { PLANE_Y, { 1, UVCC_HALVE_PAIR, 2, { { 0, 2, 1 }, { 1, 2, 1 } } } } },
+};
+
+/* source byte pairs averaged into each byte of an output group, by layout. */
+static uint8_t const HALVE_GROUP_BYTES[UVCC_HALVE_COUNT] = { 1, 2, 4, 4, 4 };
+static uint8_t const HALVE_PAIRS[UVCC_HALVE_COUNT][4][2] = {
+	{ { 0, 1 } },
+	{ { 0, 2 }, { 1, 3 } },
+	{ { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 } },
+	{ { 0, 2 }, { 1, 5 }, { 4, 6 }, { 3, 7 } }, // Y0 Y1 -> Y, U0 U1 -> U, Y2 Y3 -> Y, V0 V1 -> V
+	{ { 0, 4 }, { 1, 3 }, { 2, 6 }, { 5, 7 } },
+};
+
+/* Internal APIs */
+static scale_format_t const *find_scale_format(uint32_t format);
+static uint32_t subsampled(uint32_t size, uint32_t shift);
+static uint32_t row_bytes(scale_plane_t const *plane, uint32_t width);
+static uint32_t count_halvings(scale_job_t const *job);
+static int build_x_tables(scale_job_t *job);
+static uint32_t bilinear_position(uint32_t index, uint32_t src_size, uint32_t dst_size);
+static void halve_row(uvcc_convert_kernels_t const *kernels, uint8_t const *src0, uint8_t const *src1, uint8_t *dst, uint32_t dst_bytes, uint32_t layout);
+static void scale_halve_rows(uint32_t begin, uint32_t end, void *user_data);
+static void scale_box_rows(uint32_t begin, uint32_t end, void *user_data);
+static void scale_bilinear_rows(uint32_t begin, uint32_t end, void *user_data);
+
+int uvcc_scale(uvcc_planes_t const *src, uint32_t src_width, uint32_t src_height, uvcc_planes_t const *dst, uint32_t dst_width, uint32_t dst_height, uint32_t format, uint32_t filter) {
+	scale_format_t const *fmt;
+	scale_plane_t const *plane;
+	scale_job_t job;
+	uvcc_band_func_t func;
+	uint32_t bytes_per_row, tile_rows;
+	uint32_t p, c;
+	int ret = NOERROR;
+
+	if ((NULL == src) || (NULL == dst) || (filter >= UVCC_SCALE_FILTER_COUNT)) {
+		return INVALID_ARGUMENTS;
+	}
+	if ((0 == dst_width) || (0 == dst_height) || (dst_width > src_width) || (dst_height > src_height)) {
+		return INVALID_ARGUMENTS;
+	}
+	if ((src_width > SCALE_MAX_SIZE) || (src_height > SCALE_MAX_SIZE)) {
+		return INVALID_ARGUMENTS;
+	}
+	fmt = find_scale_format(format);
+	if (NULL == fmt) {
+		return INVALID_FORMAT_ARGUMENTS;
+	}
+	if (((UVCC_PIX_FMT_YUYV == format) || (UVCC_PIX_FMT_UYVY == format)) && (0 != ((src_width | dst_width) & 1))) {
+		return INVALID_ARGUMENTS;
+	}
+	for (p = 0; p < fmt->planes; ++p) {
+		if ((NULL == src->data[p]) || (NULL == dst->data[p])) {
+			return INVALID_ARGUMENTS;
+		}
+		if ((src->stride[p] < row_bytes(&fmt->plane[p], src_width)) || (dst->stride[p] < row_bytes(&fmt->plane[p], dst_width))) {
+			return INVALID_ARGUMENTS;
+		}
+	}
+
+	for (p = 0; (p < fmt->planes) && (NOERROR == ret); ++p) {
+		plane = &fmt->plane[p];
+		memset(&job, 0, sizeof(job));
+		job.kernels    = uvcc_get_kernels();
+		job.plane      = plane;
+		job.src        = (uint8_t const*)src->data[p];
+		job.src_stride = src->stride[p];
+		job.src_rows   = subsampled(src_height, plane->yshift);
+		job.src_bytes  = row_bytes(plane, src_width);
+		job.dst        = (uint8_t*)dst->data[p];
+		job.dst_stride = dst->stride[p];
+		job.dst_rows   = subsampled(dst_height, plane->yshift);
+		job.dst_bytes  = row_bytes(plane, dst_width);
+		job.filter     = filter;
+		for (c = 0; c < plane->channels; ++c) {
+			job.src_samples[c] = subsampled(src_width, plane->channel[c].xshift);
+			job.dst_samples[c] = subsampled(dst_width, plane->channel[c].xshift);
+		}
+
+		job.halvings = count_halvings(&job);
+		if (0 != job.halvings) {
+			func = scale_halve_rows;
+		} else {
+			if (NOERROR != build_x_tables(&job)) {
+				return INSUFFICIENT_MEMORY;
+			}
+			func = (UVCC_SCALE_BOX == filter) ? scale_box_rows : scale_bilinear_rows;
+		}
+
+		bytes_per_row = job.src_bytes * ((job.src_rows + job.dst_rows - 1) / job.dst_rows) + job.dst_bytes;
+		tile_rows     = SCALE_TILE_BYTES / bytes_per_row;
+		ret = uvcc_run_bands(job.dst_rows, tile_rows, func, &job);
+		if ((NOERROR == ret) && (0 != job.failed)) {
+			ret = INSUFFICIENT_MEMORY;
+		}
+		free(job.x_first[0]);
+	}
+
+	return ret;
+}
+
+uint32_t uvcc_halve_row_c(uint8_t const *src0, uint8_t const *src1, uint8_t *dst, uint32_t dst_bytes, uint32_t layout) {
+	uint32_t const group = HALVE_GROUP_BYTES[layout];
+	uint8_t const (*pairs)[2] = HALVE_PAIRS[layout];
+	uint32_t x, i;
+
+	for (x = 0; x + group <= dst_bytes; x += group) {
+		for (i = 0; i < group; ++i) {
+			dst[x + i] = (uint8_t)((src0[pairs[i][0]] + src0[pairs[i][1]] + src1[pairs[i][0]] + src1[pairs[i][1]] + 2) >> 2);
+		}
+		src0 += group * 2;
+		src1 += group * 2;
+	}
+
+	return x;
+}
+
+static scale_format_t const *find_scale_format(uint32_t format) {
+	uint32_t i;
+
+	for (i = 0; i < sizeof(SCALE_FORMATS) / sizeof(SCALE_FORMATS[0]); ++i) {
+		if (SCALE_FORMATS[i].format == format) {
+			return &SCALE_FORMATS[i];
+		}
+	}
+	return NULL;
+}
+
+/* Samples left of 'size' after subsampling, a partial block counting as one. */
+static uint32_t subsampled(uint32_t size, uint32_t shift) {
+	return (size + (1u << shift) - 1) >> shift;
+}
+
+static uint32_t row_bytes(scale_plane_t const *plane, uint32_t width) {
+	scale_channel_t const *ch;
+	uint32_t bytes = 0;
+	uint32_t end;
+	uint32_t c;
+
+	for (c = 0; c < plane->channels; ++c) {
+		ch  = &plane->channel[c];
+		end = ch->offset + ch->step * (subsampled(width, ch->xshift) - 1) + 1;
+		if (end > bytes) {
+			bytes = end;
+		}
+	}
+	return bytes;
+}
+
+/* 1 or 2 when every channel of the plane shrinks to exactly a half or a quarter. */
+static uint32_t count_halvings(scale_job_t const *job) {
+	uint32_t halvings, c;
+
+	for (halvings = 1; halvings <= 2; ++halvings) {
+		if ((job->dst_rows << halvings) != job->src_rows) {
+			continue;
+		}
+		for (c = 0; c < job->plane->channels; ++c) {
+			if ((job->dst_samples[c] << halvings) != job->src_samples[c]) {
+				break;
+			}
+		}
+		if (c == job->plane->channels) {
+			return halvings;
+		}
+	}
+	return 0;
+}
+
+static int build_x_tables(scale_job_t *job) {
+	uint32_t total = 0;
+	uint32_t *table;
+	uint32_t ns, nd, first, end, pos;
+	uint32_t c, x;
+
+	for (c = 0; c < job->plane->channels; ++c) {
+		total += job->dst_samples[c] * 2;
+	}
+	table = (uint32_t*)malloc(total * sizeof(uint32_t));
+	if (NULL == table) {
+		return INSUFFICIENT_MEMORY;
+	}
+
+	for (c = 0; c < job->plane->channels; ++c) {
+		ns = job->src_samples[c];
+		nd = job->dst_samples[c];
+		job->x_first[c] = table;
+		job->x_param[c] = table + nd;
+		table += nd * 2;
+		for (x = 0; x < nd; ++x) {
+			if (UVCC_SCALE_BOX == job->filter) {
+				first = (uint32_t)((uint64_t)x * ns / nd);
+				end   = (uint32_t)((uint64_t)(x + 1) * ns / nd);
+				job->x_first[c][x] = first;
+				job->x_param[c][x] = (end > first) ? end : first + 1;
+			} else {
+				pos = bilinear_position(x, ns, nd);
+				job->x_first[c][x] = pos >> 16;
+				job->x_param[c][x] = (pos >> 8) & 0xff;
+			}
+		}
+	}
+
+	return NOERROR;
+}
+
+/* Source position of the center of output sample 'index', in 16.16 fixed point. */
+static uint32_t bilinear_position(uint32_t index, uint32_t src_size, uint32_t dst_size) {
+	uint64_t pos = ((uint64_t)(index * 2 + 1) * src_size << 16) / (dst_size * 2);
+	uint64_t const last = (uint64_t)(src_size - 1) << 16;
+
+	pos = (pos > 0x8000) ? pos - 0x8000 : 0;
+	return (uint32_t)((pos < last) ? pos : last);
+}
+
+static void halve_row(uvcc_convert_kernels_t const *kernels, uint8_t const *src0, uint8_t const *src1, uint8_t *dst, uint32_t dst_bytes, uint32_t layout) {
+	uint32_t const done = kernels->halve_row(src0, src1, dst, dst_bytes, layout);
+
+	if (done < dst_bytes) {
+		uvcc_halve_row_c(src0 + done * 2, src1 + done * 2, dst + done, dst_bytes - done, layout);
+	}
+}
+
+static void scale_halve_rows(uint32_t begin, uint32_t end, void *user_data) {
+	scale_job_t *job = (scale_job_t*)user_data;
+	uint32_t const layout = job->plane->halve_layout;
+	uint8_t const *s = job->src + (begin << job->halvings) * job->src_stride;
+	uint8_t *d = job->dst + begin * job->dst_stride;
+	uint8_t *half = NULL;
+	uint32_t y;
+
+	if (2 == job->halvings) {
+		// two rows of the half-size plane, halved once more.
+		half = (uint8_t*)malloc(job->dst_bytes * 4);
+		if (NULL == half) {
+			__sync_fetch_and_or(&job->failed, 1);
+			return;
+		}
+	}
+
+	for (y = begin; y < end; ++y) {
+		if (NULL == half) {
+			halve_row(job->kernels, s, s + job->src_stride, d, job->dst_bytes, layout);
+			s += job->src_stride * 2;
+		} else {
+			halve_row(job->kernels, s,                       s + job->src_stride,     half,                      job->dst_bytes * 2, layout);
+			halve_row(job->kernels, s + job->src_stride * 2, s + job->src_stride * 3, half + job->dst_bytes * 2, job->dst_bytes * 2, layout);
+			halve_row(job->kernels, half, half + job->dst_bytes * 2, d, job->dst_bytes, layout);
+			s += job->src_stride * 4;
+		}
+		d += job->dst_stride;
+	}
+
+	free(half);
+}
+
+static void scale_box_rows(uint32_t begin, uint32_t end, void *user_data) {
+	scale_job_t *job = (scale_job_t*)user_data;
+	scale_plane_t const *plane = job->plane;
+	scale_channel_t const *ch;
+	uint8_t const *s;
+	uint8_t *d;
+	uint32_t *sums;
+	uint32_t first, last, rows, count, sum;
+	uint32_t y, x, c, b, i;
+
+	sums = (uint32_t*)malloc(job->src_bytes * sizeof(uint32_t));
+	if (NULL == sums) {
+		__sync_fetch_and_or(&job->failed, 1);
+		return;
+	}
+
+	for (y = begin; y < end; ++y) {
+		first = (uint32_t)((uint64_t)y * job->src_rows / job->dst_rows);
+		last  = (uint32_t)((uint64_t)(y + 1) * job->src_rows / job->dst_rows);
+		rows  = (last > first) ? last - first : 1;
+
+		// vertical sums of whole rows first, whatever their layout.
+		s = job->src + first * job->src_stride;
+		for (b = 0; b < job->src_bytes; ++b) {
+			sums[b] = s[b];
+		}
+		for (i = 1; i < rows; ++i) {
+			s += job->src_stride;
+			for (b = 0; b < job->src_bytes; ++b) {
+				sums[b] += s[b];
+			}
+		}
+
+		d = job->dst + y * job->dst_stride;
+		for (c = 0; c < plane->channels; ++c) {
+			ch = &plane->channel[c];
+			for (x = 0; x < job->dst_samples[c]; ++x) {
+				sum = 0;
+				for (i = job->x_first[c][x]; i < job->x_param[c][x]; ++i) {
+					sum += sums[ch->offset + ch->step * i];
+				}
+				count = (job->x_param[c][x] - job->x_first[c][x]) * rows;
+				d[ch->offset + ch->step * x] = (uint8_t)((sum + count / 2) / count);
+			}
+		}
+	}
+
+	free(sums);
+}
+
+static void scale_bilinear_rows(uint32_t begin, uint32_t end, void *user_data) {
+	scale_job_t *job = (scale_job_t*)user_data;
+	scale_plane_t const *plane = job->plane;
+	scale_channel_t const *ch;
+	uint8_t const *s0, *s1;
+	uint8_t *d;
+	uint16_t *blend;
+	uint32_t pos, wy, wx, x0, x1, last;
+	uint32_t y, x, c, b;
+
+	blend = (uint16_t*)malloc(job->src_bytes * sizeof(uint16_t));
+	if (NULL == blend) {
+		__sync_fetch_and_or(&job->failed, 1);
+		return;
+	}
+
+	for (y = begin; y < end; ++y) {
+		pos = bilinear_position(y, job->src_rows, job->dst_rows);
+		wy  = (pos >> 8) & 0xff;
+		s0  = job->src + (pos >> 16) * job->src_stride;
+		s1  = ((pos >> 16) + 1 < job->src_rows) ? s0 + job->src_stride : s0;
+		for (b = 0; b < job->src_bytes; ++b) {
+			blend[b] = (uint16_t)(s0[b] * (256 - wy) + s1[b] * wy);
+		}
+
+		d = job->dst + y * job->dst_stride;
+		for (c = 0; c < plane->channels; ++c) {
+			ch   = &plane->channel[c];
+			last = job->src_samples[c] - 1;
+			for (x = 0; x < job->dst_samples[c]; ++x) {
+				x0 = job->x_first[c][x];
+				x1 = (x0 < last) ? x0 + 1 : last;
+				wx = job->x_param[c][x];
+				d[ch->offset + ch->step * x] = (uint8_t)((blend[ch->offset + ch->step * x0] * (256 - wx) + blend[ch->offset + ch->step * x1] * wx + 0x8000) >> 16);
+			}
+		}
+	}
+
+	free(blend);
+}
@@ -0,0 +1,125 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "uvccap.h"
+#include "uvcc_stats.h"
+
+// every power of two is split into 2^SUB_BUCKET_BITS linear buckets (~12% precision).
+#define SUB_BUCKET_BITS 3
+#define SUB_BUCKETS     (1 << SUB_BUCKET_BITS)
+
+static uint32_t bucket_of(uint32_t value) {
+	uint32_t msb;
+	uint32_t bucket;
+
+	if (value < SUB_BUCKETS) {
+		return value;
+	}
+
+	msb    = 31 - __builtin_clz(value);
+	bucket = (msb - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + ((value >> (msb - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+
+	return (bucket < UVCC_HISTOGRAM_BUCKETS) ? bucket : UVCC_HISTOGRAM_BUCKETS - 1;
+}
+
+void uvcc_histogram_reset(uvcc_histogram_t *hist) {
+	uint32_t i;
+
+	assert(NULL != hist);
+
+	for (i = 0; i < UVCC_HISTOGRAM_BUCKETS; ++i) {
+		__sync_and_and_fetch(&hist->buckets[i], 0);
+	}
+	__sync_and_and_fetch(&hist->count, 0);
+	__sync_and_and_fetch(&hist->max, 0);
+	__sync_or_and_fetch(&hist->min, UINT32_MAX);
+}
+
+void uvcc_histogram_record(uvcc_histogram_t *hist, uint32_t value) {
+	volatile uint32_t *min = &hist->min;
+	volatile uint32_t *max = &hist->max;
+	uint32_t cur;
+
+	__sync_fetch_and_add(&hist->buckets[bucket_of(value)], 1);
+	__sync_fetch_and_add(&hist->count, 1);
+
+	for (cur = *min; (value < cur) && !__sync_bool_compare_and_swap(min, cur, value); cur = *min) {
+	}
+	for (cur = *max; (value > cur) && !__sync_bool_compare_and_swap(max, cur, value); cur = *max) {
+	}
+}
+
+void uvcc_histogram_copy(uvcc_histogram_t *dst, uvcc_histogram_t const *src) {
+	assert(NULL != dst);
+	assert(NULL != src);
+
+	__sync_synchronize();
+	memcpy(dst, src, sizeof(*dst));
+	if (0 == dst->count) {
+		dst->min = 0;
+	}
+}
+
+uint32_t uvcc_histogram_bucket_value(uint32_t bucket) {
+	uint32_t msb;
+
+	if (bucket < SUB_BUCKETS) {
+		return bucket;
+	}
+	if (bucket >= UVCC_HISTOGRAM_BUCKETS) {
+		bucket = UVCC_HISTOGRAM_BUCKETS - 1;
+	}
+
+	msb = bucket / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+
+	return (uint32_t)(SUB_BUCKETS + bucket % SUB_BUCKETS) << (msb - SUB_BUCKET_BITS);
+}
+
+uint32_t uvcc_histogram_percentile(uvcc_histogram_t const *hist, double percentile) {
+	uint64_t total = 0;
+	uint64_t target;
+	uint64_t seen = 0;
+	uint32_t value;
+	uint32_t i;
+
+	if (NULL == hist) {
+		return 0;
+	}
+
+	for (i = 0; i < UVCC_HISTOGRAM_BUCKETS; ++i) {
+		total += hist->buckets[i];
+	}
+	if (0 == total) {
+		return 0;
+	}
+
+	if (percentile < 0.0) {
+		percentile = 0.0;
+	} else if (percentile > 100.0) {
+		percentile = 100.0;
+	}
+	target = (uint64_t)(total * percentile / 100.0 + 0.5);
+	if (0 == target) {
+		target = 1;
+	}
+
+	for (i = 0; i < UVCC_HISTOGRAM_BUCKETS; ++i) {
+		seen += hist->buckets[i];
+		if (seen >= target) {
+			break;
+		}
+	}
+
+	// report the highest value that falls into the bucket, but never beyond the recorded range.
+	value = (i + 1 < UVCC_HISTOGRAM_BUCKETS) ? uvcc_histogram_bucket_value(i + 1) - 1 : hist->max;
+	if ((0 != hist->max) && (value > hist->max)) {
+		value = hist->max;
+	}
+	if (value < hist->min) {
+		value = hist->min;
+	}
+
+	return value;
+}
@@ -0,0 +1,25 @@
+#ifndef UVCC_STATS_H
+#define UVCC_STATS_H
+
+#include<stdint.h>
+
+#include "uvccap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Histograms are updated with atomic adds only, so that the capture thread
+ * and the callers can record concurrently while another thread copies
+ * them out through uvcc_get_stats().
+ */
+extern void uvcc_histogram_reset(uvcc_histogram_t *hist);
+extern void uvcc_histogram_record(uvcc_histogram_t *hist, uint32_t value);
+extern void uvcc_histogram_copy(uvcc_histogram_t *dst, uvcc_histogram_t const *src);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
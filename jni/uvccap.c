@@ -4,22 +4,55 @@
 #include <errno.h>
 #include <assert.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#ifdef __ANDROID__
 #include <linux/videodev.h>
-
-#include <android/log.h>
+#else
+#include <linux/videodev2.h>
+#endif
 
 #define LOG_TAG "uvccap"
+#ifdef __ANDROID__
+#include <android/log.h>
 #define LOGE(fmt, ...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, fmt, ##__VA_ARGS__)
 #define LOGD(fmt, ...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, fmt, ##__VA_ARGS__)
 #define LOGI(fmt, ...) __android_log_print(ANDROID_LOG_INFO,  LOG_TAG, fmt, ##__VA_ARGS__)
 #define LOGW(fmt, ...) __android_log_print(ANDROID_LOG_WARN,  LOG_TAG, fmt, ##__VA_ARGS__)
+#else
+// host builds log to stderr.
+#include <stdio.h>
+#define LOGE(fmt, ...) fprintf(stderr, LOG_TAG ": E " fmt "\n", ##__VA_ARGS__)
+#define LOGD(fmt, ...) fprintf(stderr, LOG_TAG ": D " fmt "\n", ##__VA_ARGS__)
+#define LOGI(fmt, ...) fprintf(stderr, LOG_TAG ": I " fmt "\n", ##__VA_ARGS__)
+#define LOGW(fmt, ...) fprintf(stderr, LOG_TAG ": W " fmt "\n", ##__VA_ARGS__)
+#endif
 
 #include "uvccap.h"
+#include "uvcc_ring.h"
+#include "uvcc_stats.h"
+#include "uvcc_backend.h"
 
 /* Data structure and constant values */
 #define DEF_PIXEL_FORMAT UVCC_PIX_FMT_YUYV
+#define DEF_BUFFER_COUNT 4
+#define MIN_BUFFER_COUNT 2
+#define HUGE_PAGE_SIZE   (2 * 1024 * 1024)
+
+// frames to observe without pressure before the adaptive ring shrinks.
+#define ADAPTIVE_IDLE_FRAMES 300
+
+#define MAX_SUBSCRIBERS 8
+
+// ready devices handled by one epoll_wait() call.
+#define MAX_LOOP_EVENTS 16
 
 static uint32_t const PIXEL_FORMATS[UVCC_PIX_FMT_COUNT + 1] = {
 	V4L2_PIX_FMT_RGB565,
@@ -30,6 +63,8 @@ static uint32_t const PIXEL_FORMATS[UVCC_PIX_FMT_COUNT + 1] = {
 	V4L2_PIX_FMT_YUV420,
 	V4L2_PIX_FMT_YUV410,
 	V4L2_PIX_FMT_YUV422P,
+	V4L2_PIX_FMT_NV12,
+	V4L2_PIX_FMT_NV21,
 	0, // sentinel
 };
 
@@ -38,60 +73,766 @@ typedef union pixel_format_name_t_ {
 	char name[4];
 } pixel_format_name_t;
 
+enum BUFFER_STATES {
+	BUFFER_STATE_IDLE = 0, // owned by the library.
+	BUFFER_STATE_QUEUED,   // owned by the video device driver.
+	BUFFER_STATE_LEASED,   // owned by the application until released.
+	BUFFER_STATE_PARKED,   // held back from the driver to shrink the ring.
+	BUFFER_STATE_REMOVED,  // freed by the driver, slot can be reused.
+};
+
 typedef struct video_buf_t_ {
 	void    *addr;
 	uint32_t size;
+	int      state;
+	int      dmabuf_fd;
 } video_buf_t;
 
+typedef struct returned_buf_t_ {
+	uint32_t index;
+	uint64_t released_us; // when the application released the frame
+} returned_buf_t;
+
+typedef struct subscriber_t_ {
+	struct video_dev_t_   *dev;
+	uvcc_ring_t            frames;        // capture thread -> subscriber
+	sem_t                  frames_sem;    // frames available in 'frames'
+	sem_t                  space_sem;     // free slots in 'frames' (block policy)
+	int                    has_sync;
+	int                    is_active;
+	volatile uint32_t      delivered;
+	volatile uint32_t      dropped;
+} subscriber_t;
+
 typedef struct video_dev_t_ {
 	int                    fd;
+	uvcc_backend_t const  *backend;
+	void                  *backend_context;
+	int                    wake_fd;        // eventfd to cancel blocking capture
+	int                    thread_wake_fd; // eventfd to wake the capture thread
+	volatile int           cancel_pending;
 	struct v4l2_capability caps;
 	struct v4l2_cropcap    cropcaps;
 	struct v4l2_crop       crop;
 	struct v4l2_format     format;
+	uvcc_frame_layout_t    layout;
+	int                    has_window;
+	uvcc_rect_t            requested_window;
+	uvcc_rect_t            window;         // aligned to the negotiated format
+	uint32_t               window_mode;
+	uvcc_frame_layout_t    window_layout;  // packed planes copied out by uvcc_capture()
 	video_buf_t           *buffers;
 	int                    buffer_count;
 	int                    is_capture_started;
+	int                    is_dmabuf_exported;
+	uint32_t               memory;
+	uint32_t               io_flags;
+	uint32_t               adaptive_min;
+	uint32_t               adaptive_max;
+	uint32_t               idle_frames;
+	int                    shrink_pending;
+	int                    can_create_bufs; // cleared once the driver rejects VIDIOC_CREATE_BUFS
+	int                    has_sequence;
+	uint32_t               last_sequence;
+	uint32_t               dropped_frames;
+	pthread_t              thread;
+	volatile int           is_thread_running;
+	volatile int           is_thread_stopping;
+	int                    thread_result;
+	int                    has_thread;
+	uint32_t               overflow_policy;
+	uvcc_ring_t            returns;       // application -> capture thread
+	volatile uint32_t     *refs;          // subscribers holding each buffer
+	uint32_t               refs_capacity;
+	subscriber_t           default_subscriber;
+	subscriber_t           subscribers[MAX_SUBSCRIBERS];
+	uint32_t               subscriber_count;
+	int                    is_broadcast;
+	uvcc_stats_t           stats;
 } video_dev_t;
 
+typedef struct loop_entry_t_ {
+	video_dev_t           *dev;
+	uvcc_frame_callback_t  callback;
+	void                  *user_data;
+	struct loop_entry_t_  *next;
+} loop_entry_t;
+
+typedef struct event_loop_t_ {
+	int                    epfd;
+	int                    wake_fd;
+	loop_entry_t          *entries;
+} event_loop_t;
+
 /* Internal APIs */
 static void print_capability(struct v4l2_capability const *caps);
 static void print_format_desc(struct v4l2_fmtdesc const *desc);
 static uint32_t to_v4l2_pixel_format(int format);
 static uint32_t from_v4l2_pixel_format(uint32_t format);
-static int init_buffer(video_dev_t *dev);
-static int read_frame(uint8_t * const buf, uint32_t buf_size, video_dev_t const *dev);
+static void build_frame_layout(video_dev_t *dev);
+static uint32_t layout_alignment(uvcc_frame_layout_t const *layout);
+static uint32_t plane_sample_bytes(uvcc_frame_layout_t const *layout, uint32_t plane);
+static uint32_t window_samples(uint32_t begin, uint32_t size, uint32_t shift);
+static int align_window(uvcc_frame_layout_t const *layout, uvcc_rect_t const *window, uvcc_rect_t *aligned);
+static void build_window_layout(uvcc_frame_layout_t const *layout, uvcc_rect_t const *window, uvcc_frame_layout_t *packed);
+static int set_device_window(video_dev_t *dev, uvcc_rect_t const *window);
+static int set_format(video_dev_t *dev, uint32_t width, uint32_t height, uint32_t pixel_format);
+static int get_device_frame_planes(video_dev_t const *dev, uvcc_frame_t const *frame, uvcc_planes_t *planes, uvcc_frame_layout_t const **layout);
+static int init_buffer(video_dev_t *dev, uint32_t count);
+static void setup_buffer(video_dev_t const *dev, uint32_t index, struct v4l2_buffer *buf);
+static int map_buffer(video_dev_t *dev, uint32_t index, video_buf_t *vbuf);
+static void unmap_buffer(video_dev_t *dev, video_buf_t *vbuf);
+static int device_ioctl(video_dev_t *dev, unsigned long request, void *arg);
+static int alloc_user_buffer(video_dev_t *dev, video_buf_t *vbuf);
+static int export_buffer(video_dev_t *dev, uint32_t index);
+static void unexport_buffer(video_buf_t *vbuf);
+static uint32_t count_buffers(video_dev_t const *dev, int state);
+static void adapt_buffers(video_dev_t *dev, uint32_t gap);
+static int grow_buffers(video_dev_t *dev);
+static void shrink_buffers(video_dev_t *dev, uint32_t index);
+static uint64_t monotonic_ms();
+static uint64_t clock_us(clockid_t clock);
+static int wait_frames_sem(sem_t *sem, int timeout_ms, uint64_t begin_us);
+static void record_latency(video_dev_t *dev, int stage, uint64_t begin_us, uint64_t end_us);
+static void record_wait(video_dev_t *dev, int result, uint64_t begin_us);
+static int wait_frame(video_dev_t *dev, int timeout_ms);
+static void wake_up(int fd);
+static int dequeue_frame(video_dev_t *dev, uvcc_frame_t *frame);
+static int queue_buffer(video_dev_t *dev, uint32_t index);
+static int return_buffer(video_dev_t *dev, uint32_t index);
+static int requeue_buffer(video_dev_t *dev, uint32_t index, uint64_t released_us);
+static void drain_returns(video_dev_t *dev);
+static void unref_buffer(video_dev_t *dev, uint32_t index);
+static int init_subscriber(video_dev_t *dev, subscriber_t *sub, uint32_t ring_size);
+static void destroy_subscriber(subscriber_t *sub);
+static void drain_subscriber(subscriber_t *sub);
+static int take_frame(subscriber_t *sub, uvcc_frame_t *frame, int timeout_ms);
+static void deliver_frame(subscriber_t *sub, uvcc_frame_t const *frame);
+static void publish_frame(video_dev_t *dev, uvcc_frame_t const *frame);
+static subscriber_t *get_subscriber(video_dev_t *dev, uint32_t i);
+static void *capture_thread_main(void *arg);
+
+static uint64_t monotonic_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t clock_us(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void record_latency(video_dev_t *dev, int stage, uint64_t begin_us, uint64_t end_us) {
+	uint64_t const elapsed = end_us - begin_us;
+
+	// a zero or future start means the stage was not observed.
+	if ((0 == begin_us) || (begin_us > end_us)) {
+		return;
+	}
+	uvcc_histogram_record(&dev->stats.latency[stage], (elapsed < UINT32_MAX) ? (uint32_t)elapsed : UINT32_MAX);
+}
+
+static void record_wait(video_dev_t *dev, int result, uint64_t begin_us) {
+	if (NOERROR == result) {
+		record_latency(dev, UVCC_STAT_WAIT, begin_us, clock_us(CLOCK_MONOTONIC));
+	} else if (CAPTURE_TIMEOUT == result) {
+		__sync_fetch_and_add(&dev->stats.timeouts, 1);
+	} else if (CAPTURE_CANCELLED == result) {
+		__sync_fetch_and_add(&dev->stats.cancelled, 1);
+	}
+}
+
+static void wake_up(int fd) {
+	uint64_t const value = 1;
+	while ((0 > write(fd, &value, sizeof(value))) && (EINTR == errno)) {
+	}
+}
+
+/* sleeps until a frame is ready, the wait is cancelled or 'timeout_ms' (-1 = infinite) elapses. */
+static int wait_frame(video_dev_t *dev, int timeout_ms) {
+	struct pollfd fds[2];
+	uint64_t const deadline = monotonic_ms() + (0 < timeout_ms ? timeout_ms : 0);
+	uint64_t now, value;
+	int wait = timeout_ms;
+	int n;
+
+	assert(NULL != dev);
+
+	for (; ; ) {
+		fds[0].fd      = dev->fd;
+		fds[0].events  = POLLIN;
+		fds[0].revents = 0;
+		fds[1].fd      = dev->wake_fd;
+		fds[1].events  = POLLIN;
+		fds[1].revents = 0;
 
-static int read_frame(uint8_t * const buf, uint32_t buf_size, video_dev_t const *dev) {
+		n = poll(fds, 2, wait);
+
+		if (n < 0) {
+			if (EINTR == errno) {
+				if (0 <= timeout_ms) {
+					now  = monotonic_ms();
+					wait = (deadline > now) ? (int)(deadline - now) : 0;
+				}
+				continue;
+			}
+			LOGE("Failed to wait for capturable frame (%s).", strerror(errno));
+			return IO_ERROR;
+		}
+
+		if (0 != (POLLIN & fds[1].revents)) {
+			read(dev->wake_fd, &value, sizeof(value));
+			return CAPTURE_CANCELLED;
+		}
+		if (0 != fds[0].revents) {
+			// errors are reported by the following VIDIOC_DQBUF.
+			return NOERROR;
+		}
+		return CAPTURE_TIMEOUT;
+	}
+}
+
+static int dequeue_frame(video_dev_t *dev, uvcc_frame_t *frame) {
 	struct v4l2_buffer v4l2_buf;
-	int result = NOERROR;
-	uint32_t size;
+	void const *data;
+	uint64_t now;
+	uint32_t gap;
 
-	assert(NULL != buf);
 	assert(NULL != dev);
+	assert(NULL != frame);
 
 	memset(&v4l2_buf, 0, sizeof(v4l2_buf));
 	v4l2_buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	v4l2_buf.memory = V4L2_MEMORY_MMAP;
+	v4l2_buf.memory = dev->memory;
 
-	if (0 > ioctl(dev->fd, VIDIOC_DQBUF, &v4l2_buf)) {
+	if (0 > device_ioctl(dev, VIDIOC_DQBUF, &v4l2_buf)) {
 		LOGE("Failed to dequeueing buffer (%s).", strerror(errno));
 		return MEMORY_DEQUEUEING_FAILED;
 	}
 
+	now = clock_us(CLOCK_MONOTONIC);
+
 	assert(v4l2_buf.index < dev->buffer_count);
 
-	size = buf_size < dev->buffers[v4l2_buf.index].size ? buf_size : dev->buffers[v4l2_buf.index].size;
-	memcpy(buf, dev->buffers[v4l2_buf.index].addr, size);
+	dev->buffers[v4l2_buf.index].state = BUFFER_STATE_LEASED;
+	if (v4l2_buf.index < dev->refs_capacity) {
+		dev->refs[v4l2_buf.index] = 1;
+	}
+
+	// a gap in the sequence numbers means the driver dropped frames.
+	gap = dev->has_sequence ? v4l2_buf.sequence - dev->last_sequence - 1 : 0;
+	dev->has_sequence   = 1;
+	dev->last_sequence  = v4l2_buf.sequence;
+	__sync_fetch_and_add(&dev->dropped_frames, gap);
+
+	adapt_buffers(dev, gap);
+
+	frame->data      = dev->buffers[v4l2_buf.index].addr;
+	if (NULL != dev->backend->frame_data) {
+		// backends may hand out frames which never went through the buffer.
+		data = dev->backend->frame_data(dev->backend_context, &v4l2_buf);
+		if (NULL != data) {
+			frame->data = data;
+		}
+	}
+	frame->size      = v4l2_buf.bytesused;
+	frame->index     = v4l2_buf.index;
+	frame->dmabuf_fd = dev->buffers[v4l2_buf.index].dmabuf_fd;
+	frame->sequence  = v4l2_buf.sequence;
+	frame->dropped   = gap;
+	frame->timestamp = (uint64_t)v4l2_buf.timestamp.tv_sec * 1000000 + v4l2_buf.timestamp.tv_usec;
+	frame->dequeued  = now;
+	frame->flags     = 0;
+	frame->layout    = &dev->layout;
+	if (0 != (V4L2_BUF_FLAG_ERROR & v4l2_buf.flags)) {
+		frame->flags |= UVCC_FRAME_FLAG_ERROR;
+	}
+	if (0 != (V4L2_BUF_FLAG_KEYFRAME & v4l2_buf.flags)) {
+		frame->flags |= UVCC_FRAME_FLAG_KEYFRAME;
+	}
+#ifdef V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC
+	if (V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC == (V4L2_BUF_FLAG_TIMESTAMP_MASK & v4l2_buf.flags)) {
+		frame->flags |= UVCC_FRAME_FLAG_MONOTONIC;
+	}
+#endif
+
+	// some drivers leave 'bytesused' unset for uncompressed formats.
+	if ((0 == frame->size) || (frame->size > dev->buffers[v4l2_buf.index].size)) {
+		frame->size = dev->buffers[v4l2_buf.index].size;
+	}
+
+	__sync_fetch_and_add(&dev->stats.frames, 1);
+	if (0 != (UVCC_FRAME_FLAG_ERROR & frame->flags)) {
+		__sync_fetch_and_add(&dev->stats.corrupted, 1);
+	}
+	// older drivers stamp frames with the wall clock.
+	if (0 != (UVCC_FRAME_FLAG_MONOTONIC & frame->flags)) {
+		record_latency(dev, UVCC_STAT_DEQUEUE, frame->timestamp, now);
+	} else {
+		record_latency(dev, UVCC_STAT_DEQUEUE, frame->timestamp, clock_us(CLOCK_REALTIME));
+	}
+
+	return NOERROR;
+}
+
+static int queue_buffer(video_dev_t *dev, uint32_t index) {
+	struct v4l2_buffer v4l2_buf;
 
-	if (0 > ioctl(dev->fd, VIDIOC_QBUF, &v4l2_buf)) {
+	assert(NULL != dev);
+	assert(index < dev->buffer_count);
+
+	setup_buffer(dev, index, &v4l2_buf);
+
+	if (0 > device_ioctl(dev, VIDIOC_QBUF, &v4l2_buf)) {
 		LOGE("Failed to queueing buffer (%s).", strerror(errno));
-		result = MEMORY_QUEUEING_FAILED;
+		dev->buffers[index].state = BUFFER_STATE_IDLE;
+		return MEMORY_QUEUEING_FAILED;
+	}
+
+	dev->buffers[index].state = BUFFER_STATE_QUEUED;
+
+	return NOERROR;
+}
+
+static int return_buffer(video_dev_t *dev, uint32_t index) {
+	assert(NULL != dev);
+	assert(index < dev->buffer_count);
+
+	if (!dev->is_capture_started) {
+		// queued again by the next uvcc_start_capture().
+		dev->buffers[index].state = BUFFER_STATE_IDLE;
+		return NOERROR;
+	}
+
+	if (dev->shrink_pending) {
+		shrink_buffers(dev, index);
+		return NOERROR;
+	}
+
+	return queue_buffer(dev, index);
+}
+
+static int requeue_buffer(video_dev_t *dev, uint32_t index, uint64_t released_us) {
+	int const result = return_buffer(dev, index);
+
+	if ((NOERROR == result) && (BUFFER_STATE_QUEUED == dev->buffers[index].state)) {
+		record_latency(dev, UVCC_STAT_REQUEUE, released_us, clock_us(CLOCK_MONOTONIC));
+	}
+
+	return result;
+}
+
+static void drain_returns(video_dev_t *dev) {
+	returned_buf_t ret;
+
+	if (NULL == dev->returns.seqs) {
+		return;
+	}
+	while (uvcc_ring_pop(&dev->returns, &ret)) {
+		requeue_buffer(dev, ret.index, ret.released_us);
+	}
+}
+
+static void unref_buffer(video_dev_t *dev, uint32_t index) {
+	// called on the capture thread or after it has stopped.
+	if ((index < dev->refs_capacity) && (0 != __sync_sub_and_fetch(&dev->refs[index], 1))) {
+		return;
+	}
+	return_buffer(dev, index);
+}
+
+static int init_subscriber(video_dev_t *dev, subscriber_t *sub, uint32_t ring_size) {
+	int result;
+
+	if (0 == ring_size) {
+		ring_size = (1 < dev->buffer_count) ? dev->buffer_count - 1 : 1;
+	}
+
+	destroy_subscriber(sub);
+
+	result = uvcc_ring_init(&sub->frames, ring_size, sizeof(uvcc_frame_t));
+	if (NOERROR != result) {
+		LOGE("Insufficient memory for frame ring.");
+		return result;
+	}
+	sem_init(&sub->frames_sem, 0, 0);
+	sem_init(&sub->space_sem, 0, uvcc_ring_capacity(&sub->frames));
+	sub->dev       = dev;
+	sub->has_sync  = 1;
+	sub->delivered = 0;
+	sub->dropped   = 0;
+
+	return NOERROR;
+}
+
+static void destroy_subscriber(subscriber_t *sub) {
+	uvcc_ring_destroy(&sub->frames);
+	if (sub->has_sync) {
+		sem_destroy(&sub->frames_sem);
+		sem_destroy(&sub->space_sem);
+		sub->has_sync = 0;
+	}
+}
+
+static void drain_subscriber(subscriber_t *sub) {
+	uvcc_frame_t frame;
+
+	if (NULL == sub->frames.seqs) {
+		return;
+	}
+	// frames which were never taken by the subscriber go back to the driver.
+	while (uvcc_ring_pop(&sub->frames, &frame)) {
+		unref_buffer(sub->dev, frame.index);
+	}
+	// wake up the subscriber waiting for a frame.
+	sem_post(&sub->frames_sem);
+}
+
+static int take_frame(subscriber_t *sub, uvcc_frame_t *frame, int timeout_ms) {
+	video_dev_t *dev = sub->dev;
+	uint64_t const begin = clock_us(CLOCK_MONOTONIC);
+	int result;
+	int n;
+
+	for (; ; ) {
+		n = wait_frames_sem(&sub->frames_sem, timeout_ms, begin);
+
+		if (__sync_bool_compare_and_swap(&dev->cancel_pending, 1, 0)) {
+			result = CAPTURE_CANCELLED;
+			break;
+		}
+		if (0 != n) {
+			result = CAPTURE_TIMEOUT;
+			break;
+		}
+		if (uvcc_ring_pop(&sub->frames, frame)) {
+			if (UVCC_OVERFLOW_BLOCK == dev->overflow_policy) {
+				sem_post(&sub->space_sem);
+			}
+			result = NOERROR;
+			break;
+		}
+		if (!dev->is_thread_running) {
+			return (NOERROR != dev->thread_result) ? dev->thread_result : INVALID_STATUS;
+		}
 	}
 
+	record_wait(dev, result, begin);
+
 	return result;
 }
 
+/*
+ * sem_timedwait() takes an absolute CLOCK_REALTIME deadline, so the time
+ * left is worked out again from CLOCK_MONOTONIC after every wake-up and a
+ * clock step neither stretches nor cuts the timeout.
+ */
+static int wait_frames_sem(sem_t *sem, int timeout_ms, uint64_t begin_us) {
+	uint64_t const timeout_us = (uint64_t)timeout_ms * 1000;
+	uint64_t elapsed;
+	uint64_t deadline_us;
+	struct timespec deadline;
+	int n;
+
+	if (0 > timeout_ms) {
+		while ((0 != (n = sem_wait(sem))) && (EINTR == errno)) {
+			// interrupted by signal.
+		}
+		return n;
+	}
+
+	for (; ; ) {
+		elapsed = clock_us(CLOCK_MONOTONIC) - begin_us;
+		if (elapsed >= timeout_us) {
+			// out of time, but a frame which is already there is taken.
+			return sem_trywait(sem);
+		}
+		deadline_us      = clock_us(CLOCK_REALTIME) + (timeout_us - elapsed);
+		deadline.tv_sec  = deadline_us / 1000000;
+		deadline.tv_nsec = (deadline_us % 1000000) * 1000;
+		n = sem_timedwait(sem, &deadline);
+		if ((0 == n) || ((EINTR != errno) && (ETIMEDOUT != errno))) {
+			return n;
+		}
+	}
+}
+
+static void deliver_frame(subscriber_t *sub, uvcc_frame_t const *frame) {
+	video_dev_t *dev = sub->dev;
+	uvcc_frame_t oldest;
+
+	if (UVCC_OVERFLOW_BLOCK == dev->overflow_policy) {
+		while (0 != sem_wait(&sub->space_sem)) {
+			// interrupted by signal.
+		}
+		if (dev->is_thread_stopping) {
+			unref_buffer(dev, frame->index);
+			return;
+		}
+	}
+
+	while (!uvcc_ring_push(&sub->frames, frame)) {
+		__sync_fetch_and_add(&sub->dropped, 1);
+		if (UVCC_OVERFLOW_DROP_NEWEST == dev->overflow_policy) {
+			unref_buffer(dev, frame->index);
+			return;
+		}
+		// drop the oldest frame that the subscriber has not taken yet.
+		if (uvcc_ring_pop(&sub->frames, &oldest)) {
+			sem_trywait(&sub->frames_sem);
+			unref_buffer(dev, oldest.index);
+		}
+	}
+
+	__sync_fetch_and_add(&sub->delivered, 1);
+	sem_post(&sub->frames_sem);
+}
+
+static void publish_frame(video_dev_t *dev, uvcc_frame_t const *frame) {
+	uint32_t i;
+
+	if (!dev->is_broadcast) {
+		deliver_frame(&dev->default_subscriber, frame);
+		return;
+	}
+
+	// every subscriber holds a reference until it releases the frame.
+	dev->refs[frame->index] = dev->subscriber_count;
+	__sync_synchronize();
+
+	for (i = 0; i < MAX_SUBSCRIBERS; ++i) {
+		if (dev->subscribers[i].is_active) {
+			deliver_frame(&dev->subscribers[i], frame);
+		}
+	}
+}
+
+static subscriber_t *get_subscriber(video_dev_t *dev, uint32_t i) {
+	// slot MAX_SUBSCRIBERS is the default subscriber.
+	return (i < MAX_SUBSCRIBERS) ? &dev->subscribers[i] : &dev->default_subscriber;
+}
+
+static void *capture_thread_main(void *arg) {
+	video_dev_t *dev = (video_dev_t*)arg;
+	uvcc_frame_t frame;
+	struct pollfd fds[2];
+	uint64_t value;
+	int nfds;
+	int n;
+
+	assert(NULL != dev);
+
+	while (!dev->is_thread_stopping) {
+		drain_returns(dev);
+
+		fds[0].fd      = dev->thread_wake_fd;
+		fds[0].events  = POLLIN;
+		fds[0].revents = 0;
+		fds[1].fd      = dev->fd;
+		fds[1].events  = POLLIN;
+		fds[1].revents = 0;
+
+		// without queued buffers only a release or stop request can wake us up.
+		nfds = (0 < count_buffers(dev, BUFFER_STATE_QUEUED)) ? 2 : 1;
+
+		n = poll(fds, nfds, -1);
+		if (n < 0) {
+			if (EINTR == errno) {
+				continue;
+			}
+			LOGE("Failed to wait for capturable frame (%s).", strerror(errno));
+			dev->thread_result = IO_ERROR;
+			break;
+		}
+
+		if (0 != (POLLIN & fds[0].revents)) {
+			read(dev->thread_wake_fd, &value, sizeof(value));
+		}
+		if ((2 > nfds) || (0 == fds[1].revents)) {
+			continue;
+		}
+
+		dev->thread_result = dequeue_frame(dev, &frame);
+		if (NOERROR != dev->thread_result) {
+			break;
+		}
+
+		publish_frame(dev, &frame);
+	}
+
+	dev->is_thread_running = 0;
+
+	// wake up the subscribers waiting for a frame.
+	for (n = 0; n <= MAX_SUBSCRIBERS; ++n) {
+		if (get_subscriber(dev, n)->has_sync) {
+			sem_post(&get_subscriber(dev, n)->frames_sem);
+		}
+	}
+
+	return NULL;
+}
+
+static uint32_t count_buffers(video_dev_t const *dev, int state) {
+	uint32_t i, n = 0;
+	for (i = 0; i < dev->buffer_count; ++i) {
+		if (state == dev->buffers[i].state) {
+			++n;
+		}
+	}
+	return n;
+}
+
+static void adapt_buffers(video_dev_t *dev, uint32_t gap) {
+	uint32_t queued;
+	uint32_t active;
+
+	if (0 == dev->adaptive_max) {
+		return;
+	}
+
+	queued = count_buffers(dev, BUFFER_STATE_QUEUED);
+	active = dev->buffer_count - count_buffers(dev, BUFFER_STATE_PARKED) - count_buffers(dev, BUFFER_STATE_REMOVED);
+
+	if ((0 != gap) || (queued <= 1)) {
+		// the driver dropped frames or is about to run dry.
+		dev->idle_frames    = 0;
+		dev->shrink_pending = 0;
+		if (active < dev->adaptive_max) {
+			grow_buffers(dev);
+		}
+		return;
+	}
+
+	if ((queued + 1 < active) || (active <= dev->adaptive_min)) {
+		dev->idle_frames = 0;
+		return;
+	}
+
+	if (++dev->idle_frames >= ADAPTIVE_IDLE_FRAMES) {
+		// drop a buffer out of the ring the next time one is released.
+		dev->idle_frames    = 0;
+		dev->shrink_pending = 1;
+	}
+}
+
+static int grow_buffers(video_dev_t *dev) {
+	uint32_t i;
+	int result;
+
+	// re-activate a parked buffer before asking the driver for more memory.
+	for (i = 0; i < dev->buffer_count; ++i) {
+		if (BUFFER_STATE_PARKED == dev->buffers[i].state) {
+			LOGI("Adaptive buffering: resume buffer (index=%u).", i);
+			return queue_buffer(dev, i);
+		}
+	}
+	if (!dev->can_create_bufs) {
+		return IO_METHOD_NOT_SUPPORTED;
+	}
+
+#ifdef VIDIOC_CREATE_BUFS
+	{
+		struct v4l2_create_buffers create;
+		video_buf_t *buf_ptr;
+		uint32_t count;
+
+		memset(&create, 0, sizeof(create));
+		create.count  = 1;
+		create.memory = dev->memory;
+		create.format = dev->format;
+
+		if (0 > device_ioctl(dev, VIDIOC_CREATE_BUFS, &create)) {
+			if ((EINVAL == errno) || (ENOTTY == errno)) {
+				// asking again on every frame would only fail again.
+				LOGW("VIDIOC_CREATE_BUFS is not supported, adaptive buffering will not grow the ring.");
+				dev->can_create_bufs = 0;
+				return IO_METHOD_NOT_SUPPORTED;
+			}
+			LOGW("Failed to create additional buffer (%s).", strerror(errno));
+			return INSUFFICIENT_MEMORY;
+		}
+		if (0 == create.count) {
+			LOGW("Failed to create additional buffer (no buffer created).");
+			return INSUFFICIENT_MEMORY;
+		}
+
+		count = create.index + create.count;
+		if (count > dev->buffer_count) {
+			buf_ptr = realloc(dev->buffers, sizeof(video_buf_t) * count);
+			if (NULL == buf_ptr) {
+				LOGE("Insufficient memory in application.");
+				return INSUFFICIENT_MEMORY;
+			}
+			for (i = dev->buffer_count; i < count; ++i) {
+				buf_ptr[i].size      = 0;
+				buf_ptr[i].addr      = MAP_FAILED;
+				buf_ptr[i].state     = BUFFER_STATE_REMOVED;
+				buf_ptr[i].dmabuf_fd = -1;
+			}
+			dev->buffers      = buf_ptr;
+			dev->buffer_count = count;
+		}
+
+		for (i = create.index; i < count; ++i) {
+			result = map_buffer(dev, i, &dev->buffers[i]);
+			if (NOERROR != result) {
+				return result;
+			}
+			dev->buffers[i].state = BUFFER_STATE_IDLE;
+			if (dev->is_dmabuf_exported) {
+				result = export_buffer(dev, i);
+				if (NOERROR != result) {
+					return result;
+				}
+			}
+			LOGI("Adaptive buffering: add buffer (index=%u).", i);
+			result = queue_buffer(dev, i);
+			if (NOERROR != result) {
+				return result;
+			}
+		}
+		return NOERROR;
+	}
+#else
+	(void)result;
+	dev->can_create_bufs = 0;
+	return IO_METHOD_NOT_SUPPORTED;
+#endif
+}
+
+static void shrink_buffers(video_dev_t *dev, uint32_t index) {
+	video_buf_t *vbuf = &dev->buffers[index];
+
+	dev->shrink_pending = 0;
+	vbuf->state = BUFFER_STATE_PARKED;
+	LOGI("Adaptive buffering: park buffer (index=%u).", index);
+
+#ifdef VIDIOC_REMOVE_BUFS
+	{
+		struct v4l2_remove_buffers remove;
+
+		// give the memory back when the driver allows freeing single buffers.
+		memset(&remove, 0, sizeof(remove));
+		remove.index = index;
+		remove.count = 1;
+		remove.type  = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		unmap_buffer(dev, vbuf);
+		unexport_buffer(vbuf);
+		if (0 == device_ioctl(dev, VIDIOC_REMOVE_BUFS, &remove)) {
+			vbuf->addr  = MAP_FAILED;
+			vbuf->size  = 0;
+			vbuf->state = BUFFER_STATE_REMOVED;
+		} else if (NOERROR != map_buffer(dev, index, vbuf)) {
+			vbuf->state = BUFFER_STATE_REMOVED;
+		} else if (dev->is_dmabuf_exported) {
+			export_buffer(dev, index);
+		}
+	}
+#endif
+}
+
 static void print_capability(struct v4l2_capability const *caps) {
 	assert(NULL != caps);
 
@@ -175,35 +916,387 @@ static uint32_t from_v4l2_pixel_format(uint32_t format) {
 	return -1;
 }
 
-static int init_buffer(video_dev_t *dev) {
-	struct v4l2_requestbuffers req;
-	struct v4l2_buffer buf;
-	uint32_t i, count;
-	video_buf_t *buf_ptr;
-	int result = NOERROR;
+/* Planes of the negotiated format laid out as V4L2 does, chroma strides following the luma one. */
+static void build_frame_layout(video_dev_t *dev) {
+	struct v4l2_pix_format const *pix = &dev->format.fmt.pix;
+	uvcc_frame_layout_t *layout = &dev->layout;
+	uvcc_plane_layout_t *plane;
+	uint32_t bytes_per_pixel;
+	uint32_t xshift = 0, yshift = 0, chroma_planes = 0;
+	uint32_t offset;
+	uint32_t i;
 
-	dev->buffers = NULL;
+	switch (pix->pixelformat) {
+	case V4L2_PIX_FMT_RGB565:
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_UYVY:
+		bytes_per_pixel = 2;
+		break;
+	case V4L2_PIX_FMT_RGB32:
+	case V4L2_PIX_FMT_BGR32:
+		bytes_per_pixel = 4;
+		break;
+	default:
+		bytes_per_pixel = 1;
+		break;
+	}
+	switch (pix->pixelformat) {
+	case V4L2_PIX_FMT_YUV420:
+		xshift        = 1;
+		yshift        = 1;
+		chroma_planes = 2;
+		break;
+	case V4L2_PIX_FMT_YUV422P:
+		xshift        = 1;
+		chroma_planes = 2;
+		break;
+	case V4L2_PIX_FMT_YUV410:
+		xshift        = 2;
+		yshift        = 2;
+		chroma_planes = 2;
+		break;
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV21:
+		xshift        = 1;
+		yshift        = 1;
+		chroma_planes = 1;
+		break;
+	default:
+		break;
+	}
+
+	memset(layout, 0, sizeof(*layout));
+	layout->pixel_format = from_v4l2_pixel_format(pix->pixelformat);
+	layout->width        = pix->width;
+	layout->height       = pix->height;
+	layout->size         = pix->sizeimage;
+	layout->plane_count  = 1 + chroma_planes;
+
+	plane = &layout->planes[0];
+	plane->stride    = (0 != pix->bytesperline) ? pix->bytesperline : pix->width * bytes_per_pixel;
+	plane->row_bytes = pix->width * bytes_per_pixel;
+	plane->height    = pix->height;
+	offset = plane->stride * plane->height;
+	for (i = 1; i < layout->plane_count; ++i) {
+		plane = &layout->planes[i];
+		plane->offset    = offset;
+		plane->row_bytes = (pix->width + (1u << xshift) - 1) >> xshift;
+		plane->stride    = layout->planes[0].stride >> xshift;
+		if (1 == chroma_planes) {
+			// both chroma channels interleaved, as wide as the luma plane.
+			plane->row_bytes *= 2;
+			plane->stride     = layout->planes[0].stride;
+		}
+		plane->height = (pix->height + (1u << yshift) - 1) >> yshift;
+		plane->xshift = (uint8_t)xshift;
+		plane->yshift = (uint8_t)yshift;
+		offset += plane->stride * plane->height;
+	}
+
+	layout->alignment = layout_alignment(layout);
+}
+
+static uint32_t layout_alignment(uvcc_frame_layout_t const *layout) {
+	uint32_t alignment = 4096;
+	uint32_t i;
+
+	for (i = 0; i < layout->plane_count; ++i) {
+		while ((1 < alignment) && (0 != ((layout->planes[i].offset | layout->planes[i].stride) & (alignment - 1)))) {
+			alignment >>= 1;
+		}
+	}
+	return alignment;
+}
+
+/* Bytes per sample of a plane: 2 for YUYV, 4 for RGB32, 2 for interleaved chroma and so on. */
+static uint32_t plane_sample_bytes(uvcc_frame_layout_t const *layout, uint32_t plane) {
+	uvcc_plane_layout_t const *p = &layout->planes[plane];
+	uint32_t const samples = (layout->width + (1u << p->xshift) - 1) >> p->xshift;
+	return (0 < samples) ? p->row_bytes / samples : 0;
+}
+
+/* Subsampled columns or rows touched by [begin, begin + size). */
+static uint32_t window_samples(uint32_t begin, uint32_t size, uint32_t shift) {
+	return ((begin + size + (1u << shift) - 1) >> shift) - (begin >> shift);
+}
+
+/* Widen a window to whole macropixels and chroma samples. */
+static int align_window(uvcc_frame_layout_t const *layout, uvcc_rect_t const *window, uvcc_rect_t *aligned) {
+	uint32_t xalign = 1, yalign = 1;
+	uint32_t right, bottom;
+	uint32_t i;
+
+	if ((0 == window->width) || (0 == window->height) ||
+		(window->left >= layout->width) || (window->width > layout->width - window->left) ||
+		(window->top >= layout->height) || (window->height > layout->height - window->top)) {
+		return INVALID_ARGUMENTS;
+	}
+
+	for (i = 0; i < layout->plane_count; ++i) {
+		if ((1u << layout->planes[i].xshift) > xalign) {
+			xalign = 1u << layout->planes[i].xshift;
+		}
+		if ((1u << layout->planes[i].yshift) > yalign) {
+			yalign = 1u << layout->planes[i].yshift;
+		}
+	}
+	if (((UVCC_PIX_FMT_YUYV == layout->pixel_format) || (UVCC_PIX_FMT_UYVY == layout->pixel_format)) && (xalign < 2)) {
+		xalign = 2;
+	}
+
+	right  = (window->left + window->width + xalign - 1) & ~(xalign - 1);
+	bottom = (window->top + window->height + yalign - 1) & ~(yalign - 1);
+	aligned->left   = window->left & ~(xalign - 1);
+	aligned->top    = window->top & ~(yalign - 1);
+	aligned->width  = ((right < layout->width) ? right : layout->width) - aligned->left;
+	aligned->height = ((bottom < layout->height) ? bottom : layout->height) - aligned->top;
+
+	return NOERROR;
+}
+
+/* Planes of a window copied out of a frame, packed one after the other. */
+static void build_window_layout(uvcc_frame_layout_t const *layout, uvcc_rect_t const *window, uvcc_frame_layout_t *packed) {
+	uvcc_plane_layout_t const *src;
+	uvcc_plane_layout_t *dst;
+	uint32_t offset = 0;
+	uint32_t i;
+
+	memset(packed, 0, sizeof(*packed));
+	packed->pixel_format = layout->pixel_format;
+	packed->width        = window->width;
+	packed->height       = window->height;
+	packed->plane_count  = layout->plane_count;
+	for (i = 0; i < layout->plane_count; ++i) {
+		src = &layout->planes[i];
+		dst = &packed->planes[i];
+		dst->offset    = offset;
+		dst->row_bytes = window_samples(window->left, window->width, src->xshift) * plane_sample_bytes(layout, i);
+		dst->stride    = dst->row_bytes;
+		dst->height    = window_samples(window->top, window->height, src->yshift);
+		dst->xshift    = src->xshift;
+		dst->yshift    = src->yshift;
+		offset += dst->stride * dst->height;
+	}
+	packed->size      = offset;
+	packed->alignment = layout_alignment(packed);
+}
+
+/* Let the driver crop to the window, unless it would pick another rectangle. */
+static int set_device_window(video_dev_t *dev, uvcc_rect_t const *window) {
+#ifdef VIDIOC_S_SELECTION
+	struct v4l2_selection sel;
+
+	memset(&sel, 0, sizeof(sel));
+	sel.type     = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	sel.target   = V4L2_SEL_TGT_CROP;
+	sel.r.left   = (int32_t)window->left;
+	sel.r.top    = (int32_t)window->top;
+	sel.r.width  = window->width;
+	sel.r.height = window->height;
+	if (0 == device_ioctl(dev, VIDIOC_S_SELECTION, &sel)) {
+		dev->crop.c = sel.r;
+	} else
+#endif
+	{
+		memset(&dev->crop, 0, sizeof(dev->crop));
+		dev->crop.type     = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		dev->crop.c.left   = (int32_t)window->left;
+		dev->crop.c.top    = (int32_t)window->top;
+		dev->crop.c.width  = window->width;
+		dev->crop.c.height = window->height;
+		if (0 > device_ioctl(dev, VIDIOC_S_CROP, &dev->crop)) {
+			return VIDEO_DEVICE_CROPPING_FAILED;
+		}
+		// S_CROP may adjust the rectangle without telling.
+		if (0 > device_ioctl(dev, VIDIOC_G_CROP, &dev->crop)) {
+			return VIDEO_DEVICE_CROPPING_FAILED;
+		}
+	}
+
+	if (((uint32_t)dev->crop.c.left != window->left) || ((uint32_t)dev->crop.c.top != window->top) ||
+		(dev->crop.c.width != window->width) || (dev->crop.c.height != window->height)) {
+		LOGW("Driver crops %ux%u at (%d, %d) instead of the window.", dev->crop.c.width, dev->crop.c.height, dev->crop.c.left, dev->crop.c.top);
+		return VIDEO_DEVICE_CROPPING_FAILED;
+	}
+
+	return NOERROR;
+}
+
+/* Frames built by callers may come without a layout, the device one is used then. */
+/* Frames without a layout are whole frames of the device; copied windows carry their own. */
+static int get_device_frame_planes(video_dev_t const *dev, uvcc_frame_t const *frame, uvcc_planes_t *planes, uvcc_frame_layout_t const **layout) {
+	uvcc_frame_t resolved;
+
+	if ((NULL == dev) || (NULL == frame)) {
+		return INVALID_ARGUMENTS;
+	}
+
+	resolved = *frame;
+	if (NULL == resolved.layout) {
+		resolved.layout = &dev->layout;
+	}
+	*layout = resolved.layout;
+	return uvcc_get_frame_planes(&resolved, planes);
+}
+
+static void setup_buffer(video_dev_t const *dev, uint32_t index, struct v4l2_buffer *buf) {
+	memset(buf, 0, sizeof(*buf));
+	buf->type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf->memory = dev->memory;
+	buf->index  = index;
+
+	if (V4L2_MEMORY_USERPTR == dev->memory) {
+		buf->m.userptr = (unsigned long)dev->buffers[index].addr;
+		buf->length    = dev->buffers[index].size;
+	}
+}
+
+static int alloc_user_buffer(video_dev_t *dev, video_buf_t *vbuf) {
+	size_t const page_size = (size_t)sysconf(_SC_PAGESIZE);
+	size_t length = dev->format.fmt.pix.sizeimage;
+
+	if (0 == length) {
+		LOGE("Image size is unknown, can not allocate user buffer.");
+		return INVALID_STATUS;
+	}
+
+#ifdef MAP_HUGETLB
+	if (0 != (UVCC_IO_FLAG_HUGEPAGE & dev->io_flags)) {
+		size_t const huge_length = (length + HUGE_PAGE_SIZE - 1) & ~((size_t)HUGE_PAGE_SIZE - 1);
+		vbuf->addr = mmap(NULL, huge_length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (MAP_FAILED != vbuf->addr) {
+			vbuf->size = huge_length;
+			return NOERROR;
+		}
+		LOGW("Huge pages are not available, fall back to normal pages (%s).", strerror(errno));
+	}
+#endif
+
+	length = (length + page_size - 1) & ~(page_size - 1);
+	vbuf->addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == vbuf->addr) {
+		LOGE("Failed to allocate user buffer (%s).", strerror(errno));
+		return INSUFFICIENT_MEMORY;
+	}
+	vbuf->size = length;
+
+	return NOERROR;
+}
+
+static int map_buffer(video_dev_t *dev, uint32_t index, video_buf_t *vbuf) {
+	struct v4l2_buffer buf;
+
+	vbuf->size = 0;
+	vbuf->addr = MAP_FAILED;
+
+	if (V4L2_MEMORY_USERPTR == dev->memory) {
+		return alloc_user_buffer(dev, vbuf);
+	}
+
+	memset(&buf, 0, sizeof(buf));
+	buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.index  = index;
+
+	if (0 > device_ioctl(dev, VIDIOC_QUERYBUF, &buf)) {
+		if (EINVAL != errno) {
+			LOGE("Failed to query buffer (%s).", strerror(errno));
+		}
+		return VIDEO_DEVICE_QUERY_BUFFER_FAILED;
+	}
+
+	vbuf->addr = dev->backend->mmap(dev->backend_context, dev->fd, buf.length, PROT_READ, MAP_SHARED, buf.m.offset);
+
+	if (MAP_FAILED == vbuf->addr) {
+		LOGE("Failed to map the video memory (%s).", strerror(errno));
+		return MEMORY_MAPPING_FAILED;
+	}
+	vbuf->size = buf.length;
+
+	return NOERROR;
+}
+
+static void unmap_buffer(video_dev_t *dev, video_buf_t *vbuf) {
+	if (MAP_FAILED == vbuf->addr) {
+		return;
+	}
+	// user pointer buffers belong to the library, mapped ones to the backend.
+	if (V4L2_MEMORY_USERPTR == dev->memory) {
+		munmap(vbuf->addr, vbuf->size);
+	} else {
+		dev->backend->munmap(dev->backend_context, vbuf->addr, vbuf->size);
+	}
+}
+
+static int device_ioctl(video_dev_t *dev, unsigned long request, void *arg) {
+	return dev->backend->ioctl(dev->backend_context, dev->fd, request, arg);
+}
+
+static int export_buffer(video_dev_t *dev, uint32_t index) {
+#ifdef VIDIOC_EXPBUF
+	struct v4l2_exportbuffer expbuf;
+
+	if (0 <= dev->buffers[index].dmabuf_fd) {
+		return NOERROR;
+	}
+
+	memset(&expbuf, 0, sizeof(expbuf));
+	expbuf.type  = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	expbuf.index = index;
+	expbuf.flags = O_RDONLY | O_CLOEXEC;
+
+	if (0 > device_ioctl(dev, VIDIOC_EXPBUF, &expbuf)) {
+		LOGE("Failed to export buffer as DMABUF (%s, index=%u).", strerror(errno), index);
+		return (EINVAL == errno || ENOTTY == errno) ? IO_METHOD_NOT_SUPPORTED : IO_ERROR;
+	}
+
+	dev->buffers[index].dmabuf_fd = expbuf.fd;
+
+	return NOERROR;
+#else
+	LOGE("DMABUF export is not supported by this build.");
+	return IO_METHOD_NOT_SUPPORTED;
+#endif
+}
+
+static void unexport_buffer(video_buf_t *vbuf) {
+	if (0 <= vbuf->dmabuf_fd) {
+		close(vbuf->dmabuf_fd);
+		vbuf->dmabuf_fd = -1;
+	}
+}
+
+static int init_buffer(video_dev_t *dev, uint32_t count) {
+	struct v4l2_requestbuffers req;
+	uint32_t i;
+	video_buf_t *buf_ptr;
+	int result = NOERROR;
+
+	dev->buffers = NULL;
 	dev->buffer_count = 0;
 
 	memset(&req, 0, sizeof(req));
-	req.count = 4;
+	req.count = count;
 	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	req.memory = V4L2_MEMORY_MMAP;
+	req.memory = dev->memory;
 
-	if (0 > ioctl(dev->fd, VIDIOC_REQBUFS, &req)) {
+	if (0 > device_ioctl(dev, VIDIOC_REQBUFS, &req)) {
 		if (EBUSY == errno) {
 			LOGE("Buffer is already in progress.");
 			return VIDEO_DEVICE_BUSY;
 		}
 		if (EINVAL == errno) {
-			LOGE("Memory mapping is not supported.");
+			LOGE("%s is not supported.", (V4L2_MEMORY_USERPTR == dev->memory) ? "User pointer I/O" : "Memory mapping");
 			return IO_METHOD_NOT_SUPPORTED;
 		}
 	}
 
+	if (req.count != count) {
+		LOGW("Video device driver adjusted buffer count (%u -> %u).", count, req.count);
+	}
 	count = req.count;
 
-	if (count < 2) {
+	if (count < MIN_BUFFER_COUNT) {
 		LOGE("Insufficient memory in video device driver.");
 		return INSUFFICIENT_MEMORY;
 	}
@@ -215,30 +1308,19 @@ static int init_buffer(video_dev_t *dev) {
 	}
 
 	for (i = 0; i < count; ++i) {
-		memset(&buf, 0, sizeof(buf));
-		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		buf.type = V4L2_MEMORY_MMAP;
-		buf.index = i;
-
-		buf_ptr[i].size = 0;
-		buf_ptr[i].addr = MAP_FAILED;
+		buf_ptr[i].size      = 0;
+		buf_ptr[i].addr      = MAP_FAILED;
+		buf_ptr[i].state     = BUFFER_STATE_IDLE;
+		buf_ptr[i].dmabuf_fd = -1;
+	}
 
-		if (0 > ioctl(dev->fd, VIDIOC_QUERYBUF, &buf)) {
-			if (EINVAL == errno) {
-				break;
-			} else {
-				LOGE("Failed to query buffer (%s).", strerror(errno));
-				result = VIDEO_DEVICE_QUERY_BUFFER_FAILED;
-				break;
+	for (i = 0; i < count; ++i) {
+		result = map_buffer(dev, i, &buf_ptr[i]);
+		if (NOERROR != result) {
+			if ((VIDEO_DEVICE_QUERY_BUFFER_FAILED == result) && (EINVAL == errno)) {
+				// driver allocated less buffers than reported.
+				result = NOERROR;
 			}
-		}
-
-		buf_ptr[i].size = buf.length;
-		buf_ptr[i].addr = mmap(NULL, buf.length, PROT_READ, MAP_SHARED, dev->fd, buf.m.offset);
-
-		if (MAP_FAILED == buf_ptr[i].addr) {
-			LOGE("Failed to map the video memory (%s).", strerror(errno));
-			result = MEMORY_MAPPING_FAILED;
 			break;
 		}
 	}
@@ -248,7 +1330,7 @@ static int init_buffer(video_dev_t *dev) {
 			if (MAP_FAILED == buf_ptr[i].addr) {
 				break;
 			}
-			munmap(buf_ptr[i].addr, buf_ptr[i].size);
+			unmap_buffer(dev, &buf_ptr[i]);
 			buf_ptr[i].size = 0;
 			buf_ptr[i].addr = NULL;
 		}
@@ -263,8 +1345,10 @@ static int init_buffer(video_dev_t *dev) {
 
 int uvcc_open_video_device(uvcc_handle_t *handle, char const * const path) {
 	video_dev_t *dev = NULL;
+	char const *args;
 	uint32_t i;
 	struct v4l2_fmtdesc desc;
+	int result;
 
 	if (NULL == handle) {
 		LOGE("'handle' parameter can not set to NULL.");
@@ -288,45 +1372,63 @@ int uvcc_open_video_device(uvcc_handle_t *handle, char const * const path) {
 	dev->buffers = NULL;
 	dev->buffer_count = 0;
 	dev->is_capture_started = 0;
+	dev->memory = V4L2_MEMORY_MMAP;
+	dev->can_create_bufs = 1;
+	uvcc_reset_stats(dev);
+
+	dev->wake_fd        = eventfd(0, 0);
+	dev->thread_wake_fd = eventfd(0, 0);
+	if ((0 > dev->wake_fd) || (0 > dev->thread_wake_fd)) {
+		LOGE("Failed to create eventfd (%s).", strerror(errno));
+		if (0 <= dev->wake_fd) {
+			close(dev->wake_fd);
+		}
+		if (0 <= dev->thread_wake_fd) {
+			close(dev->thread_wake_fd);
+		}
+		free(dev);
+		return INSUFFICIENT_MEMORY;
+	}
 
-	dev->fd = open(path, O_RDONLY);
+	dev->backend = uvcc_find_backend(path, &args);
+	dev->fd = dev->backend->open(args, &dev->backend_context);
 	if (dev->fd < 0) {
 		LOGE("Can't open video devicie (%s).", path);
 		if (EBUSY == errno) {
 			LOGE("Vide device is busy.");
-			return VIDEO_DEVICE_BUSY;
-		}
-		if (EPERM == errno) {
+			result = VIDEO_DEVICE_BUSY;
+		} else if (EPERM == errno) {
 			LOGE("Operation not permitted.");
-			return NOT_PERMITTED;
+			result = NOT_PERMITTED;
+		} else {
+			LOGE("Unknown error (%s).", strerror(errno));
+			result = VIDEO_DEVICE_OPEN_FAILED;
 		}
-		LOGE("Unknown error (%s).", strerror(errno));
-		return VIDEO_DEVICE_OPEN_FAILED;
+		goto failed;
 	}
 
 	// get device capabilities
-	if (0 > ioctl(dev->fd, VIDIOC_QUERYCAP, &dev->caps)) {
+	if (0 > device_ioctl(dev, VIDIOC_QUERYCAP, &dev->caps)) {
 		LOGE("Video device capability can not get (%s).", strerror(errno));
-		close(dev->fd);
-		dev->fd = -1;
-		return VIDEO_DEVICE_NOCAPS;
+		result = VIDEO_DEVICE_NOCAPS;
+		goto failed;
 	}
 
 	print_capability(&dev->caps);
 
 	if (0 == (dev->caps.capabilities & V4L2_CAP_VIDEO_CAPTURE)) {
 		LOGE("Capture is not supported.");
-		close(dev->fd);
-		dev->fd = -1;
-		return VIDEO_DEVICE_CAPTURE_NOT_SUPPORTED;
+		result = VIDEO_DEVICE_CAPTURE_NOT_SUPPORTED;
+		goto failed;
 	}
 
 	// get cropping capabilities
 	memset(&dev->cropcaps, 0, sizeof(dev->cropcaps));
 	dev->cropcaps.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	if (0 > ioctl(dev->fd, VIDIOC_CROPCAP, &dev->cropcaps)) {
+	if (0 > device_ioctl(dev, VIDIOC_CROPCAP, &dev->cropcaps)) {
 		LOGE("Video device crop capability can not get (%s).", strerror(errno));
-		return VIDEO_DEVICE_NOCROPCAPS;
+		result = VIDEO_DEVICE_NOCROPCAPS;
+		goto failed;
 	}
 
 	// enumerate pixel formats
@@ -334,12 +1436,13 @@ int uvcc_open_video_device(uvcc_handle_t *handle, char const * const path) {
 		memset(&desc, 0, sizeof(desc));
 		desc.index = i;
 		desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		if (0 > ioctl(dev->fd, VIDIOC_ENUM_FMT, &desc)) {
+		if (0 > device_ioctl(dev, VIDIOC_ENUM_FMT, &desc)) {
 			if (EINVAL == errno) {
 				break;
 			} else {
 				LOGE("Failed to enumerate pixel formats (%s).", strerror(errno));
-				return VIDEO_DEVICE_ENUM_FORMAT_FAILED;
+				result = VIDEO_DEVICE_ENUM_FORMAT_FAILED;
+				goto failed;
 			}
 		}
 		print_format_desc(&desc);
@@ -348,6 +1451,16 @@ int uvcc_open_video_device(uvcc_handle_t *handle, char const * const path) {
 	*handle = dev;
 
 	return NOERROR;
+
+failed:
+	// nothing but the eventfds and the backend is set up yet.
+	if (0 <= dev->fd) {
+		dev->backend->close(dev->backend_context, dev->fd);
+	}
+	close(dev->wake_fd);
+	close(dev->thread_wake_fd);
+	free(dev);
+	return result;
 }
 
 void uvcc_close_video_device(uvcc_handle_t handle) {
@@ -362,169 +1475,501 @@ void uvcc_close_video_device(uvcc_handle_t handle) {
 		return;
 	}
 
+	uvcc_stop_capture_thread(handle);
+	uvcc_ring_destroy(&dev->returns);
+	for (i = 0; i <= MAX_SUBSCRIBERS; ++i) {
+		destroy_subscriber(get_subscriber(dev, i));
+		get_subscriber(dev, i)->is_active = 0;
+	}
+	dev->subscriber_count = 0;
+	free((void*)dev->refs);
+	dev->refs = NULL;
+	dev->refs_capacity = 0;
+	dev->has_thread = 0;
+
 	if (NULL != dev->buffers) {
 		for (i = 0; i < dev->buffer_count; ++i) {
-			if (MAP_FAILED == dev->buffers[i].addr) {
-				break;
-			}
-			munmap(dev->buffers[i].addr, dev->buffers[i].size);
+			unexport_buffer(&dev->buffers[i]);
+			unmap_buffer(dev, &dev->buffers[i]);
 		}
 		free(dev->buffers);
+		dev->buffers = NULL;
+		dev->buffer_count = 0;
 	}
 
 	int ret = -1;
 	do {
-		ret = close(dev->fd);
+		ret = dev->backend->close(dev->backend_context, dev->fd);
 	} while (ret < 0);
 	dev->fd = -1;
+
+	close(dev->wake_fd);
+	close(dev->thread_wake_fd);
+	dev->wake_fd = -1;
+	dev->thread_wake_fd = -1;
 }
 
-int uvcc_init_video_device(uvcc_handle_t handle, uint32_t width, uint32_t height, uint32_t pixel_format) {
-	struct v4l2_format fmt;
+int uvcc_init_video_device(uvcc_handle_t handle, uint32_t width, uint32_t height, uint32_t pixel_format, uint32_t buffer_count) {
 	video_dev_t *dev = (video_dev_t*)handle;
+	int ret = NOERROR;
 
 	assert(NULL != dev);
 
-	// set cropping area
-	memset(&dev->crop, 0, sizeof(dev->crop));
-	dev->crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	dev->crop.c = dev->cropcaps.defrect;
-	if (0 > ioctl(dev->fd, VIDIOC_S_CROP, &dev->crop)) {
-		if (EINVAL == errno) {
-			LOGW("Cropping is not supported.");
-		} else {
-			LOGE("Failed to set cropping area (%s).", strerror(errno));
-			return VIDEO_DEVICE_CROPPING_FAILED;
+	if (0 == buffer_count) {
+		buffer_count = DEF_BUFFER_COUNT;
+	}
+	if (buffer_count < MIN_BUFFER_COUNT) {
+		LOGE("At least %d buffers are required.", MIN_BUFFER_COUNT);
+		return INVALID_ARGUMENTS;
+	}
+
+	// the layout of the requested format tells how to align the window.
+	memset(&dev->format, 0, sizeof(dev->format));
+	dev->format.fmt.pix.width       = width;
+	dev->format.fmt.pix.height      = height;
+	dev->format.fmt.pix.pixelformat = to_v4l2_pixel_format(pixel_format);
+	build_frame_layout(dev);
+	dev->window_mode = UVCC_WINDOW_NONE;
+	if (dev->has_window && (NOERROR != align_window(&dev->layout, &dev->requested_window, &dev->window))) {
+		LOGE("Capture window is out of the frame.");
+		return INVALID_ARGUMENTS;
+	}
+
+	// set cropping area, the window itself if the driver crops it without scaling.
+	if (dev->has_window && (dev->cropcaps.defrect.width == width) && (dev->cropcaps.defrect.height == height) &&
+		(NOERROR == set_device_window(dev, &dev->window))) {
+		dev->window_mode = UVCC_WINDOW_DEVICE;
+		ret = set_format(dev, dev->window.width, dev->window.height, pixel_format);
+		if ((NOERROR != ret) || (dev->format.fmt.pix.width != dev->window.width) || (dev->format.fmt.pix.height != dev->window.height)) {
+			LOGW("Driver scales the cropped window, copying it instead.");
+			dev->window_mode = UVCC_WINDOW_NONE;
+		}
+	}
+	if (UVCC_WINDOW_DEVICE != dev->window_mode) {
+		memset(&dev->crop, 0, sizeof(dev->crop));
+		dev->crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		dev->crop.c = dev->cropcaps.defrect;
+		if (0 > device_ioctl(dev, VIDIOC_S_CROP, &dev->crop)) {
+			if (EINVAL == errno) {
+				LOGW("Cropping is not supported.");
+			} else {
+				LOGE("Failed to set cropping area (%s).", strerror(errno));
+				return VIDEO_DEVICE_CROPPING_FAILED;
+			}
 		}
+		ret = set_format(dev, width, height, pixel_format);
 	}
+	if (NOERROR != ret) {
+		return ret;
+	}
+	build_frame_layout(dev);
+
+	if (dev->has_window && (UVCC_WINDOW_DEVICE != dev->window_mode)) {
+		// the driver may have picked another frame size.
+		if (NOERROR != align_window(&dev->layout, &dev->requested_window, &dev->window)) {
+			LOGE("Capture window is out of the %ux%u frame.", dev->layout.width, dev->layout.height);
+			return INVALID_ARGUMENTS;
+		}
+		build_window_layout(&dev->layout, &dev->window, &dev->window_layout);
+		dev->window_mode = UVCC_WINDOW_COPY;
+	}
+
+	return init_buffer(dev, buffer_count);
+}
+
+static int set_format(video_dev_t *dev, uint32_t width, uint32_t height, uint32_t pixel_format) {
+	struct v4l2_format fmt;
 
-	// set format
 	memset(&dev->format, 0, sizeof(dev->format));
 	dev->format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	dev->format.fmt.pix.width  = width;
 	dev->format.fmt.pix.height = height;
 	dev->format.fmt.pix.pixelformat = to_v4l2_pixel_format(pixel_format);
 	dev->format.fmt.pix.field = V4L2_FIELD_INTERLACED;
-	if (0 > ioctl(dev->fd, VIDIOC_S_FMT, &dev->format)) {
+	if (0 > device_ioctl(dev, VIDIOC_S_FMT, &dev->format)) {
 		if (EBUSY == errno) {
 			LOGE("Video format can not be changed at this time.");
 			return VIDEO_DEVICE_BUSY;
 		}
 		if (EINVAL == errno) {
+			pixel_format_name_t name = { to_v4l2_pixel_format(pixel_format) };
+			pixel_format_name_t offer = { dev->format.fmt.pix.pixelformat };
 			LOGE("Invalid format argument are set.");
+			// a device may answer with the format it can deliver instead.
+			if ((name.u != offer.u) || (width != dev->format.fmt.pix.width) || (height != dev->format.fmt.pix.height)) {
+				LOGE("%ux%u %c%c%c%c was requested, the device offers %ux%u %c%c%c%c.",
+					width, height, name.name[0], name.name[1], name.name[2], name.name[3],
+					dev->format.fmt.pix.width, dev->format.fmt.pix.height,
+					offer.name[0], offer.name[1], offer.name[2], offer.name[3]);
+			}
 			return INVALID_FORMAT_ARGUMENTS;
 		}
 	}
 
 	memset(&fmt, 0, sizeof(fmt));
 	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	if (0 == ioctl(dev->fd, VIDIOC_G_FMT, &fmt)) {
+	if (0 == device_ioctl(dev, VIDIOC_G_FMT, &fmt)) {
 		print_pixel_format(&fmt.fmt.pix);
 		dev->format = fmt;
 	}
 
-	return init_buffer(dev);
+	return NOERROR;
 }
 
-int uvcc_start_capture(uvcc_handle_t handle) {
+int uvcc_set_io_method(uvcc_handle_t handle, uint32_t io_method, uint32_t flags) {
 	video_dev_t *dev = (video_dev_t*)handle;
-	struct v4l2_buffer buf;
-	uint32_t i;
-	uint32_t const count = (NULL == dev) ? 0 : dev->buffer_count;
-	int retry;
-	int result = NOERROR;
-	enum v4l2_buf_type type;
 
 	assert(NULL != dev);
 
-	if (dev->is_capture_started) {
-		return NOERROR;
+	if (NULL != dev->buffers) {
+		LOGE("I/O method can not be changed after initialization.");
+		return INVALID_STATUS;
 	}
 
-	for (i = 0; i < count; ++i) {
-		for (retry = 0; retry < 5; ++retry) {
-			memset(&buf, 0, sizeof(buf));
-			buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-			buf.memory = V4L2_MEMORY_MMAP;
-			buf.index  = i;
+	switch (io_method) {
+	case UVCC_IO_METHOD_MMAP:
+		dev->memory = V4L2_MEMORY_MMAP;
+		break;
+	case UVCC_IO_METHOD_USERPTR:
+		dev->memory = V4L2_MEMORY_USERPTR;
+		break;
+	default:
+		LOGE("I/O method (%u) is not supported.", io_method);
+		return IO_METHOD_NOT_SUPPORTED;
+	}
+	dev->io_flags = flags;
 
-			if (0 == ioctl(dev->fd, VIDIOC_QBUF, &buf)) {
-				break;
-			}
+	return NOERROR;
+}
 
-			switch (errno) {
-			case EINVAL:
-				LOGE("Non-blocking I/O has been selected and no buffer (index=%d).", i);
-				result = MEMORY_QUEUEING_FAILED;
-				break;
-			case EIO:
-				LOGE("Internal I/O error in video device.");
-				result = IO_ERROR;
-				break;
-			case ENOMEM:
-			case EAGAIN:
-				usleep(10000);
-				break;
-			default:
-				LOGE("Failed to queueing the buffer to start (%s, index=%d).", strerror(errno), i);
-				result = MEMORY_QUEUEING_FAILED;
-				break;
-			}
+int uvcc_export_buffers(uvcc_handle_t handle) {
+	video_dev_t *dev = (video_dev_t*)handle;
+	uint32_t i;
+	int result;
 
-			if (NOERROR != result) {
-				break;
-			}
-		}
+	assert(NULL != dev);
 
-		if (retry >= 5) {
-			LOGE("Retry failed.");
-			result = MEMORY_QUEUEING_FAILED;
-		}
+	if ((NULL == dev->buffers) || (0 == dev->buffer_count)) {
+		LOGE("Video buffers are not initialized.");
+		return INVALID_STATUS;
+	}
+	if (V4L2_MEMORY_MMAP != dev->memory) {
+		LOGE("Only memory mapped buffers can be exported.");
+		return IO_METHOD_NOT_SUPPORTED;
+	}
 
+	for (i = 0; i < dev->buffer_count; ++i) {
+		if (MAP_FAILED == dev->buffers[i].addr) {
+			continue;
+		}
+		result = export_buffer(dev, i);
 		if (NOERROR != result) {
-			break;
+			for (i = 0; i < dev->buffer_count; ++i) {
+				unexport_buffer(&dev->buffers[i]);
+			}
+			return result;
 		}
 	}
 
-	if (NOERROR != result) {
-		return result;
-	}
+	dev->is_dmabuf_exported = 1;
 
-	type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	return NOERROR;
+}
 
-	if (0 > ioctl(dev->fd, VIDIOC_STREAMON, &type)) {
-		LOGE("Failed to start streaming (%s).", strerror(errno));
-		result = VIDEO_DEVICE_STREAMING_FAILED;
+int uvcc_get_buffer_count(uvcc_handle_t handle) {
+	video_dev_t const *dev = (video_dev_t const*)handle;
+	if (NULL == dev) {
+		return -1;
 	}
+	return dev->buffer_count;
+}
 
-	if (NOERROR == result) {
-		dev->is_capture_started = 1;
+int uvcc_get_buffer_fd(uvcc_handle_t handle, uint32_t index) {
+	video_dev_t const *dev = (video_dev_t const*)handle;
+	if ((NULL == dev) || (index >= dev->buffer_count)) {
+		return -1;
 	}
-
-	return result;
+	return dev->buffers[index].dmabuf_fd;
 }
 
-void uvcc_stop_capture(uvcc_handle_t handle) {
-	enum v4l2_buf_type type;
-	video_dev_t const *dev = (video_dev_t const*)handle;
+int uvcc_set_capture_window(uvcc_handle_t handle, uvcc_rect_t const *window) {
+	video_dev_t *dev = (video_dev_t*)handle;
 
 	assert(NULL != dev);
 
+	if (dev->is_capture_started) {
+		LOGE("Capture window can not be changed while capturing.");
+		return INVALID_STATUS;
+	}
+	if (NULL == window) {
+		dev->has_window = 0;
+		return NOERROR;
+	}
+	if ((0 == window->width) || (0 == window->height)) {
+		return INVALID_ARGUMENTS;
+	}
+
+	dev->requested_window = *window;
+	dev->has_window       = 1;
+
+	return NOERROR;
+}
+
+uint32_t uvcc_get_capture_window(uvcc_handle_t handle, uvcc_rect_t *window) {
+	video_dev_t const *dev = (video_dev_t const*)handle;
+
+	if (NULL == dev) {
+		return UVCC_WINDOW_NONE;
+	}
+	if (NULL != window) {
+		if (UVCC_WINDOW_NONE != dev->window_mode) {
+			*window = dev->window;
+		} else {
+			window->left   = 0;
+			window->top    = 0;
+			window->width  = dev->layout.width;
+			window->height = dev->layout.height;
+		}
+	}
+	return dev->window_mode;
+}
+
+int uvcc_copy_window(uvcc_frame_t const *frame, uvcc_rect_t const *window, void *dst, uint32_t dst_size, uint32_t *size) {
+	uvcc_frame_layout_t packed;
+	uvcc_planes_t planes;
+	uvcc_rect_t aligned;
+	uint8_t const *s;
+	uint8_t *d;
+	uint32_t bytes, shift, y;
+	uint32_t i;
+	int ret;
+
+	if ((NULL == frame) || (NULL == frame->layout) || (NULL == window) || (NULL == dst)) {
+		return INVALID_ARGUMENTS;
+	}
+	ret = align_window(frame->layout, window, &aligned);
+	if (NOERROR != ret) {
+		return ret;
+	}
+	ret = uvcc_get_frame_planes(frame, &planes);
+	if (NOERROR != ret) {
+		return ret;
+	}
+	build_window_layout(frame->layout, &aligned, &packed);
+	if (dst_size < packed.size) {
+		return INVALID_ARGUMENTS;
+	}
+
+	for (i = 0; i < packed.plane_count; ++i) {
+		bytes = plane_sample_bytes(frame->layout, i);
+		shift = packed.planes[i].xshift;
+		s = (uint8_t const*)planes.data[i] + (aligned.top >> packed.planes[i].yshift) * planes.stride[i] + (aligned.left >> shift) * bytes;
+		d = (uint8_t*)dst + packed.planes[i].offset;
+		for (y = 0; y < packed.planes[i].height; ++y) {
+			memcpy(d, s, packed.planes[i].row_bytes);
+			s += planes.stride[i];
+			d += packed.planes[i].stride;
+		}
+	}
+
+	if (NULL != size) {
+		*size = packed.size;
+	}
+	return NOERROR;
+}
+
+int uvcc_set_adaptive_buffering(uvcc_handle_t handle, uint32_t min_count, uint32_t max_count) {
+	video_dev_t *dev = (video_dev_t*)handle;
+
+	assert(NULL != dev);
+
+	if ((0 != max_count) && ((min_count < MIN_BUFFER_COUNT) || (min_count > max_count))) {
+		LOGE("Invalid adaptive buffer range (%u - %u).", min_count, max_count);
+		return INVALID_ARGUMENTS;
+	}
+
+	dev->adaptive_min   = min_count;
+	dev->adaptive_max   = max_count;
+	dev->idle_frames    = 0;
+	dev->shrink_pending = 0;
+
+	return NOERROR;
+}
+
+int uvcc_start_capture(uvcc_handle_t handle) {
+	video_dev_t *dev = (video_dev_t*)handle;
+	struct v4l2_buffer buf;
+	uint32_t i;
+	uint32_t const count = (NULL == dev) ? 0 : dev->buffer_count;
+	int retry;
+	int result = NOERROR;
+	enum v4l2_buf_type type;
+
+	assert(NULL != dev);
+
+	if (dev->is_capture_started) {
+		return NOERROR;
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (BUFFER_STATE_IDLE != dev->buffers[i].state) {
+			// leased buffers are queued when the application releases them.
+			continue;
+		}
+		for (retry = 0; retry < 5; ++retry) {
+			setup_buffer(dev, i, &buf);
+
+			if (0 == device_ioctl(dev, VIDIOC_QBUF, &buf)) {
+				dev->buffers[i].state = BUFFER_STATE_QUEUED;
+				break;
+			}
+
+			switch (errno) {
+			case EINVAL:
+				LOGE("Non-blocking I/O has been selected and no buffer (index=%d).", i);
+				result = MEMORY_QUEUEING_FAILED;
+				break;
+			case EIO:
+				LOGE("Internal I/O error in video device.");
+				result = IO_ERROR;
+				break;
+			case ENOMEM:
+			case EAGAIN:
+				usleep(10000);
+				break;
+			default:
+				LOGE("Failed to queueing the buffer to start (%s, index=%d).", strerror(errno), i);
+				result = MEMORY_QUEUEING_FAILED;
+				break;
+			}
+
+			if (NOERROR != result) {
+				break;
+			}
+		}
+
+		if (retry >= 5) {
+			LOGE("Retry failed.");
+			result = MEMORY_QUEUEING_FAILED;
+		}
+
+		if (NOERROR != result) {
+			break;
+		}
+	}
+
+	if (NOERROR != result) {
+		return result;
+	}
+
 	type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	if (0 > ioctl(dev->fd, VIDIOC_STREAMOFF, &type)) {
+
+	if (0 > device_ioctl(dev, VIDIOC_STREAMON, &type)) {
+		LOGE("Failed to start streaming (%s).", strerror(errno));
+		result = VIDEO_DEVICE_STREAMING_FAILED;
+	}
+
+	if (NOERROR == result) {
+		dev->is_capture_started = 1;
+	}
+
+	return result;
+}
+
+void uvcc_stop_capture(uvcc_handle_t handle) {
+	enum v4l2_buf_type type;
+	video_dev_t *dev = (video_dev_t*)handle;
+	uint32_t i;
+
+	assert(NULL != dev);
+
+	uvcc_stop_capture_thread(handle);
+
+	type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (0 > device_ioctl(dev, VIDIOC_STREAMOFF, &type)) {
 		LOGW("Failed to stop streaming (%s).", strerror(errno));
 	}
+
+	// STREAMOFF returns every queued buffer to the application.
+	for (i = 0; i < dev->buffer_count; ++i) {
+		if (BUFFER_STATE_QUEUED == dev->buffers[i].state) {
+			dev->buffers[i].state = BUFFER_STATE_IDLE;
+		}
+	}
+	dev->is_capture_started = 0;
+	dev->has_sequence       = 0;
 }
 
-int uvcc_capture(uvcc_handle_t handle, uint8_t * const buf, size_t buf_size) {
+int uvcc_capture(uvcc_handle_t handle, uint8_t * const buf, size_t buf_size, uvcc_frame_t *info) {
+	return uvcc_capture_timeout(handle, buf, buf_size, info, -1);
+}
+
+int uvcc_capture_timeout(uvcc_handle_t handle, uint8_t * const buf, size_t buf_size, uvcc_frame_t *info, int timeout_ms) {
 	video_dev_t const *dev = (video_dev_t const*)handle;
+	uvcc_frame_t frame;
+	uint32_t size;
+	int copied = NOERROR;
+	int result;
+
+	assert(NULL != handle);
+	assert(NULL != buf);
+
+	result = uvcc_acquire_frame_timeout(handle, &frame, timeout_ms);
+	if (NOERROR != result) {
+		return result;
+	}
+
+	if (UVCC_WINDOW_COPY == dev->window_mode) {
+		// only the rows and columns of the window.
+		copied = uvcc_copy_window(&frame, &dev->window, buf, (buf_size < UINT32_MAX) ? (uint32_t)buf_size : UINT32_MAX, &size);
+	} else {
+		// copy only the payload that the driver filled.
+		size = buf_size < frame.size ? buf_size : frame.size;
+		memcpy(buf, frame.data, size);
+	}
+
+	result = uvcc_release_frame(handle, &frame);
+	if (NOERROR == result) {
+		result = copied;
+	}
+
+	if ((NOERROR == result) && (NULL != info)) {
+		*info = frame;
+		info->data = buf;
+		info->size = size;
+		if (UVCC_WINDOW_COPY == dev->window_mode) {
+			info->layout = &dev->window_layout;
+		}
+	}
+
+	return result;
+}
+
+int uvcc_acquire_frame(uvcc_handle_t handle, uvcc_frame_t *frame) {
+	return uvcc_acquire_frame_timeout(handle, frame, -1);
+}
+
+int uvcc_acquire_frame_timeout(uvcc_handle_t handle, uvcc_frame_t *frame, int timeout_ms) {
+	video_dev_t *dev = (video_dev_t*)handle;
+	uint64_t begin;
 	int result;
-	fd_set rfds;
-	struct timeval tv;
-	int n;
 
 	assert(NULL != dev);
 
+	if (NULL == frame) {
+		LOGE("'frame' parameter can not set to NULL.");
+		return INVALID_ARGUMENTS;
+	}
+
+	if (dev->has_thread && !dev->is_thread_stopping) {
+		if (dev->is_broadcast) {
+			LOGE("Frames are delivered to subscribers.");
+			return INVALID_STATUS;
+		}
+		// frames are dequeued by the capture thread.
+		return take_frame(&dev->default_subscriber, frame, timeout_ms);
+	}
+
 	if (!dev->is_capture_started) {
 		result = uvcc_start_capture(handle);
 		if (NOERROR != result) {
@@ -533,36 +1978,599 @@ int uvcc_capture(uvcc_handle_t handle, uint8_t * const buf, size_t buf_size) {
 	}
 
 	// capture!
-	for (; ; ) {
-		FD_ZERO(&rfds);
-		FD_SET(dev->fd, &rfds);
+	begin  = clock_us(CLOCK_MONOTONIC);
+	result = wait_frame(dev, timeout_ms);
+	record_wait(dev, result, begin);
+	if (NOERROR != result) {
+		return result;
+	}
 
-		tv.tv_sec = 0;
-		tv.tv_usec = 40000;
+	return dequeue_frame(dev, frame);
+}
 
-		n = select(dev->fd + 1, &rfds, NULL, NULL, &tv);
+void uvcc_cancel_capture(uvcc_handle_t handle) {
+	video_dev_t *dev = (video_dev_t*)handle;
+	uint32_t i;
 
-		if (n < 0) {
-			if (ETIMEDOUT == errno) {
-				continue;
+	assert(NULL != dev);
+
+	if (dev->has_thread && !dev->is_thread_stopping) {
+		dev->cancel_pending = 1;
+		__sync_synchronize();
+		for (i = 0; i <= MAX_SUBSCRIBERS; ++i) {
+			if (get_subscriber(dev, i)->has_sync) {
+				sem_post(&get_subscriber(dev, i)->frames_sem);
 			}
-			LOGE("Failed to wait for capturable frame (%s).", strerror(errno));
+		}
+		return;
+	}
+
+	wake_up(dev->wake_fd);
+}
+
+int uvcc_release_frame(uvcc_handle_t handle, uvcc_frame_t const *frame) {
+	video_dev_t *dev = (video_dev_t*)handle;
+	returned_buf_t ret;
+
+	assert(NULL != dev);
+
+	if (NULL == frame) {
+		LOGE("Invalid frame is specified to release.");
+		return INVALID_ARGUMENTS;
+	}
+
+	if (NULL != dev->refs) {
+		if (frame->index >= dev->refs_capacity) {
+			LOGE("Invalid frame is specified to release.");
+			return INVALID_ARGUMENTS;
+		}
+		if (0 != __sync_sub_and_fetch(&dev->refs[frame->index], 1)) {
+			// still shared with other subscribers.
+			return NOERROR;
+		}
+		if (dev->is_thread_running) {
+			// buffers are owned by the capture thread, let it queue the buffer.
+			ret.index       = frame->index;
+			ret.released_us = clock_us(CLOCK_MONOTONIC);
+			record_latency(dev, UVCC_STAT_HOLD, frame->dequeued, ret.released_us);
+			if (!uvcc_ring_push(&dev->returns, &ret)) {
+				LOGE("Too many frames are released (index=%u).", frame->index);
+				return INVALID_STATUS;
+			}
+			wake_up(dev->thread_wake_fd);
+			return NOERROR;
+		}
+	}
+
+	if (frame->index >= dev->buffer_count) {
+		LOGE("Invalid frame is specified to release.");
+		return INVALID_ARGUMENTS;
+	}
+	if (BUFFER_STATE_LEASED != dev->buffers[frame->index].state) {
+		LOGE("Frame is not leased (index=%u).", frame->index);
+		return INVALID_STATUS;
+	}
+
+	ret.released_us = clock_us(CLOCK_MONOTONIC);
+	record_latency(dev, UVCC_STAT_HOLD, frame->dequeued, ret.released_us);
+
+	return requeue_buffer(dev, frame->index, ret.released_us);
+}
+
+int uvcc_start_capture_thread(uvcc_handle_t handle, uint32_t ring_size, uint32_t overflow_policy) {
+	video_dev_t *dev = (video_dev_t*)handle;
+	volatile uint32_t *refs;
+	uint32_t capacity;
+	uint32_t i;
+	int result;
+
+	assert(NULL != dev);
+
+	if (dev->is_thread_running) {
+		return NOERROR;
+	}
+	if (overflow_policy > UVCC_OVERFLOW_BLOCK) {
+		LOGE("Overflow policy (%u) is not supported.", overflow_policy);
+		return INVALID_ARGUMENTS;
+	}
+
+	if (!dev->is_capture_started) {
+		result = uvcc_start_capture(handle);
+		if (NOERROR != result) {
+			return result;
+		}
+	}
+
+	// every buffer may be on its way back at the same time.
+	capacity = dev->buffer_count > dev->adaptive_max ? dev->buffer_count : dev->adaptive_max;
+
+	uvcc_ring_destroy(&dev->returns);
+	result = uvcc_ring_init(&dev->returns, capacity, sizeof(returned_buf_t));
+	if (NOERROR != result) {
+		LOGE("Insufficient memory for frame ring.");
+		return result;
+	}
+
+	refs = (volatile uint32_t*)realloc((void*)dev->refs, sizeof(uint32_t) * capacity);
+	if (NULL == refs) {
+		LOGE("Insufficient memory for reference counts.");
+		return INSUFFICIENT_MEMORY;
+	}
+	for (i = 0; i < capacity; ++i) {
+		refs[i] = (i < dev->buffer_count && BUFFER_STATE_LEASED == dev->buffers[i].state) ? 1 : 0;
+	}
+	dev->refs          = refs;
+	dev->refs_capacity = capacity;
+
+	// without subscribers frames go to the application through uvcc_acquire_frame().
+	dev->is_broadcast = (0 < dev->subscriber_count);
+	if (!dev->is_broadcast) {
+		result = init_subscriber(dev, &dev->default_subscriber, ring_size);
+		if (NOERROR != result) {
+			return result;
+		}
+	}
+
+	dev->overflow_policy    = overflow_policy;
+	dev->thread_result      = NOERROR;
+	dev->cancel_pending     = 0;
+	dev->is_thread_stopping = 0;
+	dev->is_thread_running  = 1;
+	dev->has_thread         = 1;
+
+	if (0 != pthread_create(&dev->thread, NULL, capture_thread_main, dev)) {
+		LOGE("Failed to create capture thread (%s).", strerror(errno));
+		dev->is_thread_running  = 0;
+		dev->is_thread_stopping = 1;
+		return INSUFFICIENT_MEMORY;
+	}
+
+	return NOERROR;
+}
+
+void uvcc_stop_capture_thread(uvcc_handle_t handle) {
+	video_dev_t *dev = (video_dev_t*)handle;
+	uint32_t i;
+
+	assert(NULL != dev);
+
+	if (!dev->has_thread) {
+		return;
+	}
+
+	if (!dev->is_thread_stopping) {
+		dev->is_thread_stopping = 1;
+		for (i = 0; i <= MAX_SUBSCRIBERS; ++i) {
+			if (get_subscriber(dev, i)->has_sync) {
+				sem_post(&get_subscriber(dev, i)->space_sem);
+			}
+		}
+		wake_up(dev->thread_wake_fd);
+		pthread_join(dev->thread, NULL);
+		dev->is_thread_running = 0;
+	}
+
+	for (i = 0; i <= MAX_SUBSCRIBERS; ++i) {
+		drain_subscriber(get_subscriber(dev, i));
+	}
+	drain_returns(dev);
+}
+
+int uvcc_subscribe(uvcc_handle_t handle, uint32_t ring_size, uvcc_subscriber_t *subscriber) {
+	video_dev_t *dev = (video_dev_t*)handle;
+	subscriber_t *sub = NULL;
+	uint32_t i;
+	int result;
+
+	assert(NULL != dev);
+
+	if (NULL == subscriber) {
+		LOGE("'subscriber' parameter can not set to NULL.");
+		return INVALID_ARGUMENTS;
+	}
+	if (dev->is_thread_running) {
+		LOGE("Subscribers can not be added while the capture thread is running.");
+		return INVALID_STATUS;
+	}
+	for (i = 0; i < MAX_SUBSCRIBERS; ++i) {
+		if (!dev->subscribers[i].is_active) {
+			sub = &dev->subscribers[i];
 			break;
 		}
+	}
+	if (NULL == sub) {
+		LOGE("Too many subscribers (max=%d).", MAX_SUBSCRIBERS);
+		return INSUFFICIENT_MEMORY;
+	}
 
-		if (!FD_ISSET(dev->fd, &rfds)) {
-			continue;
+	result = init_subscriber(dev, sub, ring_size);
+	if (NOERROR != result) {
+		return result;
+	}
+	sub->is_active = 1;
+	++dev->subscriber_count;
+
+	*subscriber = sub;
+
+	return NOERROR;
+}
+
+int uvcc_unsubscribe(uvcc_subscriber_t subscriber) {
+	subscriber_t *sub = (subscriber_t*)subscriber;
+	video_dev_t *dev;
+
+	if ((NULL == sub) || (NULL == sub->dev) || !sub->is_active) {
+		return INVALID_ARGUMENTS;
+	}
+	dev = sub->dev;
+	if (dev->is_thread_running) {
+		LOGE("Subscribers can not be removed while the capture thread is running.");
+		return INVALID_STATUS;
+	}
+
+	drain_subscriber(sub);
+	destroy_subscriber(sub);
+	sub->is_active = 0;
+	--dev->subscriber_count;
+
+	return NOERROR;
+}
+
+int uvcc_acquire_subscribed_frame(uvcc_subscriber_t subscriber, uvcc_frame_t *frame) {
+	subscriber_t *sub = (subscriber_t*)subscriber;
+
+	if ((NULL == sub) || (NULL == sub->dev) || (NULL == frame)) {
+		return INVALID_ARGUMENTS;
+	}
+	if (!sub->dev->has_thread || sub->dev->is_thread_stopping) {
+		LOGE("Capture thread is not running.");
+		return INVALID_STATUS;
+	}
+
+	return take_frame(sub, frame, -1);
+}
+
+int uvcc_get_subscriber_lag(uvcc_subscriber_t subscriber, uint32_t *pending, uint32_t *dropped) {
+	subscriber_t const *sub = (subscriber_t const*)subscriber;
+
+	if ((NULL == sub) || (NULL == sub->frames.seqs)) {
+		return INVALID_ARGUMENTS;
+	}
+	if (NULL != pending) {
+		*pending = uvcc_ring_count(&sub->frames);
+	}
+	if (NULL != dropped) {
+		*dropped = sub->dropped;
+	}
+
+	return NOERROR;
+}
+
+int uvcc_create_event_loop(uvcc_event_loop_t *loop) {
+	event_loop_t *ev;
+	struct epoll_event event;
+
+	if (NULL == loop) {
+		LOGE("'loop' parameter can not set to NULL.");
+		return INVALID_ARGUMENTS;
+	}
+
+	ev = (event_loop_t*)malloc(sizeof(event_loop_t));
+	if (NULL == ev) {
+		LOGE("Memory allocation failed.");
+		return INSUFFICIENT_MEMORY;
+	}
+	memset(ev, 0, sizeof(event_loop_t));
+
+	ev->epfd = epoll_create(MAX_LOOP_EVENTS);
+	if (0 > ev->epfd) {
+		LOGE("Failed to create epoll instance (%s).", strerror(errno));
+		free(ev);
+		return IO_ERROR;
+	}
+
+	// registered with NULL data to tell it apart from devices.
+	ev->wake_fd = eventfd(0, 0);
+	memset(&event, 0, sizeof(event));
+	event.events   = EPOLLIN;
+	event.data.ptr = NULL;
+	if ((0 > ev->wake_fd) || (0 > epoll_ctl(ev->epfd, EPOLL_CTL_ADD, ev->wake_fd, &event))) {
+		LOGE("Failed to create wake up event (%s).", strerror(errno));
+		if (0 <= ev->wake_fd) {
+			close(ev->wake_fd);
 		}
+		close(ev->epfd);
+		free(ev);
+		return IO_ERROR;
+	}
 
-		result = read_frame(buf, buf_size, dev);
-		break;
+	*loop = ev;
+
+	return NOERROR;
+}
+
+void uvcc_destroy_event_loop(uvcc_event_loop_t loop) {
+	event_loop_t *ev = (event_loop_t*)loop;
+	loop_entry_t *entry;
+
+	if (NULL == ev) {
+		return;
+	}
+
+	while (NULL != ev->entries) {
+		entry = ev->entries;
+		ev->entries = entry->next;
+		free(entry);
+	}
+	close(ev->wake_fd);
+	close(ev->epfd);
+	free(ev);
+}
+
+void uvcc_event_loop_stop(uvcc_event_loop_t loop) {
+	event_loop_t const *ev = (event_loop_t const*)loop;
+
+	if (NULL != ev) {
+		wake_up(ev->wake_fd);
+	}
+}
+
+int uvcc_event_loop_add(uvcc_event_loop_t loop, uvcc_handle_t handle, uvcc_frame_callback_t callback, void *user_data) {
+	event_loop_t *ev = (event_loop_t*)loop;
+	video_dev_t *dev = (video_dev_t*)handle;
+	loop_entry_t *entry;
+	struct epoll_event event;
+	int result;
+
+	if ((NULL == ev) || (NULL == dev) || (NULL == callback)) {
+		LOGE("Invalid arguments to register the device.");
+		return INVALID_ARGUMENTS;
+	}
+	if (dev->has_thread && !dev->is_thread_stopping) {
+		LOGE("Frames are dequeued by the capture thread.");
+		return INVALID_STATUS;
 	}
 
 	if (!dev->is_capture_started) {
-		uvcc_stop_capture(handle);
+		result = uvcc_start_capture(handle);
+		if (NOERROR != result) {
+			return result;
+		}
 	}
 
-	return result;
+	entry = (loop_entry_t*)malloc(sizeof(loop_entry_t));
+	if (NULL == entry) {
+		LOGE("Memory allocation failed.");
+		return INSUFFICIENT_MEMORY;
+	}
+	entry->dev       = dev;
+	entry->callback  = callback;
+	entry->user_data = user_data;
+
+	memset(&event, 0, sizeof(event));
+	event.events   = EPOLLIN;
+	event.data.ptr = entry;
+	if (0 > epoll_ctl(ev->epfd, EPOLL_CTL_ADD, dev->fd, &event)) {
+		LOGE("Failed to register the device (%s).", strerror(errno));
+		free(entry);
+		return (EEXIST == errno) ? INVALID_STATUS : IO_ERROR;
+	}
+
+	entry->next = ev->entries;
+	ev->entries = entry;
+
+	return NOERROR;
+}
+
+int uvcc_event_loop_remove(uvcc_event_loop_t loop, uvcc_handle_t handle) {
+	event_loop_t *ev = (event_loop_t*)loop;
+	loop_entry_t **link;
+	loop_entry_t *entry;
+	struct epoll_event event;
+
+	if (NULL == ev) {
+		return INVALID_ARGUMENTS;
+	}
+
+	for (link = &ev->entries; NULL != *link; link = &(*link)->next) {
+		entry = *link;
+		if (entry->dev != (video_dev_t const*)handle) {
+			continue;
+		}
+		// pre-2.6.9 kernels require non-NULL event even for EPOLL_CTL_DEL.
+		memset(&event, 0, sizeof(event));
+		epoll_ctl(ev->epfd, EPOLL_CTL_DEL, entry->dev->fd, &event);
+		*link = entry->next;
+		free(entry);
+		return NOERROR;
+	}
+
+	return INVALID_ARGUMENTS;
+}
+
+int uvcc_event_loop_dispatch(uvcc_event_loop_t loop, int timeout_ms, uint32_t *dispatched) {
+	event_loop_t *ev = (event_loop_t*)loop;
+	struct epoll_event events[MAX_LOOP_EVENTS];
+	loop_entry_t *entry;
+	uvcc_frame_t frame;
+	uint64_t value;
+	int result = NOERROR;
+	int cancelled = 0;
+	int i, n;
+
+	if (NULL == ev) {
+		return INVALID_ARGUMENTS;
+	}
+	if (NULL != dispatched) {
+		*dispatched = 0;
+	}
+
+	n = epoll_wait(ev->epfd, events, MAX_LOOP_EVENTS, timeout_ms);
+	if (n < 0) {
+		if (EINTR == errno) {
+			return NOERROR;
+		}
+		LOGE("Failed to wait for capturable frames (%s).", strerror(errno));
+		return IO_ERROR;
+	}
+
+	for (i = 0; i < n; ++i) {
+		entry = (loop_entry_t*)events[i].data.ptr;
+		if (NULL == entry) {
+			read(ev->wake_fd, &value, sizeof(value));
+			cancelled = 1;
+			continue;
+		}
+
+		result = dequeue_frame(entry->dev, &frame);
+		if (NOERROR != result) {
+			break;
+		}
+
+		entry->callback(entry->dev, &frame, entry->user_data);
+
+		result = uvcc_release_frame(entry->dev, &frame);
+		if (NOERROR != result) {
+			break;
+		}
+		if (NULL != dispatched) {
+			++*dispatched;
+		}
+	}
+
+	return ((NOERROR == result) && cancelled) ? CAPTURE_CANCELLED : result;
+}
+
+uint32_t uvcc_get_dropped_frames(uvcc_handle_t handle) {
+	video_dev_t const *dev = (video_dev_t const*)handle;
+	if (NULL == dev) {
+		return -1;
+	}
+	return dev->dropped_frames;
+}
+
+int uvcc_get_stats(uvcc_handle_t handle, uvcc_stats_t *stats) {
+	video_dev_t const *dev = (video_dev_t const*)handle;
+	uint32_t i;
+
+	if ((NULL == dev) || (NULL == stats)) {
+		return INVALID_ARGUMENTS;
+	}
+
+	stats->frames    = dev->stats.frames;
+	stats->dropped   = dev->dropped_frames;
+	stats->corrupted = dev->stats.corrupted;
+	stats->timeouts  = dev->stats.timeouts;
+	stats->cancelled = dev->stats.cancelled;
+	for (i = 0; i < UVCC_STAT_COUNT; ++i) {
+		uvcc_histogram_copy(&stats->latency[i], &dev->stats.latency[i]);
+	}
+
+	return NOERROR;
+}
+
+void uvcc_reset_stats(uvcc_handle_t handle) {
+	video_dev_t *dev = (video_dev_t*)handle;
+	uint32_t i;
+
+	assert(NULL != dev);
+
+	__sync_and_and_fetch(&dev->stats.frames, 0);
+	__sync_and_and_fetch(&dev->dropped_frames, 0);
+	__sync_and_and_fetch(&dev->stats.corrupted, 0);
+	__sync_and_and_fetch(&dev->stats.timeouts, 0);
+	__sync_and_and_fetch(&dev->stats.cancelled, 0);
+	for (i = 0; i < UVCC_STAT_COUNT; ++i) {
+		uvcc_histogram_reset(&dev->stats.latency[i]);
+	}
+}
+
+int uvcc_convert_frame_to_rgb(uvcc_handle_t handle, uvcc_frame_t const *frame, void *dst, uint32_t dst_stride, uint32_t dst_format, uint32_t color_space) {
+	video_dev_t const *dev = (video_dev_t const*)handle;
+	uvcc_frame_layout_t const *layout;
+	uvcc_planes_t src;
+	int ret;
+
+	ret = get_device_frame_planes(dev, frame, &src, &layout);
+	if (NOERROR != ret) {
+		return ret;
+	}
+
+	return uvcc_convert_to_rgb(src.data[0], src.stride[0], layout->pixel_format, dst, dst_stride, dst_format,
+		layout->width, layout->height, color_space);
+}
+
+int uvcc_convert_frame_to_yuv420(uvcc_handle_t handle, uvcc_frame_t const *frame, uvcc_planes_t const *dst, uint32_t dst_format) {
+	video_dev_t const *dev = (video_dev_t const*)handle;
+	uvcc_frame_layout_t const *layout;
+	uvcc_planes_t src;
+	int ret;
+
+	ret = get_device_frame_planes(dev, frame, &src, &layout);
+	if (NOERROR != ret) {
+		return ret;
+	}
+
+	return uvcc_convert_to_yuv420(src.data[0], src.stride[0], layout->pixel_format, dst, dst_format,
+		layout->width, layout->height);
+}
+
+int uvcc_scale_frame(uvcc_handle_t handle, uvcc_frame_t const *frame, uvcc_planes_t const *dst, uint32_t dst_width, uint32_t dst_height, uint32_t filter) {
+	video_dev_t const *dev = (video_dev_t const*)handle;
+	uvcc_frame_layout_t const *layout;
+	uvcc_planes_t src;
+	int ret;
+
+	ret = get_device_frame_planes(dev, frame, &src, &layout);
+	if (NOERROR != ret) {
+		return ret;
+	}
+
+	return uvcc_scale(&src, layout->width, layout->height, dst, dst_width, dst_height,
+		layout->pixel_format, filter);
+}
+
+int uvcc_get_frame_layout(uvcc_handle_t handle, uvcc_frame_layout_t *layout) {
+	video_dev_t const *dev = (video_dev_t const*)handle;
+
+	if ((NULL == dev) || (NULL == layout)) {
+		return INVALID_ARGUMENTS;
+	}
+	if (0 == dev->layout.plane_count) {
+		// no format negotiated yet.
+		return INVALID_STATUS;
+	}
+
+	*layout = dev->layout;
+	return NOERROR;
+}
+
+int uvcc_get_frame_planes(uvcc_frame_t const *frame, uvcc_planes_t *planes) {
+	uvcc_frame_layout_t const *layout;
+	uvcc_plane_layout_t const *last;
+	uint32_t i;
+
+	if ((NULL == frame) || (NULL == frame->data) || (NULL == frame->layout) || (NULL == planes)) {
+		return INVALID_ARGUMENTS;
+	}
+
+	layout = frame->layout;
+	if (0 == layout->plane_count) {
+		return INVALID_ARGUMENTS;
+	}
+	last = &layout->planes[layout->plane_count - 1];
+	if ((0 == last->height) || (frame->size < last->offset + last->stride * (last->height - 1) + last->row_bytes)) {
+		// truncated frame, e.g. flagged with UVCC_FRAME_FLAG_ERROR.
+		return IO_ERROR;
+	}
+
+	memset(planes, 0, sizeof(*planes));
+	for (i = 0; i < layout->plane_count; ++i) {
+		planes->data[i]   = (void*)((uint8_t const*)frame->data + layout->planes[i].offset);
+		planes->stride[i] = layout->planes[i].stride;
+	}
+
+	return NOERROR;
 }
 
 uint32_t uvcc_get_frame_size(uvcc_handle_t handle) {
@@ -573,6 +2581,10 @@ uint32_t uvcc_get_frame_size(uvcc_handle_t handle) {
 	if ((0 == dev->buffer_count) || (NULL == dev->buffers)) {
 		return -1;
 	}
+	// largest payload of a frame, not the length of the mapped buffer.
+	if ((0 != dev->format.fmt.pix.sizeimage) && (dev->format.fmt.pix.sizeimage < dev->buffers[0].size)) {
+		return dev->format.fmt.pix.sizeimage;
+	}
 	return dev->buffers[0].size;
 }
 
@@ -600,3 +2612,48 @@ uint32_t uvcc_get_pixel_format(uvcc_handle_t handle) {
 	return from_v4l2_pixel_format(dev->format.fmt.pix.pixelformat);
 }
 
+int uvcc_get_frame_rate(uvcc_handle_t handle, uint32_t *numerator, uint32_t *denominator) {
+	video_dev_t *dev = (video_dev_t*)handle;
+	struct v4l2_streamparm parm;
+
+	if ((NULL == dev) || (NULL == numerator) || (NULL == denominator)) {
+		return INVALID_ARGUMENTS;
+	}
+
+	memset(&parm, 0, sizeof(parm));
+	parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (0 > device_ioctl(dev, VIDIOC_G_PARM, &parm)) {
+		return IO_METHOD_NOT_SUPPORTED;
+	}
+	if ((0 == parm.parm.capture.timeperframe.numerator) || (0 == parm.parm.capture.timeperframe.denominator)) {
+		return IO_METHOD_NOT_SUPPORTED;
+	}
+	// the driver reports the time per frame, the inverse.
+	*numerator   = parm.parm.capture.timeperframe.denominator;
+	*denominator = parm.parm.capture.timeperframe.numerator;
+
+	return NOERROR;
+}
+
+uint32_t uvcc_get_color_space(uvcc_handle_t handle) {
+	video_dev_t const *dev = (video_dev_t const*)handle;
+	struct v4l2_pix_format const *pix;
+	int full;
+
+	if (NULL == dev) {
+		return -1;
+	}
+	pix = &dev->format.fmt.pix;
+	// JPEG implies full range, every other colorspace defaults to limited range.
+	full = (V4L2_COLORSPACE_JPEG == pix->colorspace);
+#ifdef V4L2_MAP_QUANTIZATION_DEFAULT
+	if (V4L2_QUANTIZATION_DEFAULT != pix->quantization) {
+		full = (V4L2_QUANTIZATION_FULL_RANGE == pix->quantization);
+	}
+#endif
+	if (V4L2_COLORSPACE_REC709 == pix->colorspace) {
+		return full ? UVCC_COLOR_BT709_FULL : UVCC_COLOR_BT709_LIMITED;
+	}
+	return full ? UVCC_COLOR_BT601_FULL : UVCC_COLOR_BT601_LIMITED;
+}
+
@@ -29,6 +29,8 @@ enum UVCC_ERRORS {
     MEMORY_DEQUEUEING_FAILED,
     INSUFFICIENT_MEMORY,
     NOT_PERMITTED,
+    CAPTURE_TIMEOUT,
+    CAPTURE_CANCELLED,
 };
 
 enum PIXEL_FORMATS {
@@ -40,21 +42,333 @@ enum PIXEL_FORMATS {
 	UVCC_PIX_FMT_YUV420,
 	UVCC_PIX_FMT_YUV410,
 	UVCC_PIX_FMT_YUV422P,
+	UVCC_PIX_FMT_NV12,
+	UVCC_PIX_FMT_NV21,
 	UVCC_PIX_FMT_COUNT, // count of pixel formats.
 };
 
+enum UVCC_IO_METHODS {
+	UVCC_IO_METHOD_MMAP = 0, // buffers allocated by the driver and mapped.
+	UVCC_IO_METHOD_USERPTR,  // buffers allocated by the library and handed to the driver.
+};
+
+enum UVCC_IO_FLAGS {
+	UVCC_IO_FLAG_HUGEPAGE = 0x0001, // back user pointer buffers with huge pages if possible.
+};
+
+enum UVCC_OVERFLOW_POLICIES {
+	UVCC_OVERFLOW_DROP_OLDEST = 0, // replace the oldest frame not taken yet.
+	UVCC_OVERFLOW_DROP_NEWEST,     // give the new frame back to the driver.
+	UVCC_OVERFLOW_BLOCK,           // stop dequeueing until a frame is taken.
+};
+
+enum UVCC_FRAME_FLAGS {
+	UVCC_FRAME_FLAG_ERROR     = 0x0001, // driver reported the frame as corrupted.
+	UVCC_FRAME_FLAG_KEYFRAME  = 0x0002,
+	UVCC_FRAME_FLAG_MONOTONIC = 0x0004, // 'timestamp' is taken from CLOCK_MONOTONIC.
+};
+
+enum UVCC_STAT_STAGES {
+	UVCC_STAT_DEQUEUE = 0, // driver timestamp -> VIDIOC_DQBUF returned.
+	UVCC_STAT_HOLD,        // VIDIOC_DQBUF -> frame copied out or released.
+	UVCC_STAT_REQUEUE,     // frame released -> VIDIOC_QBUF.
+	UVCC_STAT_WAIT,        // caller waiting in uvcc_capture() or uvcc_acquire_frame().
+	UVCC_STAT_COUNT,       // count of stages.
+};
+
+enum UVCC_COLOR_SPACES {
+	UVCC_COLOR_BT601_LIMITED = 0, // Y 16..235, usual for SD cameras.
+	UVCC_COLOR_BT601_FULL,        // Y 0..255 (JPEG).
+	UVCC_COLOR_BT709_LIMITED,     // usual for HD cameras.
+	UVCC_COLOR_BT709_FULL,
+	UVCC_COLOR_COUNT,             // count of color spaces.
+};
+
+enum UVCC_SIMD_LEVELS {
+	UVCC_SIMD_NONE = 0, // portable C.
+	UVCC_SIMD_SSE2,
+	UVCC_SIMD_AVX2,
+	UVCC_SIMD_NEON,
+};
+
+enum UVCC_WINDOW_MODES {
+	UVCC_WINDOW_NONE = 0, // whole frames.
+	UVCC_WINDOW_DEVICE,   // the driver crops, every frame is the window.
+	UVCC_WINDOW_COPY,     // frames are whole, uvcc_capture() copies the window.
+};
+
+enum UVCC_SCALE_FILTERS {
+	UVCC_SCALE_BOX = 0,      // average of every source pixel covered.
+	UVCC_SCALE_BILINEAR,     // blend of the 2x2 source pixels nearest to the center.
+	UVCC_SCALE_FILTER_COUNT, // count of filters.
+};
+
+#define UVCC_HISTOGRAM_BUCKETS 176
+#define UVCC_MAX_THREADS        64
+#define UVCC_MAX_PLANES          3
+
 typedef void const* uvcc_handle_t;
+typedef void const* uvcc_subscriber_t;
+typedef void const* uvcc_event_loop_t;
+
+/*
+ * Where the samples of one plane lie in a frame. 'offset' counts from the
+ * start of the frame, 'stride' includes the padding the driver leaves
+ * after the 'row_bytes' holding samples. 'xshift' and 'yshift' are the
+ * subsampling of the plane (log2), e.g. 1 and 1 for the chroma of YUV420.
+ */
+typedef struct uvcc_plane_layout_t_ {
+	uint32_t offset;
+	uint32_t stride;
+	uint32_t row_bytes;
+	uint32_t height;
+	uint8_t  xshift;
+	uint8_t  yshift;
+} uvcc_plane_layout_t;
+
+/*
+ * Layout of the frames of a device as negotiated with the driver.
+ * 'size' is the image size the driver reported. 'alignment' is the
+ * largest power of two (up to 4096) dividing every plane offset and
+ * stride; buffers mapped or allocated by the library start on a page,
+ * so plane pointers of leased frames share it.
+ */
+typedef struct uvcc_frame_layout_t_ {
+	uint32_t            pixel_format;
+	uint32_t            width;
+	uint32_t            height;
+	uint32_t            size;
+	uint32_t            alignment;
+	uint32_t            plane_count;
+	uvcc_plane_layout_t planes[UVCC_MAX_PLANES];
+} uvcc_frame_layout_t;
+
+/*
+ * Frame leased by uvcc_acquire_frame().
+ * 'data' points directly into the mapped video buffer and stays valid
+ * until the frame is returned by uvcc_release_frame().
+ * 'size' is the payload filled by the driver (bytesused), which may be
+ * much smaller than the mapped buffer for compressed formats.
+ * uvcc_capture() copies only that payload and reports it through 'info'
+ * with 'data' pointing at the caller's buffer.
+ * 'dmabuf_fd' is the exported DMABUF of the video buffer, or -1 unless
+ * uvcc_export_buffers() has been called.
+ * 'timestamp' (microseconds), 'sequence' and 'flags' come from the driver;
+ * 'dropped' counts the frames lost right before this one.
+ * 'dequeued' is the CLOCK_MONOTONIC time (microseconds) at which the
+ * library took the frame from the driver.
+ * 'layout' belongs to the device and stays valid until it is initialized
+ * again; uvcc_get_frame_planes() resolves it against 'data'.
+ */
+typedef struct uvcc_frame_t_ {
+	void const *data;
+	uint32_t    size;
+	uint32_t    index;
+	int         dmabuf_fd;
+	uint32_t    sequence;
+	uint32_t    dropped;
+	uint32_t    flags;
+	uint64_t    timestamp;
+	uint64_t    dequeued;
+	uvcc_frame_layout_t const *layout;
+} uvcc_frame_t;
+
+/*
+ * Latency histogram in microseconds. Bucket widths grow with the value
+ * (log-linear), uvcc_histogram_bucket_value() gives the lowest value of a
+ * bucket. 'min' and 'max' are exact.
+ */
+typedef struct uvcc_histogram_t_ {
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint32_t buckets[UVCC_HISTOGRAM_BUCKETS];
+} uvcc_histogram_t;
+
+typedef struct uvcc_stats_t_ {
+	uint32_t         frames;    // frames dequeued from the driver.
+	uint32_t         dropped;   // frames lost by the driver.
+	uint32_t         corrupted; // frames flagged with UVCC_FRAME_FLAG_ERROR.
+	uint32_t         timeouts;
+	uint32_t         cancelled;
+	uvcc_histogram_t latency[UVCC_STAT_COUNT];
+} uvcc_stats_t;
+
+/*
+ * Planes supplied by the caller: Y, then U and V (YUV420), or the
+ * interleaved chroma plane (NV12: U first, NV21: V first) and no third.
+ * Packed formats only use the first plane.
+ */
+typedef struct uvcc_planes_t_ {
+	void    *data[3];
+	uint32_t stride[3];
+} uvcc_planes_t;
+
+typedef struct uvcc_rect_t_ {
+	uint32_t left;
+	uint32_t top;
+	uint32_t width;
+	uint32_t height;
+} uvcc_rect_t;
+
+/* Processes rows [begin, end) of a frame, see uvcc_run_bands(). */
+typedef void (*uvcc_band_func_t)(uint32_t begin, uint32_t end, void *user_data);
+
+/* Called from uvcc_event_loop_dispatch(); the frame is released on return. */
+typedef void (*uvcc_frame_callback_t)(uvcc_handle_t handle, uvcc_frame_t const *frame, void *user_data);
 
+/*
+ * 'path' is a V4L2 device node, or "fake:options" to capture from an
+ * in-process emulated device, e.g. "fake:fps=60,jitter=2000,drop=10,seed=1"
+ * (jitter in microseconds, drop probability in 1/1000, fps=0 runs freely).
+ */
 extern int  uvcc_open_video_device(uvcc_handle_t *handle, char const * const path);
 extern void uvcc_close_video_device(uvcc_handle_t handle);
-extern int  uvcc_init_video_device(uvcc_handle_t handle, uint32_t width, uint32_t height, uint32_t pixel_format);
+/*
+ * Select how video buffers are allocated. Must be called before
+ * uvcc_init_video_device(). With UVCC_IO_METHOD_USERPTR the frames are
+ * captured into page aligned memory owned by the library, which stays
+ * mapped until the device is closed.
+ */
+extern int  uvcc_set_io_method(uvcc_handle_t handle, uint32_t io_method, uint32_t flags);
+extern int  uvcc_init_video_device(uvcc_handle_t handle, uint32_t width, uint32_t height, uint32_t pixel_format, uint32_t buffer_count);
+/*
+ * Let the buffer ring grow up to 'max_count' buffers when frames are dropped
+ * or the driver runs out of queued buffers, and shrink back towards
+ * 'min_count' while the consumer keeps up. 'max_count' of 0 disables it.
+ */
+extern int  uvcc_set_adaptive_buffering(uvcc_handle_t handle, uint32_t min_count, uint32_t max_count);
+/*
+ * Capture a window of the frame only. Set before uvcc_init_video_device(),
+ * in coordinates of the frame size given to it; NULL captures whole frames
+ * again. The window grows to whole YUYV macropixels and chroma samples.
+ * The driver crops when VIDIOC_S_SELECTION or VIDIOC_S_CROP takes the
+ * window as it is; otherwise frames stay whole and uvcc_capture() copies
+ * just the rows and columns of the window, packed, out of the buffer.
+ * uvcc_get_capture_window() returns the UVCC_WINDOW_MODES in effect.
+ * uvcc_copy_window() does the same copy for any frame, e.g. a leased one,
+ * and reports the bytes written in 'size'.
+ */
+extern int  uvcc_set_capture_window(uvcc_handle_t handle, uvcc_rect_t const *window);
+extern uint32_t uvcc_get_capture_window(uvcc_handle_t handle, uvcc_rect_t *window);
+extern int  uvcc_copy_window(uvcc_frame_t const *frame, uvcc_rect_t const *window, void *dst, uint32_t dst_size, uint32_t *size);
 extern int  uvcc_start_capture(uvcc_handle_t dev);
 extern void uvcc_stop_capture(uvcc_handle_t dev);
-extern int  uvcc_capture(uvcc_handle_t handle, uint8_t * const buf, size_t buf_size);
+extern int  uvcc_capture(uvcc_handle_t handle, uint8_t * const buf, size_t buf_size, uvcc_frame_t *info);
+extern int  uvcc_acquire_frame(uvcc_handle_t handle, uvcc_frame_t *frame);
+extern int  uvcc_release_frame(uvcc_handle_t handle, uvcc_frame_t const *frame);
+/*
+ * Blocking capture sleeps until a frame arrives, 'timeout_ms' elapses
+ * (CAPTURE_TIMEOUT, -1 waits forever) or another thread calls
+ * uvcc_cancel_capture() (CAPTURE_CANCELLED). A cancel request issued
+ * while nobody waits is consumed by the next wait.
+ */
+extern int  uvcc_capture_timeout(uvcc_handle_t handle, uint8_t * const buf, size_t buf_size, uvcc_frame_t *info, int timeout_ms);
+extern int  uvcc_acquire_frame_timeout(uvcc_handle_t handle, uvcc_frame_t *frame, int timeout_ms);
+extern void uvcc_cancel_capture(uvcc_handle_t handle);
+/*
+ * Dequeue frames on a background thread and hand them over through a
+ * lock-free ring of 'ring_size' frames (0 = buffer count - 1).
+ * uvcc_acquire_frame() and uvcc_capture() then take frames from the ring,
+ * and 'overflow_policy' decides what happens when the ring is full.
+ */
+extern int  uvcc_start_capture_thread(uvcc_handle_t handle, uint32_t ring_size, uint32_t overflow_policy);
+extern void uvcc_stop_capture_thread(uvcc_handle_t handle);
+/*
+ * Broadcast frames to several consumers. Subscribers are added before
+ * uvcc_start_capture_thread(); every dequeued frame is then delivered to
+ * each subscriber's ring without copying and the buffer is queued again
+ * when the last subscriber calls uvcc_release_frame().
+ * 'pending' is the number of frames waiting in the subscriber's ring and
+ * 'dropped' the number of frames it missed because the ring was full.
+ */
+extern int  uvcc_subscribe(uvcc_handle_t handle, uint32_t ring_size, uvcc_subscriber_t *subscriber);
+extern int  uvcc_unsubscribe(uvcc_subscriber_t subscriber);
+extern int  uvcc_acquire_subscribed_frame(uvcc_subscriber_t subscriber, uvcc_frame_t *frame);
+extern int  uvcc_get_subscriber_lag(uvcc_subscriber_t subscriber, uint32_t *pending, uint32_t *dropped);
+/*
+ * Export every video buffer as a DMABUF file descriptor (VIDIOC_EXPBUF).
+ * Descriptors are owned by the library and closed with the device;
+ * dup() them to hand frames to other processes or devices.
+ */
+extern int  uvcc_export_buffers(uvcc_handle_t handle);
+extern int  uvcc_get_buffer_count(uvcc_handle_t handle);
+extern int  uvcc_get_buffer_fd(uvcc_handle_t handle, uint32_t index);
+/*
+ * Serve many devices from one thread. Registered devices are started and
+ * watched by a single epoll instance; uvcc_event_loop_dispatch() waits up
+ * to 'timeout_ms' (-1 = forever) and calls back once per ready frame.
+ */
+extern int  uvcc_create_event_loop(uvcc_event_loop_t *loop);
+extern void uvcc_destroy_event_loop(uvcc_event_loop_t loop);
+extern int  uvcc_event_loop_add(uvcc_event_loop_t loop, uvcc_handle_t handle, uvcc_frame_callback_t callback, void *user_data);
+extern int  uvcc_event_loop_remove(uvcc_event_loop_t loop, uvcc_handle_t handle);
+extern int  uvcc_event_loop_dispatch(uvcc_event_loop_t loop, int timeout_ms, uint32_t *dispatched);
+/* Wake up uvcc_event_loop_dispatch() from another thread with CAPTURE_CANCELLED. */
+extern void uvcc_event_loop_stop(uvcc_event_loop_t loop);
+extern uint32_t uvcc_get_dropped_frames(uvcc_handle_t handle);
+/*
+ * Copy out the counters and per-stage latency histograms. Recording never
+ * takes a lock, so the snapshot may be a frame behind on busy devices.
+ */
+extern int  uvcc_get_stats(uvcc_handle_t handle, uvcc_stats_t *stats);
+extern void uvcc_reset_stats(uvcc_handle_t handle);
+extern uint32_t uvcc_histogram_percentile(uvcc_histogram_t const *hist, double percentile);
+extern uint32_t uvcc_histogram_bucket_value(uint32_t bucket);
+/*
+ * Convert packed YUYV or UYVY into RGB565 (little endian), RGB32 (bytes
+ * R, G, B, A) or BGR32 (bytes B, G, R, A); alpha is opaque. 'width' must
+ * be even. The fastest kernels the CPU supports are used unless
+ * uvcc_set_simd_level() limits them; it returns the level in effect.
+ */
+extern int  uvcc_convert_to_rgb(void const *src, uint32_t src_stride, uint32_t src_format, void *dst, uint32_t dst_stride, uint32_t dst_format, uint32_t width, uint32_t height, uint32_t color_space);
+extern int  uvcc_convert_frame_to_rgb(uvcc_handle_t handle, uvcc_frame_t const *frame, void *dst, uint32_t dst_stride, uint32_t dst_format, uint32_t color_space);
+/*
+ * Convert packed YUYV or UYVY into YUV420 (I420), NV12 or NV21. Two
+ * source rows are read at a time and their chroma averaged on the way,
+ * so the source is read once; 'width' must be even.
+ */
+extern int  uvcc_convert_to_yuv420(void const *src, uint32_t src_stride, uint32_t src_format, uvcc_planes_t const *dst, uint32_t dst_format, uint32_t width, uint32_t height);
+extern int  uvcc_convert_frame_to_yuv420(uvcc_handle_t handle, uvcc_frame_t const *frame, uvcc_planes_t const *dst, uint32_t dst_format);
+/*
+ * Downscale YUYV, UYVY, RGB32, BGR32, YUV420, YUV422P, YUV410, NV12 or
+ * NV21 by any ratio, reading the source planes where they are, e.g. in a
+ * captured buffer. Planes scaled to exactly a half or a quarter go through
+ * SIMD kernels averaging 2x2 samples, once or twice, whatever the filter;
+ * sampling a quarter bilinearly would alias. YUYV and UYVY widths must be
+ * even.
+ */
+extern int  uvcc_scale(uvcc_planes_t const *src, uint32_t src_width, uint32_t src_height, uvcc_planes_t const *dst, uint32_t dst_width, uint32_t dst_height, uint32_t format, uint32_t filter);
+extern int  uvcc_scale_frame(uvcc_handle_t handle, uvcc_frame_t const *frame, uvcc_planes_t const *dst, uint32_t dst_width, uint32_t dst_height, uint32_t filter);
+/*
+ * Frame kernels split their rows over a pool of worker threads owned by
+ * the library. The pool starts with one thread (the caller);
+ * uvcc_set_thread_count() resizes it, 0 meaning one per online CPU, and
+ * returns the count in effect. uvcc_run_bands() hands 'tile_rows' rows
+ * at a time to the calling thread and the workers, which steal tiles from
+ * each other when they run out. It returns once every row is done.
+ * A run started while another one is in progress, or from within one,
+ * is processed by the calling thread alone.
+ */
+extern uint32_t uvcc_set_thread_count(uint32_t count);
+extern uint32_t uvcc_get_thread_count();
+extern int  uvcc_run_bands(uint32_t rows, uint32_t tile_rows, uvcc_band_func_t func, void *user_data);
+extern uint32_t uvcc_get_simd_level();
+extern uint32_t uvcc_set_simd_level(uint32_t level);
 extern uint32_t uvcc_get_frame_size(uvcc_handle_t handle);
+extern int  uvcc_get_frame_layout(uvcc_handle_t handle, uvcc_frame_layout_t *layout);
+/* Plane pointers and strides of a frame; IO_ERROR when it is too short to hold them. */
+extern int  uvcc_get_frame_planes(uvcc_frame_t const *frame, uvcc_planes_t *planes);
 extern uint32_t uvcc_get_frame_width(uvcc_handle_t handle);
 extern uint32_t uvcc_get_frame_height(uvcc_handle_t handle);
 extern uint32_t uvcc_get_pixel_format(uvcc_handle_t handle);
+/*
+ * Frame rate the driver streams at, 'numerator'/'denominator' frames per
+ * second; IO_METHOD_NOT_SUPPORTED when it does not tell.
+ */
+extern int  uvcc_get_frame_rate(uvcc_handle_t handle, uint32_t *numerator, uint32_t *denominator);
+/* UVCC_COLOR_* matching the colorspace and range the driver reported. */
+extern uint32_t uvcc_get_color_space(uvcc_handle_t handle);
 
 #ifdef __cplusplus
 }
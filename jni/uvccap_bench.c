@@ -0,0 +1,974 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "uvccap.h"
+
+#define LOGE(fmt, ...) fprintf(stderr, "Error: " fmt, ##__VA_ARGS__)
+#define LOGI(fmt, ...) fprintf(stdout,           fmt, ##__VA_ARGS__)
+
+/* Data structure and constant values */
+#define DEF_VIDEO_DEVICE   "/dev/video0"
+#define DEF_CAPTURE_WIDTH  640
+#define DEF_CAPTURE_HEIGHT 480
+#define DEF_PIXEL_FORMAT     3
+#define DEF_CAPTURE_COUNT  300
+#define DEF_BUFFER_COUNT     4
+#define MAX_LOOP_DEVICES    32
+
+enum BENCH_MODES {
+	BENCH_MODE_IO = 0,  // MMAP+memcpy versus USERPTR
+	BENCH_MODE_LOOP,    // many devices served by one event loop
+	BENCH_MODE_SUITE,   // every pixel format, reported as JSON
+	BENCH_MODE_CONVERT, // YUV -> RGB kernels of every SIMD level
+	BENCH_MODE_THREADS, // frame conversion versus worker threads
+	BENCH_MODE_SCALE,   // downscaling kernels of every SIMD level
+};
+
+typedef struct bench_args_t_ {
+	char *device;
+	int   cap_width;
+	int   cap_height;
+	int   pixel_format;
+	int   cap_count;
+	int   buffer_count;
+	int   use_hugepage;
+	int   mode;
+	char *devices;
+	int   max_threads;
+} bench_args_t;
+
+typedef struct bench_result_t_ {
+	uint32_t frames;
+	uint64_t bytes;
+	uint64_t wall_us;
+	uint64_t cpu_us;
+} bench_result_t;
+
+typedef struct suite_result_t_ {
+	int            supported;
+	uint32_t       width;
+	uint32_t       height;
+	uint32_t       frame_size;
+	uint64_t       open_us;        // open and initialization
+	uint64_t       first_frame_us; // start of capture until the first frame
+	uint64_t       copy_us;        // spent copying frames out of the buffers
+	bench_result_t run;
+	uvcc_stats_t   stats;
+} suite_result_t;
+
+static char const *PIXEL_FORMAT_NAMES[] = {
+	"RGB565",
+	"RGB32",
+	"BGR32",
+	"YUYV",
+	"UYVY",
+	"YUV420",
+	"YUV410",
+	"YUV422P",
+	"NV12",
+	"NV21",
+	NULL // sentinel
+};
+
+static char const *SIMD_LEVEL_NAMES[] = {
+	"scalar",
+	"sse2",
+	"avx2",
+	"neon",
+	NULL // sentinel
+};
+
+/* Internal APIs */
+static int bench_mmap_copy(bench_args_t const *args, bench_result_t *result);
+static int bench_userptr(bench_args_t const *args, bench_result_t *result);
+static int bench_event_loop(bench_args_t const *args, bench_result_t *result, int *device_count);
+static int bench_suite(bench_args_t const *args);
+static int bench_format(bench_args_t const *args, int format, suite_result_t *result);
+static int bench_convert(bench_args_t const *args);
+static int bench_threads(bench_args_t const *args);
+static int bench_scale(bench_args_t const *args);
+static uint32_t pack_planes(uint8_t *data, uint32_t format, uint32_t width, uint32_t height, uvcc_planes_t *planes);
+static int convert_frame(uint8_t const *src, uint32_t src_format, uint8_t *dst, uint32_t dst_format, uint32_t width, uint32_t height);
+static int check_window_copy(bench_args_t const *args, int mode);
+static void print_result(char const *name, bench_result_t const *result);
+static void print_json_string(char const *str);
+static void print_json_result(int format, suite_result_t const *result);
+
+static void usage() {
+	printf("Usage: uvccap_bench [options]\n");
+	printf("[Option]\n");
+	printf("  -d device    : path to video device.\n");
+	printf("                 'fake:fps=N,jitter=us,drop=permille,seed=N' emulates a device.\n");
+	printf("  -w width     : width of capture image.\n");
+	printf("  -h height    : height of capture image.\n");
+	printf("  -f format    : pixel format of capture image (default: %d).\n", DEF_PIXEL_FORMAT);
+	printf("  -n count     : count of frames per run (default: %d).\n", DEF_CAPTURE_COUNT);
+	printf("  -b count     : count of video buffers (default: %d).\n", DEF_BUFFER_COUNT);
+	printf("  -H           : back user pointer buffers with huge pages.\n");
+	printf("  -m mode      : benchmark to run (io, loop, suite, convert, threads, scale) (default: io).\n");
+	printf("                 'suite' measures every pixel format and prints JSON.\n");
+	printf("                 'convert' times YUYV/UYVY -> RGB/YUV420 kernels without a device.\n");
+	printf("                 'threads' shows frames/s of the conversions versus threads.\n");
+	printf("                 'scale' times downscaling to 1/2, 1/4 and 3/8 without a device.\n");
+	printf("  -l devices   : comma separated video devices for 'loop' mode.\n");
+	printf("  -T count     : highest thread count for 'threads' mode (default: online CPUs).\n");
+	exit(NOERROR);
+}
+
+static int parse_args(int argc, char **argv, bench_args_t *args) {
+	int opt;
+
+	if ((argc == 2) && ((0 == strcmp(argv[1], "--help")) || (0 == strcmp(argv[1], "-?")))) {
+		usage();
+		return 0;
+	}
+
+	while((opt = getopt(argc, argv, "d:w:h:f:n:b:Hm:l:T:")) != -1) {
+		switch(opt) {
+		case 'd':
+			if (NULL == optarg || '\0' == *optarg) {
+				LOGE("invalid device path.\n");
+				return -1;
+			}
+			args->device = optarg;
+			break;
+		case 'w':
+			args->cap_width = atoi(optarg);
+			break;
+		case 'h':
+			args->cap_height = atoi(optarg);
+			break;
+		case 'f':
+			args->pixel_format = atoi(optarg);
+			if (args->pixel_format >= UVCC_PIX_FMT_COUNT) {
+				LOGE("pixel format (%d) is not supported.\n", args->pixel_format);
+				return -1;
+			}
+			break;
+		case 'n':
+			args->cap_count = atoi(optarg);
+			break;
+		case 'b':
+			args->buffer_count = atoi(optarg);
+			break;
+		case 'H':
+			args->use_hugepage = 1;
+			break;
+		case 'm':
+			if (0 == strcmp(optarg, "io")) {
+				args->mode = BENCH_MODE_IO;
+			} else if (0 == strcmp(optarg, "loop")) {
+				args->mode = BENCH_MODE_LOOP;
+			} else if (0 == strcmp(optarg, "suite")) {
+				args->mode = BENCH_MODE_SUITE;
+			} else if (0 == strcmp(optarg, "convert")) {
+				args->mode = BENCH_MODE_CONVERT;
+			} else if (0 == strcmp(optarg, "threads")) {
+				args->mode = BENCH_MODE_THREADS;
+			} else if (0 == strcmp(optarg, "scale")) {
+				args->mode = BENCH_MODE_SCALE;
+			} else {
+				LOGE("unknown benchmark mode (%s).\n", optarg);
+				return -1;
+			}
+			break;
+		case 'l':
+			args->devices = optarg;
+			break;
+		case 'T':
+			args->max_threads = atoi(optarg);
+			break;
+		default:
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static uint64_t wall_clock_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t cpu_time_us() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+		+ usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static int open_device(bench_args_t const *args, uint32_t io_method, uvcc_handle_t *handle) {
+	uint32_t const flags = args->use_hugepage ? UVCC_IO_FLAG_HUGEPAGE : 0;
+	int ret;
+
+	ret = uvcc_open_video_device(handle, args->device);
+	if (NOERROR != ret) {
+		LOGE("failed to open video device.\n");
+		return ret;
+	}
+
+	ret = uvcc_set_io_method(*handle, io_method, flags);
+	if (NOERROR == ret) {
+		ret = uvcc_init_video_device(*handle, args->cap_width, args->cap_height, args->pixel_format, args->buffer_count);
+	}
+	if (NOERROR == ret) {
+		ret = uvcc_start_capture(*handle);
+	}
+	if (NOERROR != ret) {
+		LOGE("failed to initialize video device.\n");
+		uvcc_close_video_device(*handle);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv) {
+	bench_args_t args = {
+		DEF_VIDEO_DEVICE,
+		DEF_CAPTURE_WIDTH,
+		DEF_CAPTURE_HEIGHT,
+		DEF_PIXEL_FORMAT,
+		DEF_CAPTURE_COUNT,
+		DEF_BUFFER_COUNT,
+		0,
+		BENCH_MODE_IO,
+		NULL,
+		0,
+	};
+	bench_result_t result;
+	char name[32];
+	int count;
+	int ret;
+
+	if (parse_args(argc, argv, &args)) {
+		LOGE("failed to parse arguments.\n");
+		return INVALID_ARGUMENTS;
+	}
+
+	if (BENCH_MODE_SUITE == args.mode) {
+		return bench_suite(&args);
+	}
+
+	if (BENCH_MODE_CONVERT == args.mode) {
+		return bench_convert(&args);
+	}
+
+	if (BENCH_MODE_THREADS == args.mode) {
+		return bench_threads(&args);
+	}
+
+	if (BENCH_MODE_SCALE == args.mode) {
+		return bench_scale(&args);
+	}
+
+	if (BENCH_MODE_LOOP == args.mode) {
+		ret = bench_event_loop(&args, &result, &count);
+		if (NOERROR != ret) {
+			return ret;
+		}
+		snprintf(name, sizeof(name), "loop(%d devices)", count);
+		print_result(name, &result);
+		return NOERROR;
+	}
+
+	ret = bench_mmap_copy(&args, &result);
+	if (NOERROR != ret) {
+		return ret;
+	}
+	print_result("mmap+memcpy", &result);
+
+	ret = bench_userptr(&args, &result);
+	if (NOERROR != ret) {
+		return ret;
+	}
+	print_result(args.use_hugepage ? "userptr(hugepage)" : "userptr", &result);
+
+	return NOERROR;
+}
+
+static int bench_mmap_copy(bench_args_t const *args, bench_result_t *result) {
+	uvcc_handle_t handle;
+	uvcc_frame_t info;
+	uint64_t wall, cpu;
+	uint32_t size;
+	uint8_t *buf;
+	int ret;
+	int i;
+
+	assert(NULL != args);
+	assert(NULL != result);
+
+	ret = open_device(args, UVCC_IO_METHOD_MMAP, &handle);
+	if (NOERROR != ret) {
+		return ret;
+	}
+
+	size = uvcc_get_frame_size(handle);
+	buf  = malloc(size);
+	if (NULL == buf) {
+		LOGE("memory allocation failed.\n");
+		uvcc_stop_capture(handle);
+		uvcc_close_video_device(handle);
+		return INSUFFICIENT_MEMORY;
+	}
+
+	memset(result, 0, sizeof(*result));
+	wall = wall_clock_us();
+	cpu  = cpu_time_us();
+	for (i = 0; i < args->cap_count; ++i) {
+		ret = uvcc_capture(handle, buf, size, &info);
+		if (NOERROR != ret) {
+			break;
+		}
+		result->bytes += info.size;
+		++result->frames;
+	}
+	result->wall_us = wall_clock_us() - wall;
+	result->cpu_us  = cpu_time_us() - cpu;
+
+	free(buf);
+	uvcc_stop_capture(handle);
+	uvcc_close_video_device(handle);
+
+	return ret;
+}
+
+static int bench_userptr(bench_args_t const *args, bench_result_t *result) {
+	uvcc_handle_t handle;
+	uvcc_frame_t frame;
+	uint64_t wall, cpu;
+	int ret;
+	int i;
+
+	assert(NULL != args);
+	assert(NULL != result);
+
+	ret = open_device(args, UVCC_IO_METHOD_USERPTR, &handle);
+	if (NOERROR != ret) {
+		return ret;
+	}
+
+	memset(result, 0, sizeof(*result));
+	wall = wall_clock_us();
+	cpu  = cpu_time_us();
+	for (i = 0; i < args->cap_count; ++i) {
+		ret = uvcc_acquire_frame(handle, &frame);
+		if (NOERROR != ret) {
+			break;
+		}
+		result->bytes += frame.size;
+		++result->frames;
+		ret = uvcc_release_frame(handle, &frame);
+		if (NOERROR != ret) {
+			break;
+		}
+	}
+	result->wall_us = wall_clock_us() - wall;
+	result->cpu_us  = cpu_time_us() - cpu;
+
+	uvcc_stop_capture(handle);
+	uvcc_close_video_device(handle);
+
+	return ret;
+}
+
+static void count_frame(uvcc_handle_t handle, uvcc_frame_t const *frame, void *user_data) {
+	bench_result_t *result = (bench_result_t*)user_data;
+	result->bytes += frame->size;
+	++result->frames;
+}
+
+static int bench_event_loop(bench_args_t const *args, bench_result_t *result, int *device_count) {
+	uvcc_handle_t handles[MAX_LOOP_DEVICES];
+	bench_result_t per_device[MAX_LOOP_DEVICES];
+	bench_args_t dev_args = *args;
+	uvcc_event_loop_t loop;
+	char devices[4096];
+	char *path, *save;
+	uint64_t wall, cpu;
+	uint32_t target;
+	int count = 0;
+	int ret;
+	int i;
+
+	assert(NULL != args);
+	assert(NULL != result);
+
+	snprintf(devices, sizeof(devices), "%s", (NULL != args->devices) ? args->devices : args->device);
+
+	ret = uvcc_create_event_loop(&loop);
+	if (NOERROR != ret) {
+		return ret;
+	}
+
+	for (path = strtok_r(devices, ",", &save); NULL != path; path = strtok_r(NULL, ",", &save)) {
+		if (count >= MAX_LOOP_DEVICES) {
+			LOGE("too many devices (max=%d).\n", MAX_LOOP_DEVICES);
+			break;
+		}
+		dev_args.device = path;
+		ret = open_device(&dev_args, UVCC_IO_METHOD_MMAP, &handles[count]);
+		if (NOERROR != ret) {
+			break;
+		}
+		memset(&per_device[count], 0, sizeof(bench_result_t));
+		ret = uvcc_event_loop_add(loop, handles[count], count_frame, &per_device[count]);
+		++count;
+		if (NOERROR != ret) {
+			break;
+		}
+	}
+
+	memset(result, 0, sizeof(*result));
+	if (NOERROR == ret) {
+		target = args->cap_count * count;
+		wall = wall_clock_us();
+		cpu  = cpu_time_us();
+		while (NOERROR == ret && result->frames < target) {
+			ret = uvcc_event_loop_dispatch(loop, 1000, NULL);
+			result->frames = 0;
+			for (i = 0; i < count; ++i) {
+				result->frames += per_device[i].frames;
+			}
+		}
+		result->wall_us = wall_clock_us() - wall;
+		result->cpu_us  = cpu_time_us() - cpu;
+		for (i = 0; i < count; ++i) {
+			result->bytes += per_device[i].bytes;
+		}
+	}
+
+	uvcc_destroy_event_loop(loop);
+	for (i = 0; i < count; ++i) {
+		uvcc_stop_capture(handles[i]);
+		uvcc_close_video_device(handles[i]);
+	}
+
+	*device_count = count;
+
+	return ret;
+}
+
+static void print_result(char const *name, bench_result_t const *result) {
+	double const secs = result->wall_us / 1000000.0;
+
+	assert(NULL != result);
+
+	if ((0 == result->frames) || (0 == result->wall_us)) {
+		LOGI("%-20s: no frames captured\n", name);
+		return;
+	}
+
+	LOGI("%-20s: %u frames, %.2f fps, %.2f MB/s, %.1f us cpu/frame\n",
+		name,
+		result->frames,
+		result->frames / secs,
+		result->bytes / secs / (1024.0 * 1024.0),
+		(double)result->cpu_us / result->frames);
+}
+
+static int bench_suite(bench_args_t const *args) {
+	suite_result_t result;
+	int format;
+	int ret;
+
+	assert(NULL != args);
+
+	printf("{\n");
+	printf("  \"device\": ");
+	print_json_string(args->device);
+	printf(",\n");
+	printf("  \"width\": %d,\n", args->cap_width);
+	printf("  \"height\": %d,\n", args->cap_height);
+	printf("  \"count\": %d,\n", args->cap_count);
+	printf("  \"buffers\": %d,\n", args->buffer_count);
+	printf("  \"results\": [\n");
+
+	for (format = 0; format < UVCC_PIX_FMT_COUNT; ++format) {
+		memset(&result, 0, sizeof(result));
+		ret = bench_format(args, format, &result);
+		if ((NOERROR != ret) && result.supported) {
+			LOGE("benchmark of %s failed (%d).\n", PIXEL_FORMAT_NAMES[format], ret);
+		}
+		print_json_result(format, &result);
+		printf("%s\n", (format + 1 < UVCC_PIX_FMT_COUNT) ? "," : "");
+	}
+
+	printf("  ]\n");
+	printf("}\n");
+
+	return NOERROR;
+}
+
+static int bench_format(bench_args_t const *args, int format, suite_result_t *result) {
+	uvcc_handle_t handle;
+	uvcc_frame_t frame;
+	uint64_t start, now, cpu;
+	uint8_t *buf = NULL;
+	int ret;
+	int i;
+
+	assert(NULL != args);
+	assert(NULL != result);
+
+	start = wall_clock_us();
+	ret = uvcc_open_video_device(&handle, args->device);
+	if (NOERROR != ret) {
+		return ret;
+	}
+	ret = uvcc_init_video_device(handle, args->cap_width, args->cap_height, format, args->buffer_count);
+	result->open_us = wall_clock_us() - start;
+	if (NOERROR != ret) {
+		uvcc_close_video_device(handle);
+		return ret;
+	}
+	// drivers fall back to another format instead of failing.
+	if (format != (int)uvcc_get_pixel_format(handle)) {
+		uvcc_close_video_device(handle);
+		return INVALID_FORMAT_ARGUMENTS;
+	}
+	result->supported  = 1;
+	result->width      = uvcc_get_frame_width(handle);
+	result->height     = uvcc_get_frame_height(handle);
+	result->frame_size = uvcc_get_frame_size(handle);
+
+	buf = malloc(result->frame_size);
+	if (NULL == buf) {
+		uvcc_close_video_device(handle);
+		return INSUFFICIENT_MEMORY;
+	}
+
+	start = wall_clock_us();
+	ret = uvcc_start_capture(handle);
+	if (NOERROR == ret) {
+		ret = uvcc_acquire_frame_timeout(handle, &frame, 5000);
+	}
+	if (NOERROR == ret) {
+		result->first_frame_us = wall_clock_us() - start;
+		ret = uvcc_release_frame(handle, &frame);
+	}
+
+	// the first frame is left out of the sustained numbers.
+	uvcc_reset_stats(handle);
+	start = wall_clock_us();
+	cpu   = cpu_time_us();
+	for (i = 0; (NOERROR == ret) && (i < args->cap_count); ++i) {
+		ret = uvcc_acquire_frame_timeout(handle, &frame, 5000);
+		if (NOERROR != ret) {
+			break;
+		}
+		now = wall_clock_us();
+		memcpy(buf, frame.data, frame.size);
+		result->copy_us += wall_clock_us() - now;
+		result->run.bytes += frame.size;
+		++result->run.frames;
+		ret = uvcc_release_frame(handle, &frame);
+	}
+	result->run.wall_us = wall_clock_us() - start;
+	result->run.cpu_us  = cpu_time_us() - cpu;
+	uvcc_get_stats(handle, &result->stats);
+
+	free(buf);
+	uvcc_stop_capture(handle);
+	uvcc_close_video_device(handle);
+
+	return ret;
+}
+
+/* Planes of a frame in 'format' packed back to back at 'data'; returns the bytes they take. */
+static uint32_t pack_planes(uint8_t *data, uint32_t format, uint32_t width, uint32_t height, uvcc_planes_t *planes) {
+	uint32_t const chroma_width  = (width + 1) / 2;
+	uint32_t const chroma_height = (height + 1) / 2;
+
+	memset(planes, 0, sizeof(*planes));
+	planes->data[0] = data;
+	switch (format) {
+	case UVCC_PIX_FMT_YUV420:
+		planes->stride[0] = width;
+		planes->data[1]   = data + width * height;
+		planes->stride[1] = chroma_width;
+		planes->data[2]   = data + width * height + chroma_width * chroma_height;
+		planes->stride[2] = chroma_width;
+		return width * height + chroma_width * chroma_height * 2;
+	case UVCC_PIX_FMT_NV12:
+	case UVCC_PIX_FMT_NV21:
+		planes->stride[0] = width;
+		planes->data[1]   = data + width * height;
+		planes->stride[1] = chroma_width * 2;
+		return width * height + chroma_width * chroma_height * 2;
+	case UVCC_PIX_FMT_RGB32:
+	case UVCC_PIX_FMT_BGR32:
+		planes->stride[0] = width * 4;
+		return width * 4 * height;
+	default:
+		planes->stride[0] = width * 2;
+		return width * 2 * height;
+	}
+}
+
+static int convert_frame(uint8_t const *src, uint32_t src_format, uint8_t *dst, uint32_t dst_format, uint32_t width, uint32_t height) {
+	uvcc_planes_t planes;
+
+	switch (dst_format) {
+	case UVCC_PIX_FMT_RGB565:
+		return uvcc_convert_to_rgb(src, width * 2, src_format, dst, width * 2, dst_format, width, height, UVCC_COLOR_BT601_LIMITED);
+	case UVCC_PIX_FMT_RGB32:
+	case UVCC_PIX_FMT_BGR32:
+		return uvcc_convert_to_rgb(src, width * 2, src_format, dst, width * 4, dst_format, width, height, UVCC_COLOR_BT601_LIMITED);
+	default:
+		pack_planes(dst, dst_format, width, height, &planes);
+		return uvcc_convert_to_yuv420(src, width * 2, src_format, &planes, dst_format, width, height);
+	}
+}
+
+static int bench_convert(bench_args_t const *args) {
+	static int const DST_FORMATS[] = {
+		UVCC_PIX_FMT_RGB565, UVCC_PIX_FMT_RGB32, UVCC_PIX_FMT_BGR32,
+		UVCC_PIX_FMT_YUV420, UVCC_PIX_FMT_NV12, UVCC_PIX_FMT_NV21,
+	};
+	int const format_count = sizeof(DST_FORMATS) / sizeof(DST_FORMATS[0]);
+	uint32_t const width  = args->cap_width & ~1;
+	uint32_t const height = args->cap_height;
+	uint32_t const src_format = (UVCC_PIX_FMT_UYVY == args->pixel_format) ? UVCC_PIX_FMT_UYVY : UVCC_PIX_FMT_YUYV;
+	uint64_t scalar_us[sizeof(DST_FORMATS) / sizeof(DST_FORMATS[0])];
+	uint64_t start, elapsed;
+	uint8_t *src, *dst, *ref;
+	uint32_t level;
+	uint32_t i;
+	int f, n;
+	int ret = NOERROR;
+
+	src = malloc(width * 2 * height);
+	dst = malloc(width * 4 * height);
+	ref = malloc(width * 4 * height);
+	if ((NULL == src) || (NULL == dst) || (NULL == ref)) {
+		LOGE("memory allocation failed.\n");
+		free(src);
+		free(dst);
+		free(ref);
+		return INSUFFICIENT_MEMORY;
+	}
+	// every YUV combination appears, so that saturation is exercised too.
+	for (i = 0; i < width * 2 * height; ++i) {
+		src[i] = (uint8_t)(i * 2654435761u >> 13);
+	}
+
+	LOGI("%ux%u %s, %d frames per run\n", width, height, PIXEL_FORMAT_NAMES[src_format], args->cap_count);
+	for (level = UVCC_SIMD_NONE; NULL != SIMD_LEVEL_NAMES[level]; ++level) {
+		if (level != uvcc_set_simd_level(level)) {
+			continue;
+		}
+		for (f = 0; f < format_count; ++f) {
+			memset(dst, 0, width * 4 * height);
+			start = wall_clock_us();
+			for (n = 0; n < args->cap_count; ++n) {
+				ret = convert_frame(src, src_format, dst, DST_FORMATS[f], width, height);
+				if (NOERROR != ret) {
+					break;
+				}
+			}
+			elapsed = wall_clock_us() - start;
+			if (NOERROR != ret) {
+				break;
+			}
+			if (0 == elapsed) {
+				elapsed = 1;
+			}
+
+			if (UVCC_SIMD_NONE == level) {
+				scalar_us[f] = elapsed;
+				LOGI("%-6s -> %-7s: %8.1f Mpixel/s\n", SIMD_LEVEL_NAMES[level], PIXEL_FORMAT_NAMES[DST_FORMATS[f]],
+					(double)width * height * args->cap_count / elapsed);
+				continue;
+			}
+			// the scalar result of the same format is the reference.
+			memset(ref, 0, width * 4 * height);
+			uvcc_set_simd_level(UVCC_SIMD_NONE);
+			convert_frame(src, src_format, ref, DST_FORMATS[f], width, height);
+			uvcc_set_simd_level(level);
+			LOGI("%-6s -> %-7s: %8.1f Mpixel/s, x%.2f%s\n", SIMD_LEVEL_NAMES[level], PIXEL_FORMAT_NAMES[DST_FORMATS[f]],
+				(double)width * height * args->cap_count / elapsed,
+				(double)scalar_us[f] / elapsed,
+				(0 == memcmp(dst, ref, width * 4 * height)) ? "" : " (differs from scalar)");
+		}
+	}
+	uvcc_set_simd_level(UINT32_MAX);
+	if (NOERROR == ret) {
+		ret = check_window_copy(args, BENCH_MODE_CONVERT);
+	}
+
+	free(src);
+	free(dst);
+	free(ref);
+
+	return ret;
+}
+
+static int bench_threads(bench_args_t const *args) {
+	static int const DST_FORMATS[] = { UVCC_PIX_FMT_RGB32, UVCC_PIX_FMT_NV12 };
+	int const format_count = sizeof(DST_FORMATS) / sizeof(DST_FORMATS[0]);
+	uint32_t const width  = args->cap_width & ~1;
+	uint32_t const height = args->cap_height;
+	uint32_t const src_format = (UVCC_PIX_FMT_UYVY == args->pixel_format) ? UVCC_PIX_FMT_UYVY : UVCC_PIX_FMT_YUYV;
+	uint32_t const max_threads = uvcc_set_thread_count((0 < args->max_threads) ? args->max_threads : 0);
+	double single[sizeof(DST_FORMATS) / sizeof(DST_FORMATS[0])];
+	double fps;
+	uint64_t start, elapsed;
+	uint8_t *src, *dst;
+	uint32_t threads;
+	uint32_t i;
+	int f, n;
+	int ret = NOERROR;
+
+	src = malloc(width * 2 * height);
+	dst = malloc(width * 4 * height);
+	if ((NULL == src) || (NULL == dst)) {
+		LOGE("memory allocation failed.\n");
+		free(src);
+		free(dst);
+		return INSUFFICIENT_MEMORY;
+	}
+	for (i = 0; i < width * 2 * height; ++i) {
+		src[i] = (uint8_t)(i * 2654435761u >> 13);
+	}
+
+	LOGI("%ux%u %s, %d frames per run, %s kernels\n", width, height, PIXEL_FORMAT_NAMES[src_format], args->cap_count,
+		SIMD_LEVEL_NAMES[uvcc_get_simd_level()]);
+	LOGI("threads");
+	for (f = 0; f < format_count; ++f) {
+		LOGI(" %16s", PIXEL_FORMAT_NAMES[DST_FORMATS[f]]);
+	}
+	LOGI("\n");
+
+	for (threads = 1; (NOERROR == ret) && (threads <= max_threads); ++threads) {
+		uvcc_set_thread_count(threads);
+		LOGI("%7u", threads);
+		for (f = 0; f < format_count; ++f) {
+			// once untimed, so that workers and pages are warm.
+			convert_frame(src, src_format, dst, DST_FORMATS[f], width, height);
+			start = wall_clock_us();
+			for (n = 0; n < args->cap_count; ++n) {
+				ret = convert_frame(src, src_format, dst, DST_FORMATS[f], width, height);
+				if (NOERROR != ret) {
+					break;
+				}
+			}
+			elapsed = wall_clock_us() - start;
+			fps = args->cap_count * 1000000.0 / ((0 < elapsed) ? elapsed : 1);
+			if (1 == threads) {
+				single[f] = fps;
+			}
+			LOGI(" %8.1f fps x%-4.2f", fps, fps / single[f]);
+		}
+		LOGI("\n");
+	}
+	uvcc_set_thread_count(1);
+
+	free(src);
+	free(dst);
+
+	return ret;
+}
+
+static int bench_scale(bench_args_t const *args) {
+	static int const FORMATS[] = { UVCC_PIX_FMT_YUYV, UVCC_PIX_FMT_YUV420, UVCC_PIX_FMT_NV12, UVCC_PIX_FMT_RGB32 };
+	static uint32_t const RATIOS[][2] = { { 1, 2 }, { 1, 4 }, { 3, 8 } };
+	static char const *FILTER_NAMES[] = { "box", "bilinear" };
+	int const format_count = sizeof(FORMATS) / sizeof(FORMATS[0]);
+	int const ratio_count  = sizeof(RATIOS) / sizeof(RATIOS[0]);
+	// a quarter of a YUYV row has to stay even.
+	uint32_t const width  = args->cap_width & ~7;
+	uint32_t const height = args->cap_height & ~3;
+	uvcc_planes_t src_planes, dst_planes, ref_planes;
+	uint32_t dst_width, dst_height, dst_size;
+	uint64_t scalar_us = 1;
+	uint64_t start, elapsed;
+	uint8_t *src, *dst, *ref;
+	uint32_t level, filter;
+	uint32_t i;
+	int f, r, n;
+	int ret = NOERROR;
+
+	src = malloc(width * 4 * height);
+	dst = malloc(width * 4 * height);
+	ref = malloc(width * 4 * height);
+	if ((NULL == src) || (NULL == dst) || (NULL == ref)) {
+		LOGE("memory allocation failed.\n");
+		free(src);
+		free(dst);
+		free(ref);
+		return INSUFFICIENT_MEMORY;
+	}
+	for (i = 0; i < width * 4 * height; ++i) {
+		src[i] = (uint8_t)(i * 2654435761u >> 13);
+	}
+
+	LOGI("%ux%u, %d frames per run\n", width, height, args->cap_count);
+	for (f = 0; (NOERROR == ret) && (f < format_count); ++f) {
+		pack_planes(src, FORMATS[f], width, height, &src_planes);
+		for (r = 0; (NOERROR == ret) && (r < ratio_count); ++r) {
+			dst_width  = (width * RATIOS[r][0] / RATIOS[r][1]) & ~1;
+			dst_height = height * RATIOS[r][0] / RATIOS[r][1];
+			dst_size   = pack_planes(dst, FORMATS[f], dst_width, dst_height, &dst_planes);
+			pack_planes(ref, FORMATS[f], dst_width, dst_height, &ref_planes);
+			for (filter = 0; filter < UVCC_SCALE_FILTER_COUNT; ++filter) {
+				for (level = UVCC_SIMD_NONE; NULL != SIMD_LEVEL_NAMES[level]; ++level) {
+					if (level != uvcc_set_simd_level(level)) {
+						continue;
+					}
+					memset(dst, 0, dst_size);
+					start = wall_clock_us();
+					for (n = 0; n < args->cap_count; ++n) {
+						ret = uvcc_scale(&src_planes, width, height, &dst_planes, dst_width, dst_height, FORMATS[f], filter);
+						if (NOERROR != ret) {
+							break;
+						}
+					}
+					elapsed = wall_clock_us() - start;
+					if (NOERROR != ret) {
+						LOGE("failed to scale %s (%d).\n", PIXEL_FORMAT_NAMES[FORMATS[f]], ret);
+						break;
+					}
+					if (0 == elapsed) {
+						elapsed = 1;
+					}
+
+					LOGI("%-6s %u/%u %-8s %-6s: %8.1f Mpixel/s", PIXEL_FORMAT_NAMES[FORMATS[f]], RATIOS[r][0], RATIOS[r][1],
+						FILTER_NAMES[filter], SIMD_LEVEL_NAMES[level], (double)width * height * args->cap_count / elapsed);
+					if (UVCC_SIMD_NONE == level) {
+						scalar_us = elapsed;
+						memcpy(ref, dst, dst_size);
+						LOGI("\n");
+						continue;
+					}
+					LOGI(", x%.2f%s\n", (double)scalar_us / elapsed, (0 == memcmp(dst, ref, dst_size)) ? "" : " (differs from scalar)");
+				}
+			}
+		}
+	}
+	uvcc_set_simd_level(UINT32_MAX);
+	if (NOERROR == ret) {
+		ret = check_window_copy(args, BENCH_MODE_SCALE);
+	}
+
+	free(src);
+	free(dst);
+	free(ref);
+
+	return ret;
+}
+
+/*
+ * Frames copied out of a capture window are packed and smaller than the
+ * device frames; the frame helpers have to follow their layout. The
+ * emulated device does not crop, so the window is always copied.
+ */
+static int check_window_copy(bench_args_t const *args, int mode) {
+	uint32_t const width  = args->cap_width & ~7;
+	uint32_t const height = args->cap_height & ~7;
+	uvcc_rect_t const window = { width / 4, height / 4, width / 2, height / 2 };
+	uvcc_handle_t handle;
+	uvcc_frame_t frame;
+	uvcc_planes_t src_planes, dst_planes, ref_planes;
+	uint32_t size;
+	uint8_t *buf = NULL, *dst = NULL, *ref = NULL;
+	int ret;
+
+	ret = uvcc_open_video_device(&handle, "fake:fps=0");
+	if (NOERROR != ret) {
+		return ret;
+	}
+	ret = uvcc_set_capture_window(handle, &window);
+	if (NOERROR == ret) {
+		ret = uvcc_init_video_device(handle, width, height, UVCC_PIX_FMT_YUYV, DEF_BUFFER_COUNT);
+	}
+	if ((NOERROR == ret) && (UVCC_WINDOW_COPY != uvcc_get_capture_window(handle, NULL))) {
+		ret = INVALID_STATUS;
+	}
+	if (NOERROR == ret) {
+		size = uvcc_get_frame_size(handle);
+		buf  = malloc(size);
+		dst  = malloc(window.width * 4 * window.height);
+		ref  = malloc(window.width * 4 * window.height);
+		ret  = ((NULL == buf) || (NULL == dst) || (NULL == ref)) ? INSUFFICIENT_MEMORY : uvcc_start_capture(handle);
+	}
+	if (NOERROR == ret) {
+		ret = uvcc_capture(handle, buf, size, &frame);
+		uvcc_stop_capture(handle);
+	}
+
+	// the packed window is the reference.
+	if ((NOERROR == ret) && (BENCH_MODE_CONVERT == mode)) {
+		ret = uvcc_convert_frame_to_rgb(handle, &frame, dst, window.width * 4, UVCC_PIX_FMT_RGB32, UVCC_COLOR_BT601_LIMITED);
+		if (NOERROR == ret) {
+			ret = uvcc_convert_to_rgb(buf, window.width * 2, UVCC_PIX_FMT_YUYV, ref, window.width * 4, UVCC_PIX_FMT_RGB32,
+				window.width, window.height, UVCC_COLOR_BT601_LIMITED);
+		}
+		size = window.width * 4 * window.height;
+	} else if (NOERROR == ret) {
+		size = pack_planes(dst, UVCC_PIX_FMT_YUYV, window.width / 2, window.height / 2, &dst_planes);
+		pack_planes(ref, UVCC_PIX_FMT_YUYV, window.width / 2, window.height / 2, &ref_planes);
+		pack_planes(buf, UVCC_PIX_FMT_YUYV, window.width, window.height, &src_planes);
+		ret = uvcc_scale_frame(handle, &frame, &dst_planes, window.width / 2, window.height / 2, UVCC_SCALE_BOX);
+		if (NOERROR == ret) {
+			ret = uvcc_scale(&src_planes, window.width, window.height, &ref_planes, window.width / 2, window.height / 2,
+				UVCC_PIX_FMT_YUYV, UVCC_SCALE_BOX);
+		}
+	}
+	if (NOERROR == ret) {
+		LOGI("window copy %ux%u of %ux%u: %s\n", window.width, window.height, width, height,
+			(0 == memcmp(dst, ref, size)) ? "matches the packed window" : "differs from the packed window");
+	} else {
+		LOGE("window copy check failed (%d).\n", ret);
+	}
+
+	uvcc_close_video_device(handle);
+	free(buf);
+	free(dst);
+	free(ref);
+
+	return ret;
+}
+
+static void print_json_string(char const *str) {
+	putchar('"');
+	for (; '\0' != *str; ++str) {
+		if (('"' == *str) || ('\\' == *str)) {
+			putchar('\\');
+		}
+		putchar(*str);
+	}
+	putchar('"');
+}
+
+static void print_json_result(int format, suite_result_t const *result) {
+	double const secs = result->run.wall_us / 1000000.0;
+	uvcc_histogram_t const *dequeue = &result->stats.latency[UVCC_STAT_DEQUEUE];
+	uvcc_histogram_t const *wait    = &result->stats.latency[UVCC_STAT_WAIT];
+
+	printf("    {\"format\": \"%s\", \"supported\": %s", PIXEL_FORMAT_NAMES[format], result->supported ? "true" : "false");
+	if (!result->supported) {
+		printf("}");
+		return;
+	}
+
+	printf(", \"width\": %u, \"height\": %u, \"frame_size\": %u,\n", result->width, result->height, result->frame_size);
+	printf("     \"open_us\": %llu, \"first_frame_us\": %llu,\n",
+		(unsigned long long)result->open_us, (unsigned long long)result->first_frame_us);
+	printf("     \"frames\": %u, \"dropped\": %u, \"fps\": %.2f, \"cpu_us_per_frame\": %.1f, \"copy_mb_per_s\": %.1f,\n",
+		result->run.frames,
+		result->stats.dropped,
+		(0 < secs) ? result->run.frames / secs : 0.0,
+		(0 < result->run.frames) ? (double)result->run.cpu_us / result->run.frames : 0.0,
+		(0 < result->copy_us) ? result->run.bytes / (result->copy_us / 1000000.0) / (1024.0 * 1024.0) : 0.0);
+	printf("     \"dequeue_us\": {\"p50\": %u, \"p99\": %u, \"max\": %u}, \"wait_us\": {\"p50\": %u, \"p99\": %u, \"max\": %u}}",
+		uvcc_histogram_percentile(dequeue, 50.0), uvcc_histogram_percentile(dequeue, 99.0), dequeue->max,
+		uvcc_histogram_percentile(wait, 50.0), uvcc_histogram_percentile(wait, 99.0), wait->max);
+}
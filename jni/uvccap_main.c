@@ -5,14 +5,21 @@
 #include <errno.h>
 #include <assert.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#ifdef __ANDROID__
 #include <linux/videodev.h>
+#else
+#include <linux/videodev2.h>
+#endif
 #include "uvccap.h"
+#include "uvccap_writer.h"
 
 #define LOGE(fmt, ...) fprintf(stderr, "Error: " fmt, ##__VA_ARGS__)
-#define LOGD(fmt, ...) fprintf(stdout, "Debug: " fmt, ##__VA_ARGS__)
-#define LOGI(fmt, ...) fprintf(stdout,           fmt, ##__VA_ARGS__)
+#define LOGD(fmt, ...) fprintf(log_out, "Debug: " fmt, ##__VA_ARGS__)
+#define LOGI(fmt, ...) fprintf(log_out,           fmt, ##__VA_ARGS__)
 
 /* Data structure and constant values */
 #define DEF_VIDEO_DEVICE   "/dev/video0"
@@ -21,6 +28,16 @@
 #define DEF_PIXEL_FORMAT     3
 #define DEF_CAPTURE_PREFIX "video.cap"
 #define DEF_CAPTURE_COUNT    1
+#define DEF_BUFFER_COUNT     4
+#define DEF_QUEUE_SIZE       4
+#define DEF_SEGMENT_MBYTES 256
+#define DEF_FRAME_RATE      30 // for streams from drivers not telling theirs.
+
+enum OUTPUT_KINDS {
+	OUTPUT_FILES = 0, // one file per frame.
+	OUTPUT_SEGMENTS,  // segmented recording.
+	OUTPUT_Y4M,       // YUV4MPEG2 stream.
+};
 
 typedef struct app_args_t_ {
 	char *device;
@@ -29,6 +46,19 @@ typedef struct app_args_t_ {
 	int   pixel_format;
 	char *cap_prefix;
 	int   cap_count;
+	int   buffer_count;
+	int   adaptive_max;
+	int   ring_size;
+	int   overflow_policy;
+	int   show_stats;
+	int   queue_size;
+	int   has_window;
+	uvcc_rect_t window;
+	int   output;
+	int   segment_mbytes;
+	int   segment_seconds;
+	int   use_io_uring;
+	int   use_direct_io;
 } app_args_t;
 
 static char const *PIXEL_FORMAT_NAMES[] = {
@@ -40,23 +70,61 @@ static char const *PIXEL_FORMAT_NAMES[] = {
 	"YUV420",
 	"YUV410",
 	"YUV422P",
+	"NV12",
+	"NV21",
 	NULL // sentinel
 };
 
+static char const *OUTPUT_NAMES[] = {
+	"files",
+	"segments",
+	"y4m",
+	NULL // sentinel
+};
+
+static char const *STAT_STAGE_NAMES[UVCC_STAT_COUNT] = {
+	"driver->dqbuf",
+	"dqbuf->release",
+	"release->qbuf",
+	"caller wait",
+};
+
+// stderr while frames are streamed to stdout.
+static FILE *log_out;
+
 /* Internal APIs */
 static int do_capture(uvcc_handle_t handle, app_args_t const *args);
-static int write_frame(uvcc_handle_t handle, app_args_t const *args, void const *buf, uint32_t size, int index);
+static int open_sink(uvcc_handle_t handle, app_args_t const *args, writer_sink_t *sink);
+static int write_frame(void *ctx, uvcc_frame_t const *frame, uint32_t index);
+static void print_stats(uvcc_handle_t handle);
+static void print_writer_stats(writer_stats_t const *stats, int queue_size);
 
 static void usage() {
 	int i;
 	printf("Usage: uvccap [options]\n");
 	printf("[Option]\n");
 	printf("  -d device    : path to video device.\n");
+	printf("                 'fake:fps=N,jitter=us,drop=permille,seed=N' emulates a device.\n");
 	printf("  -w width     : width of capture image.\n");
 	printf("  -h height    : height of capture image.\n");
 	printf("  -f format    : pixel format of capture image (default: %d).\n", DEF_PIXEL_FORMAT);
-	printf("  -p prefix    : prefix of saved file name (default: %s).\n", DEF_CAPTURE_PREFIX);
+	printf("  -p prefix    : prefix of saved file name, or the stream of '-O y4m' ('-' for stdout)\n");
+	printf("                 (default: %s).\n", DEF_CAPTURE_PREFIX);
 	printf("  -n count     : count of capture frames (default: %d).\n", DEF_CAPTURE_COUNT);
+	printf("  -b count     : count of video buffers (default: %d).\n", DEF_BUFFER_COUNT);
+	printf("  -a max       : grow video buffers up to 'max' when frames are dropped.\n");
+	printf("  -t size      : capture on a background thread with a ring of 'size' frames.\n");
+	printf("  -o policy    : ring overflow policy (0: drop oldest, 1: drop newest, 2: block).\n");
+	printf("  -s           : print frame counters and latency of every capture stage.\n");
+	printf("  -q count     : frames queued to the writer thread, 0 writes synchronously (default: %d).\n", DEF_QUEUE_SIZE);
+	printf("  -r l,t,w,h   : capture only the window of 'w'x'h' pixels at ('l', 't').\n");
+	printf("  -O output    : 'files' writes prefix.N per frame, 'segments' records into\n");
+	printf("                 prefix.idx and preallocated prefix.sNNN, 'y4m' streams YUV4MPEG2\n");
+	printf("                 to a file, FIFO or stdout (default: files).\n");
+	printf("  -S mbytes    : size of a segment (default: %d).\n", DEF_SEGMENT_MBYTES);
+	printf("  -D seconds   : longest time span of a segment (default: no limit).\n");
+	printf("  -U           : write segments through io_uring when the kernel has it.\n");
+	printf("  -I           : write segments with O_DIRECT, bypassing the page cache.\n");
 	printf("\n");
 	printf("[Pixel format]\n");
 	for (i = 0; NULL != PIXEL_FORMAT_NAMES[i]; ++i) {
@@ -73,7 +141,7 @@ static int parse_args(int argc, char **argv, app_args_t *args) {
 		return 0;
 	}
 
-	while((opt = getopt(argc, argv, "d:w:h:f:p:n:")) != -1) {
+	while((opt = getopt(argc, argv, "d:w:h:f:p:n:b:a:t:o:sq:r:O:S:D:UI")) != -1) {
 		switch(opt) {
 		case 'd':
 			if (NULL == optarg || '\0' == *optarg) {
@@ -101,6 +169,70 @@ static int parse_args(int argc, char **argv, app_args_t *args) {
 		case 'n':
 			args->cap_count = atoi(optarg);
 			break;
+		case 'b':
+			args->buffer_count = atoi(optarg);
+			if (args->buffer_count < 2) {
+				LOGE("buffer count (%d) is too small.\n", args->buffer_count);
+				return -1;
+			}
+			break;
+		case 'a':
+			args->adaptive_max = atoi(optarg);
+			break;
+		case 't':
+			args->ring_size = atoi(optarg);
+			break;
+		case 'o':
+			args->overflow_policy = atoi(optarg);
+			if ((args->overflow_policy < UVCC_OVERFLOW_DROP_OLDEST) || (args->overflow_policy > UVCC_OVERFLOW_BLOCK)) {
+				LOGE("overflow policy (%d) is not supported.\n", args->overflow_policy);
+				return -1;
+			}
+			break;
+		case 's':
+			args->show_stats = 1;
+			break;
+		case 'q':
+			args->queue_size = atoi(optarg);
+			if (args->queue_size < 0) {
+				LOGE("writer queue size (%d) is invalid.\n", args->queue_size);
+				return -1;
+			}
+			break;
+		case 'r':
+			if (4 != sscanf(optarg, "%u,%u,%u,%u", &args->window.left, &args->window.top, &args->window.width, &args->window.height)) {
+				LOGE("invalid capture window (%s).\n", optarg);
+				return -1;
+			}
+			args->has_window = 1;
+			break;
+		case 'O':
+			for (args->output = 0; NULL != OUTPUT_NAMES[args->output]; ++args->output) {
+				if (0 == strcmp(optarg, OUTPUT_NAMES[args->output])) {
+					break;
+				}
+			}
+			if (NULL == OUTPUT_NAMES[args->output]) {
+				LOGE("output (%s) is not supported.\n", optarg);
+				return -1;
+			}
+			break;
+		case 'S':
+			args->segment_mbytes = atoi(optarg);
+			if (args->segment_mbytes <= 0) {
+				LOGE("segment size (%d) is invalid.\n", args->segment_mbytes);
+				return -1;
+			}
+			break;
+		case 'D':
+			args->segment_seconds = atoi(optarg);
+			break;
+		case 'U':
+			args->use_io_uring = 1;
+			break;
+		case 'I':
+			args->use_direct_io = 1;
+			break;
 		}
 	}
 	return 0;
@@ -114,6 +246,19 @@ int main(int argc, char **argv) {
 		DEF_PIXEL_FORMAT,
 		DEF_CAPTURE_PREFIX,
 		DEF_CAPTURE_COUNT,
+		DEF_BUFFER_COUNT,
+		0,
+		0,
+		UVCC_OVERFLOW_DROP_OLDEST,
+		0,
+		DEF_QUEUE_SIZE,
+		0,
+		{ 0, 0, 0, 0 },
+		OUTPUT_FILES,
+		DEF_SEGMENT_MBYTES,
+		0,
+		0,
+		0,
 	};
 	uvcc_handle_t handle;
 
@@ -121,6 +266,11 @@ int main(int argc, char **argv) {
 		LOGE("failed to parse arguments.\n");
 		return INVALID_ARGUMENTS;
 	}
+	log_out = ((OUTPUT_Y4M == args.output) && (0 == strcmp(args.cap_prefix, "-"))) ? stderr : stdout;
+	if (OUTPUT_Y4M == args.output) {
+		// a reader going away fails the writes with EPIPE and capture shuts down as usual.
+		signal(SIGPIPE, SIG_IGN);
+	}
 
 	int ret = uvcc_open_video_device(&handle, args.device);
 	if (NOERROR != ret) {
@@ -128,7 +278,25 @@ int main(int argc, char **argv) {
 		return ret;
 	}
 
-	ret = uvcc_init_video_device(handle, args.cap_width, args.cap_height, args.pixel_format);
+	if (0 < args.adaptive_max) {
+		ret = uvcc_set_adaptive_buffering(handle, args.buffer_count, args.adaptive_max);
+		if (NOERROR != ret) {
+			LOGE("invalid adaptive buffer range.\n");
+			uvcc_close_video_device(handle);
+			return ret;
+		}
+	}
+
+	if (args.has_window) {
+		ret = uvcc_set_capture_window(handle, &args.window);
+		if (NOERROR != ret) {
+			LOGE("invalid capture window.\n");
+			uvcc_close_video_device(handle);
+			return ret;
+		}
+	}
+
+	ret = uvcc_init_video_device(handle, args.cap_width, args.cap_height, args.pixel_format, args.buffer_count);
 	if (NOERROR == ret) {
 		ret = do_capture(handle, &args);
 	} else {
@@ -144,54 +312,181 @@ static int do_capture(uvcc_handle_t handle, app_args_t const *args) {
 	int result;
 	int count;
 	int i;
-	uint32_t size;
-	void *buf;
+	uvcc_frame_t frame;
+	uvcc_frame_layout_t layout;
+	uvcc_rect_t window;
+	uint32_t window_mode;
+	writer_sink_t sink;
+	writer_t *writer = NULL;
+	writer_stats_t writer_stats;
+	uint8_t *buf = NULL;
+	uint32_t buf_size;
+	int close_result;
+	int close_errno;
+	int failed_errno = 0;
 
 	assert(NULL != args);
-	assert(NULL != dev);
+	assert(NULL != handle);
 
-	result = uvcc_start_capture(handle);
+	window_mode = uvcc_get_capture_window(handle, &window);
+	if (UVCC_WINDOW_NONE != window_mode) {
+		LOGI("capture window: %ux%u at (%u, %u)%s\n", window.width, window.height, window.left, window.top,
+			(UVCC_WINDOW_DEVICE == window_mode) ? " cropped by the driver" : "");
+	}
+
+	result = uvcc_get_frame_layout(handle, &layout);
+	if (NOERROR != result) {
+		return result;
+	}
+	result = open_sink(handle, args, &sink);
 	if (NOERROR != result) {
-		LOGE("colud not start capture.\n");
 		return result;
 	}
+	if (0 < args->queue_size) {
+		// the window is never larger than the frame.
+		result = writer_create(&writer, &sink, args->queue_size, layout.size);
+		if (NOERROR != result) {
+			LOGE("could not start writer thread.\n");
+		}
+	} else if (UVCC_WINDOW_COPY == window_mode) {
+		buf = (uint8_t*)malloc(layout.size);
+		if (NULL == buf) {
+			result = INSUFFICIENT_MEMORY;
+		}
+	}
+	if ((NOERROR == result) && (OUTPUT_SEGMENTS == args->output)) {
+		LOGI("record - %s.idx (%s)\n", args->cap_prefix, sink.engine);
+	} else if ((NOERROR == result) && (OUTPUT_Y4M == args->output)) {
+		LOGI("stream - %s (%s)\n", args->cap_prefix, sink.engine);
+	}
 
-	size = uvcc_get_frame_size(handle);
-	if (size == -1) {
-		LOGE("colud not get frame size.\n");
-		uvcc_stop_capture(handle);
-		return INVALID_STATUS;
+	if (NOERROR == result) {
+		result = uvcc_start_capture(handle);
+		if (NOERROR != result) {
+			LOGE("colud not start capture.\n");
+		}
 	}
 
-	buf = malloc(size);
-	if (NULL == buf) {
-		LOGE("memory allocation failed.\n");
-		uvcc_stop_capture(handle);
-		return INSUFFICIENT_MEMORY;
+	if ((NOERROR == result) && (0 < args->ring_size)) {
+		result = uvcc_start_capture_thread(handle, args->ring_size, args->overflow_policy);
+		if (NOERROR != result) {
+			LOGE("colud not start capture thread.\n");
+			uvcc_stop_capture(handle);
+		}
 	}
 
 	// capture!
-	count = args->cap_count;
+	count = (NOERROR == result) ? args->cap_count : 0;
 	for (i = 0; i < count; ) {
-		result = uvcc_capture(handle, buf, size);
-		if (NOERROR == result) {
-			result = write_frame(handle, args, buf, size, i);
+		if (NULL != writer) {
+			// uvcc_capture() copies the frame (or the window) and gives the video buffer back at once.
+			result = writer_get_buffer(writer, &buf, &buf_size);
+			if (NOERROR == result) {
+				result = uvcc_capture(handle, buf, buf_size, &frame);
+			}
+			if (NOERROR == result) {
+				result = writer_submit(writer, &frame, frame.size);
+			}
+		} else if (UVCC_WINDOW_COPY == window_mode) {
+			result = uvcc_capture(handle, buf, layout.size, &frame);
+			if (NOERROR == result) {
+				result = sink.write(sink.ctx, &frame, i);
+			}
+		} else {
+			result = uvcc_acquire_frame(handle, &frame);
+			if (NOERROR != result) {
+				break;
+			}
+			// write directly from the mapped video buffer.
+			result = sink.write(sink.ctx, &frame, i);
+			if (NOERROR == result) {
+				result = uvcc_release_frame(handle, &frame);
+			} else {
+				uvcc_release_frame(handle, &frame);
+			}
 		}
 		if (NOERROR != result) {
+			failed_errno = errno;
 			break;
 		}
+		if (0 != (UVCC_FRAME_FLAG_ERROR & frame.flags)) {
+			LOGI("frame %u is marked as corrupted.\n", frame.sequence);
+		}
 		++i;
 	}
 
-	free(buf);
-	buf = NULL;
+	if (0 < count) {
+		LOGI("dropped frames: %u\n", uvcc_get_dropped_frames(handle));
+		if (args->show_stats) {
+			print_stats(handle);
+		}
+
+		uvcc_stop_capture(handle);
+	}
+
+	if (NULL != writer) {
+		close_result = writer_close(writer, &writer_stats);
+		close_errno  = errno;
+		if (args->show_stats) {
+			print_writer_stats(&writer_stats, args->queue_size);
+		}
+	} else {
+		close_result = (NULL != sink.close) ? sink.close(sink.ctx) : NOERROR;
+		close_errno  = errno;
+		free(buf);
+	}
+	if (NOERROR == result) {
+		result       = close_result;
+		failed_errno = close_errno;
+	}
+	if ((NOERROR != result) && (OUTPUT_Y4M == args->output) && (EPIPE == failed_errno)) {
+		LOGE("reader closed the stream.\n");
+	} else if (NOERROR != result) {
+		LOGE("capture or writing failed (%d).\n", result);
+	}
+
+	return result;
+}
+
+static int open_sink(uvcc_handle_t handle, app_args_t const *args, writer_sink_t *sink) {
+	uint32_t rate_num;
+	uint32_t rate_den;
+	int result = NOERROR;
 
-	uvcc_stop_capture(handle);
+	memset(sink, 0, sizeof(*sink));
+	switch (args->output) {
+	case OUTPUT_SEGMENTS:
+		result = writer_open_segments(sink, args->cap_prefix, (uint64_t)args->segment_mbytes << 20, (uint64_t)args->segment_seconds * 1000000,
+			(args->use_io_uring ? WRITER_SEGMENTS_IO_URING : 0) | (args->use_direct_io ? WRITER_SEGMENTS_DIRECT : 0));
+		if (NOERROR != result) {
+			LOGE("failed to create recording (%s) (%s).\n", args->cap_prefix, strerror(errno));
+		}
+		break;
+	case OUTPUT_Y4M:
+		if (NOERROR != uvcc_get_frame_rate(handle, &rate_num, &rate_den)) {
+			LOGI("frame rate unknown, streaming at %d fps.\n", DEF_FRAME_RATE);
+			rate_num = DEF_FRAME_RATE;
+			rate_den = 1;
+		}
+		result = writer_open_y4m(sink, args->cap_prefix, uvcc_get_pixel_format(handle), rate_num, rate_den, uvcc_get_color_space(handle));
+		if (INVALID_FORMAT_ARGUMENTS == result) {
+			LOGE("pixel format (%d) cannot be streamed as YUV4MPEG2.\n", args->pixel_format);
+		} else if (NOERROR != result) {
+			LOGE("failed to open stream (%s) (%s).\n", args->cap_prefix, strerror(errno));
+		}
+		break;
+	default:
+		sink->ctx    = (void*)args;
+		sink->engine = "write";
+		sink->write  = write_frame;
+		break;
+	}
 
 	return result;
 }
 
-static int write_frame(uvcc_handle_t handle, app_args_t const *args, void const *buf, uint32_t size, int index) {
+static int write_frame(void *ctx, uvcc_frame_t const *frame, uint32_t index) {
+	app_args_t const *args = (app_args_t const*)ctx;
 	char path[4096];
 	int fd;
 	int result = NOERROR;
@@ -200,10 +495,10 @@ static int write_frame(uvcc_handle_t handle, app_args_t const *args, void const
 	int n;
 
 	assert(NULL != args);
-	assert(NULL != dev);
+	assert(NULL != frame);
 
 	// write captured data.
-	snprintf(path, sizeof(path), "%s.%d", args->cap_prefix, index);
+	snprintf(path, sizeof(path), "%s.%u", args->cap_prefix, index);
 	LOGI("dump - %s\n", path);
 	fd = open(path, O_WRONLY | O_CREAT, 0666);
 	if (0 > fd) {
@@ -215,19 +510,69 @@ static int write_frame(uvcc_handle_t handle, app_args_t const *args, void const
 			result = IO_FILE_NOT_CREATED;
 		}
 	} else {
-		ptr = (uint8_t const*)buf;
-		for (wrote = 0; wrote < size; ) {
-			n = write(fd, ptr + wrote, size - wrote);
-			if (n < 0) {
-				LOGE("failed to write file (%s).\n", strerror(errno));
+		ptr = (uint8_t const*)frame->data;
+		for (wrote = 0; wrote < frame->size; ) {
+			n = write(fd, ptr + wrote, frame->size - wrote);
+			if (0 > n) {
+				if (EINTR == errno) {
+					continue;
+				}
+				result = IO_ERROR;
+				break;
+			}
+			if (0 == n) {
+				// nothing written and no error, the file cannot grow.
+				errno  = ENOSPC;
+				result = IO_ERROR;
 				break;
 			}
 			wrote += n;
 		}
-		close(fd);
+		// delayed write errors surface on close.
+		if ((0 != close(fd)) && (NOERROR == result)) {
+			result = IO_ERROR;
+		}
+		if (NOERROR != result) {
+			// the caller sees errno of the failing call, not of the message.
+			n = errno;
+			LOGE("failed to write file (%s) (%s).\n", path, strerror(n));
+			errno = n;
+		}
 	}
 
 	return result;
 }
 
+static void print_writer_stats(writer_stats_t const *stats, int queue_size) {
+	double const seconds = (0 < stats->elapsed_us) ? stats->elapsed_us / 1e6 : 1.0;
+	double const busy    = (0 < stats->write_us) ? stats->write_us / 1e6 : 1.0;
+
+	LOGI("writer: %u frames, %llu bytes, queue high-water %u/%d, waited %llu us for buffers\n",
+		stats->frames, (unsigned long long)stats->bytes, stats->high_water, queue_size, (unsigned long long)stats->wait_us);
+	LOGI("writer: %.1f MB/s overall, %.1f MB/s while writing, busy %.1f%%\n",
+		stats->bytes / seconds / 1e6, stats->bytes / busy / 1e6, 100.0 * stats->write_us / (seconds * 1e6));
+}
+
+static void print_stats(uvcc_handle_t handle) {
+	uvcc_stats_t stats;
+	uvcc_histogram_t const *hist;
+	int i;
+
+	if (NOERROR != uvcc_get_stats(handle, &stats)) {
+		return;
+	}
 
+	LOGI("frames: %u, corrupted: %u, timeouts: %u, cancelled: %u\n",
+		stats.frames, stats.corrupted, stats.timeouts, stats.cancelled);
+	LOGI("%-16s %8s %8s %8s %8s %8s (us)\n", "stage", "count", "min", "p50", "p99", "max");
+	for (i = 0; i < UVCC_STAT_COUNT; ++i) {
+		hist = &stats.latency[i];
+		LOGI("%-16s %8u %8u %8u %8u %8u\n",
+			STAT_STAGE_NAMES[i],
+			hist->count,
+			hist->min,
+			uvcc_histogram_percentile(hist, 50.0),
+			uvcc_histogram_percentile(hist, 99.0),
+			hist->max);
+	}
+}
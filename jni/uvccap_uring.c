@@ -0,0 +1,263 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+
+#include "uvccap_uring.h"
+
+// older NDK headers know neither the system calls nor the ring layout.
+#if defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+// IORING_OP_WRITE and this feature flag both came with Linux 5.6.
+#ifdef IORING_FEAT_RW_CUR_POS
+#define UVCCAP_HAS_IO_URING 1
+#endif
+#endif
+#endif
+
+#ifdef UVCCAP_HAS_IO_URING
+
+struct uring_t_ {
+	int                  fd;
+	void                *sq_ring;
+	size_t               sq_ring_size;
+	void                *cq_ring;
+	size_t               cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t               sqes_size;
+	uint32_t volatile   *sq_head;
+	uint32_t volatile   *sq_tail;
+	uint32_t             sq_mask;
+	uint32_t             sq_entries;
+	uint32_t            *sq_array;
+	uint32_t volatile   *cq_head;
+	uint32_t volatile   *cq_tail;
+	uint32_t             cq_mask;
+	struct io_uring_cqe *cqes;
+	uint32_t             queued;  // prepared but not submitted yet.
+	int                  has_file;
+};
+
+/* Internal APIs */
+static void unmap_ring(uring_t *ring);
+
+int uring_open(uring_t **ring, uint32_t entries) {
+	struct io_uring_params params;
+	uring_t *r;
+	void *p;
+
+	r = (uring_t*)malloc(sizeof(uring_t));
+	if (NULL == r) {
+		return INSUFFICIENT_MEMORY;
+	}
+	memset(r, 0, sizeof(uring_t));
+
+	memset(&params, 0, sizeof(params));
+	r->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+	if ((0 > r->fd) || (0 == (IORING_FEAT_RW_CUR_POS & params.features))) {
+		if (0 <= r->fd) {
+			close(r->fd);
+		}
+		free(r);
+		return IO_METHOD_NOT_SUPPORTED;
+	}
+
+	r->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	r->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (0 != (IORING_FEAT_SINGLE_MMAP & params.features)) {
+		if (r->cq_ring_size > r->sq_ring_size) {
+			r->sq_ring_size = r->cq_ring_size;
+		}
+		r->cq_ring_size = 0;
+	}
+	p = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (MAP_FAILED == p) {
+		unmap_ring(r);
+		return IO_METHOD_NOT_SUPPORTED;
+	}
+	r->sq_ring = p;
+	r->cq_ring = p;
+	if (0 < r->cq_ring_size) {
+		p = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (MAP_FAILED == p) {
+			unmap_ring(r);
+			return IO_METHOD_NOT_SUPPORTED;
+		}
+		r->cq_ring = p;
+	}
+	r->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	p = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (MAP_FAILED == p) {
+		unmap_ring(r);
+		return IO_METHOD_NOT_SUPPORTED;
+	}
+	r->sqes = (struct io_uring_sqe*)p;
+
+	r->sq_head    = (uint32_t volatile*)((uint8_t*)r->sq_ring + params.sq_off.head);
+	r->sq_tail    = (uint32_t volatile*)((uint8_t*)r->sq_ring + params.sq_off.tail);
+	r->sq_mask    = *(uint32_t*)((uint8_t*)r->sq_ring + params.sq_off.ring_mask);
+	r->sq_entries = params.sq_entries;
+	r->sq_array   = (uint32_t*)((uint8_t*)r->sq_ring + params.sq_off.array);
+	r->cq_head    = (uint32_t volatile*)((uint8_t*)r->cq_ring + params.cq_off.head);
+	r->cq_tail    = (uint32_t volatile*)((uint8_t*)r->cq_ring + params.cq_off.tail);
+	r->cq_mask    = *(uint32_t*)((uint8_t*)r->cq_ring + params.cq_off.ring_mask);
+	r->cqes       = (struct io_uring_cqe*)((uint8_t*)r->cq_ring + params.cq_off.cqes);
+
+	*ring = r;
+	return NOERROR;
+}
+
+void uring_close(uring_t *ring) {
+	if (NULL != ring) {
+		unmap_ring(ring);
+	}
+}
+
+int uring_register_buffers(uring_t *ring, uint8_t * const *buffers, uint32_t count, uint32_t size) {
+	struct iovec *iov;
+	uint32_t i;
+	long ret;
+
+	iov = (struct iovec*)malloc(sizeof(struct iovec) * count);
+	if (NULL == iov) {
+		return INSUFFICIENT_MEMORY;
+	}
+	for (i = 0; i < count; ++i) {
+		iov[i].iov_base = buffers[i];
+		iov[i].iov_len  = size;
+	}
+	// pins the pages, which RLIMIT_MEMLOCK may not allow.
+	ret = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, count);
+	free(iov);
+
+	return (0 == ret) ? NOERROR : IO_METHOD_NOT_SUPPORTED;
+}
+
+int uring_register_file(uring_t *ring, int fd) {
+	if (ring->has_file) {
+		// rolling files is rare, no need for IORING_REGISTER_FILES_UPDATE.
+		syscall(__NR_io_uring_register, ring->fd, IORING_UNREGISTER_FILES, NULL, 0);
+		ring->has_file = 0;
+	}
+	if (0 > fd) {
+		return NOERROR;
+	}
+	if (0 != syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES, &fd, 1)) {
+		return IO_ERROR;
+	}
+	ring->has_file = 1;
+
+	return NOERROR;
+}
+
+int uring_queue_write(uring_t *ring, void const *data, uint32_t size, uint64_t offset, int buffer, uint64_t user_data) {
+	struct io_uring_sqe *sqe;
+	uint32_t const tail = *ring->sq_tail;
+	uint32_t index;
+
+	if (tail - *ring->sq_head >= ring->sq_entries) {
+		return INSUFFICIENT_MEMORY;
+	}
+
+	index = tail & ring->sq_mask;
+	sqe   = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode    = (0 <= buffer) ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+	sqe->flags     = IOSQE_FIXED_FILE;
+	sqe->fd        = 0;
+	sqe->off       = offset;
+	sqe->addr      = (uint64_t)(uintptr_t)data;
+	sqe->len       = size;
+	sqe->buf_index = (0 <= buffer) ? (uint16_t)buffer : 0;
+	sqe->user_data = user_data;
+	ring->sq_array[index] = index;
+
+	// the kernel must see the entry before the new tail.
+	__sync_synchronize();
+	*ring->sq_tail = tail + 1;
+	++ring->queued;
+
+	return NOERROR;
+}
+
+int uring_submit(uring_t *ring, uint32_t wait_nr) {
+	long ret;
+
+	do {
+		ret = syscall(__NR_io_uring_enter, ring->fd, ring->queued, wait_nr, (0 < wait_nr) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	} while ((0 > ret) && (EINTR == errno));
+	if (0 > ret) {
+		return IO_ERROR;
+	}
+	ring->queued -= (uint32_t)ret;
+
+	return NOERROR;
+}
+
+int uring_complete(uring_t *ring, uint64_t *user_data, int32_t *res) {
+	uint32_t const head = *ring->cq_head;
+	struct io_uring_cqe const *cqe;
+
+	if (head == *ring->cq_tail) {
+		return 0;
+	}
+	// read the entry only after seeing the tail move.
+	__sync_synchronize();
+	cqe = &ring->cqes[head & ring->cq_mask];
+	*user_data = cqe->user_data;
+	*res       = cqe->res;
+	__sync_synchronize();
+	*ring->cq_head = head + 1;
+
+	return 1;
+}
+
+static void unmap_ring(uring_t *ring) {
+	if (NULL != ring->sqes) {
+		munmap(ring->sqes, ring->sqes_size);
+	}
+	if ((NULL != ring->cq_ring) && (ring->cq_ring != ring->sq_ring)) {
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	}
+	if (NULL != ring->sq_ring) {
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	}
+	close(ring->fd);
+	free(ring);
+}
+
+#else
+
+int uring_open(uring_t **ring, uint32_t entries) {
+	return IO_METHOD_NOT_SUPPORTED;
+}
+
+void uring_close(uring_t *ring) {
+}
+
+int uring_register_buffers(uring_t *ring, uint8_t * const *buffers, uint32_t count, uint32_t size) {
+	return IO_METHOD_NOT_SUPPORTED;
+}
+
+int uring_register_file(uring_t *ring, int fd) {
+	return IO_METHOD_NOT_SUPPORTED;
+}
+
+int uring_queue_write(uring_t *ring, void const *data, uint32_t size, uint64_t offset, int buffer, uint64_t user_data) {
+	return IO_METHOD_NOT_SUPPORTED;
+}
+
+int uring_submit(uring_t *ring, uint32_t wait_nr) {
+	return IO_METHOD_NOT_SUPPORTED;
+}
+
+int uring_complete(uring_t *ring, uint64_t *user_data, int32_t *res) {
+	return 0;
+}
+
+#endif
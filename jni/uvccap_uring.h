@@ -0,0 +1,37 @@
+#ifndef UVCCAP_URING_H
+#define UVCCAP_URING_H
+
+#include<stdint.h>
+
+#include "uvccap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Just enough io_uring for the recording writer, on the raw system calls
+ * since liburing is not part of the NDK. Writes go to one registered
+ * file from registered buffers (or plain ones, 'buffer' < 0).
+ * Kernels or headers without io_uring fail uring_open() with
+ * IO_METHOD_NOT_SUPPORTED, and callers fall back to write().
+ */
+typedef struct uring_t_ uring_t;
+
+extern int  uring_open(uring_t **ring, uint32_t entries);
+extern void uring_close(uring_t *ring);
+extern int  uring_register_buffers(uring_t *ring, uint8_t * const *buffers, uint32_t count, uint32_t size);
+/* Make 'fd' the registered file every write goes to, -1 drops it. */
+extern int  uring_register_file(uring_t *ring, int fd);
+/* Queue a write; INSUFFICIENT_MEMORY when the submission queue is full. */
+extern int  uring_queue_write(uring_t *ring, void const *data, uint32_t size, uint64_t offset, int buffer, uint64_t user_data);
+/* Submit what is queued and wait until 'wait_nr' writes are complete. */
+extern int  uring_submit(uring_t *ring, uint32_t wait_nr);
+/* Take one completion, 0 if there is none. 'res' is bytes written or -errno. */
+extern int  uring_complete(uring_t *ring, uint64_t *user_data, int32_t *res);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1136 @@
+#define _GNU_SOURCE // fallocate(), vmsplice()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "uvccap_writer.h"
+#include "uvccap_uring.h"
+#include "uvcc_record.h"
+
+/*
+ * Frames travel in a ring of slots, each owning one buffer. The capture
+ * side fills the slot at 'tail' while fewer than all slots are queued.
+ * The writer thread hands every queued slot from 'next' on to the sink
+ * in one batch and frees slots from 'head' once the sink is done with
+ * them; 'inflight' slots are with the sink. Counts are shared under the
+ * lock, the indices each have a single owner.
+ */
+
+typedef struct writer_slot_t_ {
+	uint8_t     *buf;
+	uvcc_frame_t frame;
+} writer_slot_t;
+
+struct writer_t_ {
+	pthread_mutex_t lock;
+	pthread_cond_t  queued_cond;
+	pthread_cond_t  free_cond;
+	pthread_t       thread;
+	writer_sink_t   sink;
+	writer_slot_t  *slots;
+	uint32_t        slot_count;
+	uint32_t        buffer_size;
+	uint32_t        head;
+	uint32_t        next;
+	uint32_t        tail;
+	uint32_t        count;
+	uint32_t        inflight;
+	uint32_t        submitted;
+	int             is_closing;
+	int             error;
+	int             error_errno;  // errno of the failing sink call, set on the writer thread.
+	uint64_t        start_us;
+	writer_stats_t  stats;
+};
+
+// index entries written at once.
+#define SEGMENT_INDEX_BATCH 64
+
+typedef struct segment_sink_t_ {
+	char                prefix[4096];
+	uint64_t            segment_bytes;
+	uint64_t            segment_us;
+	int                 fd;
+	int                 index_fd;
+	uint32_t            segment;
+	uint64_t            offset;    // end of the payloads in the segment.
+	uint64_t            first_timestamp;
+	uint32_t            entry_count;
+	uvcc_record_entry_t entries[SEGMENT_INDEX_BATCH];
+	uint32_t            flags;
+	int                 direct;     // segments are opened with O_DIRECT.
+	char                engine[48];
+	uint32_t            completed;  // oldest frames written but not reaped yet.
+	// io_uring engine, set up once the writer buffers are known.
+	uring_t            *ring;
+	uint8_t           **buffers;
+	uint32_t           *sizes;      // being written from each buffer.
+	uint8_t            *written;
+	uint32_t            buffer_count;
+	int                 fixed_buffers;
+	uint32_t            oldest;     // buffer of the oldest frame in flight.
+	uint32_t            inflight;
+} segment_sink_t;
+
+typedef struct y4m_sink_t_ {
+	int                 fd;
+	int                 is_pipe;
+	int                 has_header;
+	uint32_t            pixel_format;
+	uint32_t            rate_num;
+	uint32_t            rate_den;
+	uint32_t            color_space;
+	uint32_t            frame_size;  // of a YUV4MPEG2 picture, without "FRAME\n".
+	uint8_t            *staging;     // converted frame written without a writer.
+	int                 splice;      // frames go into the pipe with vmsplice().
+	char                engine[16];
+	uint32_t            completed;   // oldest frames consumed but not reaped yet.
+	// set up once the writer buffers are known, when writing to a pipe.
+	uint8_t           **buffers;
+	uint8_t           **converted;   // converted frame of each buffer, allocated on demand.
+	uint32_t            buffer_count;
+	uint64_t            sent;        // bytes put into the pipe.
+	uint64_t           *ends;        // 'sent' after each frame in flight, oldest first.
+	uint32_t            oldest;
+	uint32_t            inflight;
+} y4m_sink_t;
+
+/* Internal APIs */
+static void *writer_main(void *arg);
+static void destroy_writer(writer_t *writer);
+static int attach_buffers(writer_t *writer);
+static uint64_t now_us();
+static int segment_attach(void *ctx, uint8_t * const *buffers, uint32_t count, uint32_t size);
+static int segment_write(void *ctx, uvcc_frame_t const *frame, uint32_t index);
+static int segment_reap(void *ctx, int wait, uint32_t *done);
+static int segment_close(void *ctx);
+static void describe_engine(segment_sink_t *seg);
+static int queue_segment_write(segment_sink_t *seg, uvcc_frame_t const *frame, uint32_t length);
+static int collect_writes(segment_sink_t *seg);
+static int drain_writes(segment_sink_t *seg);
+static int roll_segment(segment_sink_t *seg, uint64_t timestamp);
+static int finish_segment(segment_sink_t *seg);
+static int flush_index(segment_sink_t *seg);
+static int y4m_attach(void *ctx, uint8_t * const *buffers, uint32_t count, uint32_t size);
+static int y4m_write(void *ctx, uvcc_frame_t const *frame, uint32_t index);
+static int y4m_reap(void *ctx, int wait, uint32_t *done);
+static int y4m_close(void *ctx);
+static int write_y4m_header(y4m_sink_t *y4m, uvcc_frame_layout_t const *layout);
+static uint32_t packed_y4m_size(uvcc_frame_layout_t const *layout);
+static int convert_y4m_frame(y4m_sink_t const *y4m, uvcc_frame_t const *frame, uint8_t *dst);
+static int send_y4m_frame(y4m_sink_t *y4m, void const *data, uint32_t size);
+static int collect_frames(y4m_sink_t *y4m);
+static int write_fully(int fd, void const *data, size_t size);
+static int pwrite_fully(int fd, void const *data, size_t size, uint64_t offset);
+
+int writer_create(writer_t **writer, writer_sink_t const *sink, uint32_t buffer_count, uint32_t buffer_size) {
+	writer_t *w;
+	uint32_t i;
+	int ret;
+
+	if ((NULL == writer) || (NULL == sink) || (NULL == sink->write) || (0 == buffer_count) || (0 == buffer_size)) {
+		return INVALID_ARGUMENTS;
+	}
+
+	w = (writer_t*)malloc(sizeof(writer_t));
+	if (NULL == w) {
+		return INSUFFICIENT_MEMORY;
+	}
+	memset(w, 0, sizeof(writer_t));
+	w->sink        = *sink;
+	w->buffer_size = (buffer_size + WRITER_BUFFER_ALIGN - 1) & ~(WRITER_BUFFER_ALIGN - 1);
+	w->slots       = (writer_slot_t*)calloc(buffer_count, sizeof(writer_slot_t));
+	if (NULL == w->slots) {
+		free(w);
+		return INSUFFICIENT_MEMORY;
+	}
+	w->slot_count = buffer_count;
+	for (i = 0; i < buffer_count; ++i) {
+		if (0 != posix_memalign((void**)&w->slots[i].buf, WRITER_BUFFER_ALIGN, w->buffer_size)) {
+			w->slots[i].buf = NULL;
+			destroy_writer(w);
+			return INSUFFICIENT_MEMORY;
+		}
+	}
+	if (NULL != sink->attach) {
+		ret = attach_buffers(w);
+		if (NOERROR != ret) {
+			destroy_writer(w);
+			return ret;
+		}
+	}
+
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->queued_cond, NULL);
+	pthread_cond_init(&w->free_cond, NULL);
+	w->start_us = now_us();
+	if (0 != pthread_create(&w->thread, NULL, writer_main, w)) {
+		pthread_cond_destroy(&w->free_cond);
+		pthread_cond_destroy(&w->queued_cond);
+		pthread_mutex_destroy(&w->lock);
+		destroy_writer(w);
+		return INSUFFICIENT_MEMORY;
+	}
+
+	*writer = w;
+	return NOERROR;
+}
+
+int writer_get_buffer(writer_t *writer, uint8_t **buf, uint32_t *buf_size) {
+	uint64_t begin = 0;
+	int ret;
+
+	pthread_mutex_lock(&writer->lock);
+	if ((writer->count == writer->slot_count) && (NOERROR == writer->error)) {
+		begin = now_us();
+		while ((writer->count == writer->slot_count) && (NOERROR == writer->error)) {
+			pthread_cond_wait(&writer->free_cond, &writer->lock);
+		}
+		writer->stats.wait_us += now_us() - begin;
+	}
+	ret = writer->error;
+	pthread_mutex_unlock(&writer->lock);
+	if (NOERROR != ret) {
+		errno = writer->error_errno;
+	}
+
+	// the slot at 'tail' is ours until it is submitted.
+	*buf      = writer->slots[writer->tail].buf;
+	*buf_size = writer->buffer_size;
+
+	return ret;
+}
+
+int writer_submit(writer_t *writer, uvcc_frame_t const *frame, uint32_t size) {
+	writer_slot_t *slot = &writer->slots[writer->tail];
+	int ret;
+
+	slot->frame      = *frame;
+	slot->frame.data = slot->buf;
+	slot->frame.size = (size < writer->buffer_size) ? size : writer->buffer_size;
+
+	pthread_mutex_lock(&writer->lock);
+	ret = writer->error;
+	if (NOERROR == ret) {
+		writer->tail = (writer->tail + 1) % writer->slot_count;
+		++writer->count;
+		if (writer->count > writer->stats.high_water) {
+			writer->stats.high_water = writer->count;
+		}
+		pthread_cond_signal(&writer->queued_cond);
+	}
+	pthread_mutex_unlock(&writer->lock);
+	if (NOERROR != ret) {
+		errno = writer->error_errno;
+	}
+
+	return ret;
+}
+
+int writer_close(writer_t *writer, writer_stats_t *stats) {
+	int error_errno;
+	int ret;
+	int close_ret = NOERROR;
+
+	if (NULL == writer) {
+		return INVALID_ARGUMENTS;
+	}
+
+	pthread_mutex_lock(&writer->lock);
+	writer->is_closing = 1;
+	pthread_cond_signal(&writer->queued_cond);
+	pthread_mutex_unlock(&writer->lock);
+	pthread_join(writer->thread, NULL);
+
+	if (NULL != writer->sink.close) {
+		close_ret = writer->sink.close(writer->sink.ctx);
+	}
+	ret = (NOERROR != writer->error) ? writer->error : close_ret;
+	error_errno = (NOERROR != writer->error) ? writer->error_errno : errno;
+
+	writer->stats.elapsed_us = now_us() - writer->start_us;
+	if (NULL != stats) {
+		*stats = writer->stats;
+	}
+
+	pthread_cond_destroy(&writer->free_cond);
+	pthread_cond_destroy(&writer->queued_cond);
+	pthread_mutex_destroy(&writer->lock);
+	destroy_writer(writer);
+	errno = error_errno;
+
+	return ret;
+}
+
+static void *writer_main(void *arg) {
+	writer_t *writer = (writer_t*)arg;
+	writer_slot_t *slot;
+	uint32_t batch, done, i;
+	uint64_t begin;
+	int sink_errno;
+	int ret;
+
+	pthread_mutex_lock(&writer->lock);
+	for (; ; ) {
+		while ((0 == writer->count) && !writer->is_closing) {
+			pthread_cond_wait(&writer->queued_cond, &writer->lock);
+		}
+		batch = writer->count - writer->inflight;
+		if (0 == writer->count) {
+			break;
+		}
+		pthread_mutex_unlock(&writer->lock);
+
+		// the sink runs without the lock, the capture side keeps filling other slots.
+		begin = now_us();
+		ret   = NOERROR;
+		for (i = 0; (i < batch) && (NOERROR == ret); ++i) {
+			slot = &writer->slots[writer->next];
+			ret  = writer->sink.write(writer->sink.ctx, &slot->frame, writer->submitted + i);
+			writer->next = (writer->next + 1) % writer->slot_count;
+		}
+		done = batch;
+		if ((NOERROR == ret) && (NULL != writer->sink.reap)) {
+			// nothing new to hand over, wait for the sink instead.
+			ret = writer->sink.reap(writer->sink.ctx, 0 == batch, &done);
+		}
+		begin = now_us() - begin;
+		sink_errno = errno;
+
+		pthread_mutex_lock(&writer->lock);
+		writer->stats.write_us += begin;
+		writer->submitted      += batch;
+		writer->inflight       += batch;
+		if (NOERROR != ret) {
+			if (NOERROR == writer->error) {
+				writer->error       = ret;
+				writer->error_errno = sink_errno;
+			}
+			// drop what is left, the capture side sees the error.
+			writer->head     = writer->tail;
+			writer->next     = writer->tail;
+			writer->count    = 0;
+			writer->inflight = 0;
+			pthread_cond_signal(&writer->free_cond);
+			break;
+		}
+		for (i = 0; i < done; ++i) {
+			slot = &writer->slots[writer->head];
+			++writer->stats.frames;
+			writer->stats.bytes += slot->frame.size;
+			writer->head = (writer->head + 1) % writer->slot_count;
+		}
+		writer->count    -= done;
+		writer->inflight -= done;
+		if (0 < done) {
+			pthread_cond_signal(&writer->free_cond);
+		}
+	}
+	pthread_mutex_unlock(&writer->lock);
+
+	return NULL;
+}
+
+static void destroy_writer(writer_t *writer) {
+	uint32_t i;
+
+	for (i = 0; i < writer->slot_count; ++i) {
+		free(writer->slots[i].buf);
+	}
+	free(writer->slots);
+	free(writer);
+}
+
+static int attach_buffers(writer_t *writer) {
+	uint8_t **buffers;
+	uint32_t i;
+	int ret;
+
+	buffers = (uint8_t**)malloc(sizeof(uint8_t*) * writer->slot_count);
+	if (NULL == buffers) {
+		return INSUFFICIENT_MEMORY;
+	}
+	for (i = 0; i < writer->slot_count; ++i) {
+		buffers[i] = writer->slots[i].buf;
+	}
+	ret = writer->sink.attach(writer->sink.ctx, buffers, writer->slot_count, writer->buffer_size);
+	free(buffers);
+
+	return ret;
+}
+
+static uint64_t now_us() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Segmented recordings */
+
+int writer_open_segments(writer_sink_t *sink, char const *prefix, uint64_t segment_bytes, uint64_t segment_us, uint32_t flags) {
+	uvcc_record_header_t header;
+	segment_sink_t *seg;
+	char path[4096 + 16];
+
+	if ((NULL == sink) || (NULL == prefix) || (strlen(prefix) >= sizeof(seg->prefix))) {
+		return INVALID_ARGUMENTS;
+	}
+
+	seg = (segment_sink_t*)malloc(sizeof(segment_sink_t));
+	if (NULL == seg) {
+		return INSUFFICIENT_MEMORY;
+	}
+	memset(seg, 0, sizeof(segment_sink_t));
+	strcpy(seg->prefix, prefix);
+	seg->segment_bytes = segment_bytes;
+	seg->segment_us    = segment_us;
+	seg->flags         = flags;
+	seg->fd            = -1;
+	strcpy(seg->engine, "write");
+
+	snprintf(path, sizeof(path), UVCC_RECORD_INDEX_NAME, prefix);
+	seg->index_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (0 > seg->index_fd) {
+		free(seg);
+		return (EPERM == errno) ? NOT_PERMITTED : IO_FILE_NOT_CREATED;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, UVCC_RECORD_MAGIC, sizeof(header.magic));
+	header.version     = UVCC_RECORD_VERSION;
+	header.header_size = sizeof(uvcc_record_header_t);
+	header.entry_size  = sizeof(uvcc_record_entry_t);
+	header.align       = UVCC_RECORD_ALIGN;
+	if (NOERROR != write_fully(seg->index_fd, &header, sizeof(header))) {
+		close(seg->index_fd);
+		free(seg);
+		return IO_ERROR;
+	}
+
+	sink->ctx    = seg;
+	sink->engine = seg->engine;
+	sink->attach = segment_attach;
+	sink->write  = segment_write;
+	sink->reap   = segment_reap;
+	sink->close  = segment_close;
+
+	return NOERROR;
+}
+
+static int segment_write(void *ctx, uvcc_frame_t const *frame, uint32_t index) {
+	segment_sink_t *seg = (segment_sink_t*)ctx;
+	uvcc_record_entry_t *entry;
+	uint32_t length = frame->size;
+	int ret;
+
+	if ((0 > seg->fd) ||
+		((0 < seg->offset) && (0 < seg->segment_bytes) && (seg->offset + frame->size > seg->segment_bytes)) ||
+		((0 < seg->segment_us) && (frame->timestamp - seg->first_timestamp >= seg->segment_us))) {
+		ret = roll_segment(seg, frame->timestamp);
+		if (NOERROR != ret) {
+			return ret;
+		}
+	}
+
+	if (seg->direct) {
+		// whole blocks from the padded writer buffer, the index keeps the real size.
+		length = (frame->size + UVCC_RECORD_ALIGN - 1) & ~(UVCC_RECORD_ALIGN - 1);
+	}
+	if (NULL != seg->ring) {
+		ret = queue_segment_write(seg, frame, length);
+	} else {
+		ret = pwrite_fully(seg->fd, frame->data, length, seg->offset);
+		++seg->completed;
+	}
+	if (NOERROR != ret) {
+		return ret;
+	}
+
+	entry = &seg->entries[seg->entry_count++];
+	memset(entry, 0, sizeof(*entry));
+	entry->offset    = seg->offset;
+	entry->timestamp = frame->timestamp;
+	entry->segment   = seg->segment - 1;
+	entry->size      = frame->size;
+	entry->sequence  = frame->sequence;
+	entry->flags     = frame->flags;
+	if (NULL != frame->layout) {
+		entry->pixel_format = frame->layout->pixel_format;
+		entry->width        = frame->layout->width;
+		entry->height       = frame->layout->height;
+		entry->stride       = frame->layout->planes[0].stride;
+	}
+	seg->offset = (seg->offset + frame->size + UVCC_RECORD_ALIGN - 1) & ~(uint64_t)(UVCC_RECORD_ALIGN - 1);
+
+	if (SEGMENT_INDEX_BATCH == seg->entry_count) {
+		return flush_index(seg);
+	}
+	return NOERROR;
+}
+
+static int segment_reap(void *ctx, int wait, uint32_t *done) {
+	segment_sink_t *seg = (segment_sink_t*)ctx;
+	int ret = NOERROR;
+
+	if (NULL != seg->ring) {
+		// one system call submits the batch and, if asked to, waits.
+		ret = uring_submit(seg->ring, (wait && (0 == seg->completed) && (0 < seg->inflight)) ? 1 : 0);
+		if (NOERROR == ret) {
+			ret = collect_writes(seg);
+		}
+		while ((NOERROR == ret) && wait && (0 == seg->completed) && (0 < seg->inflight)) {
+			ret = uring_submit(seg->ring, 1);
+			if (NOERROR == ret) {
+				ret = collect_writes(seg);
+			}
+		}
+	}
+	*done = seg->completed;
+	seg->completed = 0;
+
+	return ret;
+}
+
+static int segment_close(void *ctx) {
+	segment_sink_t *seg = (segment_sink_t*)ctx;
+	int ret;
+
+	ret = drain_writes(seg);
+	if (NOERROR == ret) {
+		ret = finish_segment(seg);
+	} else {
+		finish_segment(seg);
+	}
+	if (NOERROR == ret) {
+		ret = flush_index(seg);
+	}
+	if ((0 != close(seg->index_fd)) && (NOERROR == ret)) {
+		ret = IO_ERROR;
+	}
+	uring_close(seg->ring);
+	free(seg->buffers);
+	free(seg->sizes);
+	free(seg->written);
+	free(seg);
+
+	return ret;
+}
+
+/* Writer buffers are aligned and padded to whole blocks, which is all O_DIRECT and registered io_uring buffers need. */
+static int segment_attach(void *ctx, uint8_t * const *buffers, uint32_t count, uint32_t size) {
+	segment_sink_t *seg = (segment_sink_t*)ctx;
+	uint32_t i;
+
+	if ((0 != (WRITER_SEGMENTS_DIRECT & seg->flags)) && (0 == size % UVCC_RECORD_ALIGN)) {
+		seg->direct = 1;
+		for (i = 0; i < count; ++i) {
+			if (0 != ((uintptr_t)buffers[i] & (UVCC_RECORD_ALIGN - 1))) {
+				seg->direct = 0;
+			}
+		}
+	}
+
+	// without io_uring the frames are written as before.
+	if ((0 != (WRITER_SEGMENTS_IO_URING & seg->flags)) && (NOERROR == uring_open(&seg->ring, count))) {
+		seg->buffers = (uint8_t**)malloc(sizeof(uint8_t*) * count);
+		seg->sizes   = (uint32_t*)calloc(count, sizeof(uint32_t));
+		seg->written = (uint8_t*)calloc(count, sizeof(uint8_t));
+		if ((NULL == seg->buffers) || (NULL == seg->sizes) || (NULL == seg->written)) {
+			return INSUFFICIENT_MEMORY;
+		}
+		memcpy(seg->buffers, buffers, sizeof(uint8_t*) * count);
+		seg->buffer_count  = count;
+		seg->fixed_buffers = (NOERROR == uring_register_buffers(seg->ring, buffers, count, size));
+	}
+	describe_engine(seg);
+
+	return NOERROR;
+}
+
+static void describe_engine(segment_sink_t *seg) {
+	if (NULL == seg->ring) {
+		strcpy(seg->engine, "write");
+	} else {
+		strcpy(seg->engine, seg->fixed_buffers ? "io_uring" : "io_uring, unregistered buffers");
+	}
+	if (seg->direct) {
+		strcat(seg->engine, ", O_DIRECT");
+	}
+}
+
+static int queue_segment_write(segment_sink_t *seg, uvcc_frame_t const *frame, uint32_t length) {
+	uint32_t b;
+	int ret;
+
+	for (b = 0; (b < seg->buffer_count) && (seg->buffers[b] != frame->data); ++b) {
+	}
+	if (b == seg->buffer_count) {
+		// only the writer's buffers outlive the call.
+		return INVALID_ARGUMENTS;
+	}
+
+	seg->sizes[b]   = length;
+	seg->written[b] = 0;
+	for (; ; ) {
+		ret = uring_queue_write(seg->ring, frame->data, length, seg->offset, seg->fixed_buffers ? (int)b : -1, b);
+		if (INSUFFICIENT_MEMORY != ret) {
+			break;
+		}
+		ret = uring_submit(seg->ring, 1);
+		if (NOERROR == ret) {
+			ret = collect_writes(seg);
+		}
+		if (NOERROR != ret) {
+			return ret;
+		}
+	}
+	if (NOERROR == ret) {
+		++seg->inflight;
+	}
+
+	return ret;
+}
+
+/* Take completions and count the oldest frames which are now written. */
+static int collect_writes(segment_sink_t *seg) {
+	uint64_t b;
+	int32_t res;
+	int ret = NOERROR;
+
+	while (uring_complete(seg->ring, &b, &res)) {
+		if (b >= seg->buffer_count) {
+			continue;
+		}
+		if ((0 > res) || ((uint32_t)res != seg->sizes[b])) {
+			// short writes to a preallocated file only happen when the disk fails.
+			errno = (0 > res) ? -res : EIO;
+			ret = IO_ERROR;
+		}
+		seg->written[b] = 1;
+	}
+	while ((0 < seg->inflight) && seg->written[seg->oldest]) {
+		seg->written[seg->oldest] = 0;
+		seg->oldest = (seg->oldest + 1) % seg->buffer_count;
+		--seg->inflight;
+		++seg->completed;
+	}
+
+	return ret;
+}
+
+static int drain_writes(segment_sink_t *seg) {
+	int ret = NOERROR;
+
+	while ((NULL != seg->ring) && (0 < seg->inflight) && (NOERROR == ret)) {
+		ret = uring_submit(seg->ring, 1);
+		if (NOERROR == ret) {
+			ret = collect_writes(seg);
+		}
+	}
+	return ret;
+}
+
+/* Close the current segment, if any, and start the next one at 'timestamp'. */
+static int roll_segment(segment_sink_t *seg, uint64_t timestamp) {
+	char path[4096 + 16];
+	int ret;
+
+	// the segment is trimmed and closed only after its last write.
+	ret = drain_writes(seg);
+	if (NOERROR == ret) {
+		ret = finish_segment(seg);
+	}
+	if (NOERROR == ret) {
+		// entries must not point at segments which are not complete yet.
+		ret = flush_index(seg);
+	}
+	if (NOERROR != ret) {
+		return ret;
+	}
+
+	snprintf(path, sizeof(path), UVCC_RECORD_SEGMENT_NAME, seg->prefix, seg->segment);
+	seg->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | (seg->direct ? O_DIRECT : 0), 0666);
+	if ((0 > seg->fd) && seg->direct && (EINVAL == errno)) {
+		// the filesystem has no O_DIRECT, go through the page cache.
+		seg->direct = 0;
+		describe_engine(seg);
+		seg->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	}
+	if (0 > seg->fd) {
+		return (EPERM == errno) ? NOT_PERMITTED : IO_FILE_NOT_CREATED;
+	}
+	// allocate the whole segment up front, so appending never allocates blocks
+	// nor extends the file, which would serialize O_DIRECT writes.
+	// filesystems without fallocate() just grow the file as before.
+	if (0 < seg->segment_bytes) {
+		fallocate(seg->fd, 0, 0, (off_t)seg->segment_bytes);
+	}
+	if ((NULL != seg->ring) && (NOERROR != uring_register_file(seg->ring, seg->fd))) {
+		return IO_ERROR;
+	}
+	++seg->segment;
+	seg->offset          = 0;
+	seg->first_timestamp = timestamp;
+
+	return NOERROR;
+}
+
+static int finish_segment(segment_sink_t *seg) {
+	int ret = NOERROR;
+
+	if (0 > seg->fd) {
+		return NOERROR;
+	}
+	// give back what the preallocation did not use.
+	if (0 != ftruncate(seg->fd, (off_t)seg->offset)) {
+		ret = IO_ERROR;
+	}
+	if ((0 != close(seg->fd)) && (NOERROR == ret)) {
+		ret = IO_ERROR;
+	}
+	seg->fd = -1;
+
+	return ret;
+}
+
+static int flush_index(segment_sink_t *seg) {
+	int ret;
+
+	if (0 == seg->entry_count) {
+		return NOERROR;
+	}
+	ret = write_fully(seg->index_fd, seg->entries, sizeof(uvcc_record_entry_t) * seg->entry_count);
+	seg->entry_count = 0;
+
+	return ret;
+}
+
+/* YUV4MPEG2 streams */
+
+int writer_open_y4m(writer_sink_t *sink, char const *path, uint32_t pixel_format, uint32_t rate_num, uint32_t rate_den, uint32_t color_space) {
+	y4m_sink_t *y4m;
+	struct stat st;
+
+	if ((NULL == sink) || (NULL == path) || (0 == rate_num) || (0 == rate_den)) {
+		return INVALID_ARGUMENTS;
+	}
+	switch (pixel_format) {
+	case UVCC_PIX_FMT_YUV420:
+	case UVCC_PIX_FMT_YUV422P:
+	case UVCC_PIX_FMT_NV12:
+	case UVCC_PIX_FMT_NV21:
+	case UVCC_PIX_FMT_YUYV:
+	case UVCC_PIX_FMT_UYVY:
+		break;
+	default:
+		// YUV4MPEG2 has neither RGB nor 4:1:0.
+		return INVALID_FORMAT_ARGUMENTS;
+	}
+
+	y4m = (y4m_sink_t*)malloc(sizeof(y4m_sink_t));
+	if (NULL == y4m) {
+		return INSUFFICIENT_MEMORY;
+	}
+	memset(y4m, 0, sizeof(y4m_sink_t));
+	y4m->pixel_format = pixel_format;
+	y4m->rate_num     = rate_num;
+	y4m->rate_den     = rate_den;
+	y4m->color_space  = color_space;
+	strcpy(y4m->engine, "write");
+
+	if (0 == strcmp(path, "-")) {
+		y4m->fd = STDOUT_FILENO;
+	} else {
+		// opening a FIFO waits for its reader.
+		y4m->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (0 > y4m->fd) {
+			free(y4m);
+			return (EPERM == errno) ? NOT_PERMITTED : IO_FILE_NOT_CREATED;
+		}
+	}
+	y4m->is_pipe = (0 == fstat(y4m->fd, &st)) && S_ISFIFO(st.st_mode);
+
+	sink->ctx    = y4m;
+	sink->engine = y4m->engine;
+	sink->attach = y4m_attach;
+	sink->write  = y4m_write;
+	sink->reap   = y4m_reap;
+	sink->close  = y4m_close;
+
+	return NOERROR;
+}
+
+/*
+ * vmsplice() makes the pipe refer to the pages of a buffer rather than
+ * copying them, so a buffer is given back only once the reader has taken
+ * its frame out of the pipe; a reader splicing it on could still see the
+ * buffer change. Files, and frames written without a writer, are copied
+ * by write().
+ */
+static int y4m_attach(void *ctx, uint8_t * const *buffers, uint32_t count, uint32_t size) {
+	y4m_sink_t *y4m = (y4m_sink_t*)ctx;
+	uint64_t const room = (uint64_t)count * size;
+
+	if (!y4m->is_pipe) {
+		return NOERROR;
+	}
+
+	y4m->buffers   = (uint8_t**)malloc(sizeof(uint8_t*) * count);
+	y4m->converted = (uint8_t**)calloc(count, sizeof(uint8_t*));
+	y4m->ends      = (uint64_t*)calloc(count, sizeof(uint64_t));
+	if ((NULL == y4m->buffers) || (NULL == y4m->converted) || (NULL == y4m->ends)) {
+		return INSUFFICIENT_MEMORY;
+	}
+	memcpy(y4m->buffers, buffers, sizeof(uint8_t*) * count);
+	y4m->buffer_count = count;
+	y4m->splice       = 1;
+	strcpy(y4m->engine, "vmsplice");
+
+	// room for every queued frame, or at least one, so vmsplice() seldom waits
+	// for the reader; unprivileged pipes are limited to /proc/sys/fs/pipe-max-size.
+	if ((room > 0x7fffffff) || (0 > fcntl(y4m->fd, F_SETPIPE_SZ, (int)room))) {
+		fcntl(y4m->fd, F_SETPIPE_SZ, (int)size);
+	}
+
+	return NOERROR;
+}
+
+static int y4m_write(void *ctx, uvcc_frame_t const *frame, uint32_t index) {
+	y4m_sink_t *y4m = (y4m_sink_t*)ctx;
+	uint8_t *dst;
+	void const *data = frame->data;
+	uint32_t size;
+	uint32_t b = 0;
+	int ret;
+
+	if (NULL == frame->layout) {
+		return INVALID_ARGUMENTS;
+	}
+	if (!y4m->has_header) {
+		ret = write_y4m_header(y4m, frame->layout);
+		if (NOERROR != ret) {
+			return ret;
+		}
+	}
+	if (NULL != y4m->buffers) {
+		for (b = 0; (b < y4m->buffer_count) && (y4m->buffers[b] != frame->data); ++b) {
+		}
+		if (b == y4m->buffer_count) {
+			// only the writer's buffers outlive the call.
+			return INVALID_ARGUMENTS;
+		}
+	}
+
+	size = packed_y4m_size(frame->layout);
+	if (size != y4m->frame_size) {
+		// planes with padding or in another order are packed into a copy.
+		if (NULL != y4m->buffers) {
+			if ((NULL == y4m->converted[b]) && (0 != posix_memalign((void**)&y4m->converted[b], WRITER_BUFFER_ALIGN, y4m->frame_size))) {
+				y4m->converted[b] = NULL;
+				return INSUFFICIENT_MEMORY;
+			}
+			dst = y4m->converted[b];
+		} else {
+			if ((NULL == y4m->staging) && (NULL == (y4m->staging = (uint8_t*)malloc(y4m->frame_size)))) {
+				return INSUFFICIENT_MEMORY;
+			}
+			dst = y4m->staging;
+		}
+		ret  = convert_y4m_frame(y4m, frame, dst);
+		data = dst;
+	} else {
+		ret = (frame->size < size) ? IO_ERROR : NOERROR;
+	}
+
+	if (NOERROR == ret) {
+		ret = send_y4m_frame(y4m, data, y4m->frame_size);
+	} else if (IO_ERROR == ret) {
+		// a truncated frame has no picture to stream, leave it out.
+		ret = NOERROR;
+	}
+	if (NOERROR != ret) {
+		return ret;
+	}
+
+	if (NULL != y4m->buffers) {
+		y4m->ends[(y4m->oldest + y4m->inflight) % y4m->buffer_count] = y4m->sent;
+		++y4m->inflight;
+	} else {
+		++y4m->completed;
+	}
+
+	return NOERROR;
+}
+
+static int y4m_reap(void *ctx, int wait, uint32_t *done) {
+	y4m_sink_t *y4m = (y4m_sink_t*)ctx;
+	struct pollfd pfd;
+	int ret;
+
+	ret = collect_frames(y4m);
+	while ((NOERROR == ret) && wait && (0 == y4m->completed) && (0 < y4m->inflight)) {
+		// a pipe tells when it has room, not when it is empty; poll the reader's progress.
+		usleep(1000);
+		pfd.fd      = y4m->fd;
+		pfd.events  = POLLOUT;
+		pfd.revents = 0;
+		if ((0 < poll(&pfd, 1, 0)) && (0 != (POLLERR & pfd.revents))) {
+			// the reader is gone, its frames will never be consumed.
+			errno = EPIPE;
+			return IO_ERROR;
+		}
+		ret = collect_frames(y4m);
+	}
+	*done = y4m->completed;
+	y4m->completed = 0;
+
+	return ret;
+}
+
+static int y4m_close(void *ctx) {
+	y4m_sink_t *y4m = (y4m_sink_t*)ctx;
+	uint32_t i;
+	int ret = NOERROR;
+
+	// stdout belongs to the caller.
+	if ((STDOUT_FILENO != y4m->fd) && (0 != close(y4m->fd))) {
+		ret = IO_ERROR;
+	}
+	if (NULL != y4m->converted) {
+		for (i = 0; i < y4m->buffer_count; ++i) {
+			free(y4m->converted[i]);
+		}
+	}
+	free(y4m->converted);
+	free(y4m->buffers);
+	free(y4m->ends);
+	free(y4m->staging);
+	free(y4m);
+
+	return ret;
+}
+
+static int write_y4m_header(y4m_sink_t *y4m, uvcc_frame_layout_t const *layout) {
+	uint32_t const width    = layout->width;
+	uint32_t const height   = layout->height;
+	uint32_t const chroma_w = (width + 1) / 2;
+	uint32_t const chroma_h = (UVCC_PIX_FMT_YUV422P == y4m->pixel_format) ? height : (height + 1) / 2;
+	char const *chroma;
+	char header[128];
+	int n;
+	int ret;
+
+	switch (y4m->pixel_format) {
+	case UVCC_PIX_FMT_YUV422P:
+		chroma = "422";
+		break;
+	case UVCC_PIX_FMT_YUYV:
+	case UVCC_PIX_FMT_UYVY:
+		// chroma of even columns averaged over two rows.
+		chroma = "420mpeg2";
+		break;
+	default:
+		// siting of native 4:2:0 is unknown, take the default of the format.
+		chroma = "420jpeg";
+		break;
+	}
+
+	// the format has no tag for the matrix, only for the range.
+	n = snprintf(header, sizeof(header), "YUV4MPEG2 W%u H%u F%u:%u Ip A1:1 C%s XCOLORRANGE=%s\n",
+		width, height, y4m->rate_num, y4m->rate_den, chroma,
+		((UVCC_COLOR_BT601_FULL == y4m->color_space) || (UVCC_COLOR_BT709_FULL == y4m->color_space)) ? "FULL" : "LIMITED");
+	ret = write_fully(y4m->fd, header, n);
+	if (NOERROR != ret) {
+		return ret;
+	}
+	y4m->sent        += n;
+	y4m->frame_size   = width * height + 2 * chroma_w * chroma_h;
+	y4m->has_header   = 1;
+
+	return NOERROR;
+}
+
+/* Size of a frame whose planes already follow each other as YUV4MPEG2 stores them, 0 otherwise. */
+static uint32_t packed_y4m_size(uvcc_frame_layout_t const *layout) {
+	uvcc_plane_layout_t const *plane;
+	uint32_t size = 0;
+	uint32_t i;
+
+	if (((UVCC_PIX_FMT_YUV420 != layout->pixel_format) && (UVCC_PIX_FMT_YUV422P != layout->pixel_format)) || (3 != layout->plane_count)) {
+		return 0;
+	}
+	for (i = 0; i < layout->plane_count; ++i) {
+		plane = &layout->planes[i];
+		if ((plane->offset != size) || (plane->stride != plane->row_bytes)) {
+			return 0;
+		}
+		size += plane->row_bytes * plane->height;
+	}
+	return size;
+}
+
+static int convert_y4m_frame(y4m_sink_t const *y4m, uvcc_frame_t const *frame, uint8_t *dst) {
+	uvcc_frame_layout_t const *layout = frame->layout;
+	uint32_t const width    = layout->width;
+	uint32_t const height   = layout->height;
+	uint32_t const chroma_w = (width + 1) / 2;
+	uint32_t const chroma_h = (UVCC_PIX_FMT_YUV422P == y4m->pixel_format) ? height : (height + 1) / 2;
+	uint8_t * const u = dst + width * height;
+	uint8_t * const v = u + chroma_w * chroma_h;
+	uvcc_planes_t src;
+	uvcc_planes_t planes;
+	uint8_t const *row;
+	uint32_t i, x, y;
+	int ret;
+
+	ret = uvcc_get_frame_planes(frame, &src);
+	if (NOERROR != ret) {
+		return ret;
+	}
+
+	switch (layout->pixel_format) {
+	case UVCC_PIX_FMT_YUYV:
+	case UVCC_PIX_FMT_UYVY:
+		planes.data[0]   = dst;
+		planes.data[1]   = u;
+		planes.data[2]   = v;
+		planes.stride[0] = width;
+		planes.stride[1] = chroma_w;
+		planes.stride[2] = chroma_w;
+		return uvcc_convert_to_yuv420(src.data[0], src.stride[0], layout->pixel_format, &planes, UVCC_PIX_FMT_YUV420, width, height);
+	case UVCC_PIX_FMT_YUV420:
+	case UVCC_PIX_FMT_YUV422P:
+		for (i = 0; i < 3; ++i) {
+			for (y = 0; y < layout->planes[i].height; ++y) {
+				memcpy(dst, (uint8_t const*)src.data[i] + src.stride[i] * y, layout->planes[i].row_bytes);
+				dst += layout->planes[i].row_bytes;
+			}
+		}
+		return NOERROR;
+	case UVCC_PIX_FMT_NV12:
+	case UVCC_PIX_FMT_NV21:
+		for (y = 0; y < height; ++y) {
+			memcpy(dst + width * y, (uint8_t const*)src.data[0] + src.stride[0] * y, width);
+		}
+		// NV12 interleaves U first, NV21 V first.
+		for (y = 0; y < chroma_h; ++y) {
+			row = (uint8_t const*)src.data[1] + src.stride[1] * y;
+			for (x = 0; x < chroma_w; ++x) {
+				u[chroma_w * y + x] = row[2 * x + (UVCC_PIX_FMT_NV21 == layout->pixel_format)];
+				v[chroma_w * y + x] = row[2 * x + (UVCC_PIX_FMT_NV12 == layout->pixel_format)];
+			}
+		}
+		return NOERROR;
+	default:
+		return INVALID_FORMAT_ARGUMENTS;
+	}
+}
+
+static int send_y4m_frame(y4m_sink_t *y4m, void const *data, uint32_t size) {
+	static char const FRAME_HEADER[] = "FRAME\n";
+	struct iovec iov[2];
+	struct iovec *p = iov;
+	int count = 2;
+	ssize_t n;
+
+	iov[0].iov_base = (void*)FRAME_HEADER;
+	iov[0].iov_len  = sizeof(FRAME_HEADER) - 1;
+	iov[1].iov_base = (void*)data;
+	iov[1].iov_len  = size;
+
+	while (0 < count) {
+		n = y4m->splice ? vmsplice(y4m->fd, p, count, 0) : writev(y4m->fd, p, count);
+		if (0 > n) {
+			if (EINTR == errno) {
+				continue;
+			}
+			if (y4m->splice && ((EINVAL == errno) || (ENOSYS == errno))) {
+				// no vmsplice() here, copy like any other file.
+				y4m->splice = 0;
+				strcpy(y4m->engine, "write");
+				continue;
+			}
+			return IO_ERROR;
+		}
+		y4m->sent += n;
+		while ((0 < count) && ((size_t)n >= p->iov_len)) {
+			n -= p->iov_len;
+			++p;
+			--count;
+		}
+		if (0 < count) {
+			p->iov_base = (uint8_t*)p->iov_base + n;
+			p->iov_len -= n;
+		}
+	}
+	return NOERROR;
+}
+
+/* Count the oldest frames the reader has taken out of the pipe. */
+static int collect_frames(y4m_sink_t *y4m) {
+	int queued;
+	uint64_t consumed;
+
+	if (0 == y4m->inflight) {
+		return NOERROR;
+	}
+	if (0 != ioctl(y4m->fd, FIONREAD, &queued)) {
+		return IO_ERROR;
+	}
+	consumed = y4m->sent - (uint32_t)queued;
+	while ((0 < y4m->inflight) && (y4m->ends[y4m->oldest] <= consumed)) {
+		y4m->oldest = (y4m->oldest + 1) % y4m->buffer_count;
+		--y4m->inflight;
+		++y4m->completed;
+	}
+	return NOERROR;
+}
+
+static int write_fully(int fd, void const *data, size_t size) {
+	uint8_t const *p = (uint8_t const*)data;
+	ssize_t n;
+
+	while (0 < size) {
+		n = write(fd, p, size);
+		if (0 > n) {
+			if (EINTR == errno) {
+				continue;
+			}
+			return IO_ERROR;
+		}
+		p    += n;
+		size -= n;
+	}
+	return NOERROR;
+}
+
+static int pwrite_fully(int fd, void const *data, size_t size, uint64_t offset) {
+	uint8_t const *p = (uint8_t const*)data;
+	ssize_t n;
+
+	while (0 < size) {
+		n = pwrite(fd, p, size, (off_t)offset);
+		if (0 > n) {
+			if (EINTR == errno) {
+				continue;
+			}
+			return IO_ERROR;
+		}
+		p      += n;
+		size   -= n;
+		offset += n;
+	}
+	return NOERROR;
+}
@@ -0,0 +1,96 @@
+#ifndef UVCCAP_WRITER_H
+#define UVCCAP_WRITER_H
+
+#include<stdint.h>
+
+#include "uvccap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Where the writer thread puts frames. 'write' gets a copy of the frame
+ * whose data points to a writer buffer, which is reused once 'write'
+ * returns. Sinks writing in the background set 'reap' instead: 'write'
+ * only queues the frame and keeps its buffer until 'reap' counts it in
+ * 'done', the number of the oldest queued frames now written; 'wait'
+ * asks it to block until there is at least one.
+ * 'attach' (optional) learns every writer buffer before the first frame.
+ * 'close' runs on the thread closing the writer, after the last frame.
+ * 'engine' names how the sink writes, for messages.
+ */
+typedef struct writer_sink_t_ {
+	void       *ctx;
+	char const *engine;
+	int  (*attach)(void *ctx, uint8_t * const *buffers, uint32_t count, uint32_t size);
+	int  (*write)(void *ctx, uvcc_frame_t const *frame, uint32_t index);
+	int  (*reap)(void *ctx, int wait, uint32_t *done);
+	int  (*close)(void *ctx);
+} writer_sink_t;
+
+typedef struct writer_stats_t_ {
+	uint32_t frames;
+	uint32_t high_water;  // most frames queued at once.
+	uint64_t bytes;
+	uint64_t write_us;    // time spent in the sink, waiting for completions included.
+	uint64_t wait_us;     // time the capture side waited for a free buffer.
+	uint64_t elapsed_us;  // from creating to closing the writer.
+} writer_stats_t;
+
+typedef struct writer_t_ writer_t;
+
+/*
+ * Start a writer thread with 'buffer_count' buffers of 'buffer_size' bytes,
+ * aligned to WRITER_BUFFER_ALIGN. The capture side fills the buffer got
+ * from writer_get_buffer() and queues it with writer_submit(); both block
+ * only when every buffer is still queued. A failing sink makes both return
+ * its error from then on, with errno as the sink left it.
+ */
+#define WRITER_BUFFER_ALIGN 4096
+
+extern int  writer_create(writer_t **writer, writer_sink_t const *sink, uint32_t buffer_count, uint32_t buffer_size);
+extern int  writer_get_buffer(writer_t *writer, uint8_t **buf, uint32_t *buf_size);
+extern int  writer_submit(writer_t *writer, uvcc_frame_t const *frame, uint32_t size);
+/* Write what is queued, stop the thread and close the sink. */
+extern int  writer_close(writer_t *writer, writer_stats_t *stats);
+
+/*
+ * Sink appending frames to a segmented recording (uvcc_record.h). A new
+ * segment starts once the next frame would pass 'segment_bytes' or the
+ * segment spans 'segment_us' of timestamps (0 = no limit); segments are
+ * preallocated to 'segment_bytes' and trimmed when they are closed.
+ * The index is written in batches and whenever a segment is closed.
+ * WRITER_SEGMENTS_IO_URING submits the frames of a writer in batches
+ * through io_uring from registered buffers, and falls back to write()
+ * where io_uring is not available; frames written without a writer
+ * always use write().
+ * WRITER_SEGMENTS_DIRECT opens segments with O_DIRECT, keeping recordings
+ * out of the page cache: frames of a writer are written as whole
+ * UVCC_RECORD_ALIGN blocks straight from its buffers (padding beyond the
+ * size in the index is undefined). Filesystems without O_DIRECT and
+ * frames written without a writer go through the page cache.
+ * Errors are uvcc error codes with errno left as the failing call set it.
+ */
+#define WRITER_SEGMENTS_IO_URING 0x1
+#define WRITER_SEGMENTS_DIRECT   0x2
+
+extern int  writer_open_segments(writer_sink_t *sink, char const *prefix, uint64_t segment_bytes, uint64_t segment_us, uint32_t flags);
+
+/*
+ * Sink streaming YUV4MPEG2 to 'path' ("-" for stdout), e.g. a pipe or FIFO
+ * read by an encoder. The header takes the size of the first frame, the
+ * rate of 'rate_num'/'rate_den' frames per second and the range of
+ * 'color_space' (UVCC_COLOR_*). YUV420 and YUV422P frames go out as they
+ * are, NV12, NV21, YUYV and UYVY as 4:2:0; other formats fail with
+ * INVALID_FORMAT_ARGUMENTS. Frames of a writer are vmsplice()d into a
+ * pipe instead of copied, and their buffers reused once the reader has
+ * read them; everything else is written with write().
+ */
+extern int  writer_open_y4m(writer_sink_t *sink, char const *path, uint32_t pixel_format, uint32_t rate_num, uint32_t rate_den, uint32_t color_space);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif